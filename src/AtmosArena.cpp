@@ -0,0 +1,105 @@
+﻿#include "AtmosArena.h"
+#include <algorithm>
+#include <stdint.h>
+
+arenaStatsData::arenaStatsData() :blocks(0), reservedBytes(0), usedBytes(0), peakBytes(0), allocations(0), resets(0)
+{
+
+}
+
+void arenaStatsData::add(const arenaStatsData& other)
+{
+    blocks += other.blocks;
+    reservedBytes += other.reservedBytes;
+    usedBytes += other.usedBytes;
+    peakBytes += other.peakBytes;
+    allocations += other.allocations;
+    resets += other.resets;
+}
+
+AtmosArena::AtmosArena(size_t blockSize) :current(0), offset(0), blockSize(blockSize)
+{
+
+}
+
+AtmosArena::~AtmosArena()
+{
+    release();
+}
+
+void* AtmosArena::allocate(size_t size, size_t alignment)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if(size == 0)
+        size = 1;
+
+    // 从当前内存块开始 依次寻找放得下的内存块
+    for(; current < blocks.size(); current++, offset = 0)
+    {
+        blockData& block = blocks[current];
+
+        uintptr_t base = (uintptr_t) block.data;
+        size_t start = (size_t) (((base + offset + alignment - 1) & ~(uintptr_t) (alignment - 1)) - base);
+        if(start + size <= block.size)
+        {
+            stats.usedBytes += start + size - offset;
+            stats.peakBytes = std::max(stats.peakBytes, stats.usedBytes);
+            stats.allocations++;
+
+            offset = start + size;
+            return block.data + start;
+        }
+    }
+
+    // 超过块大小的分配单独占用一块 reset后同样复用
+    blockData block;
+    block.size = std::max(blockSize, size + alignment);
+    block.data = (char*) ::operator new(block.size);
+    blocks.push_back(block);
+
+    stats.blocks++;
+    stats.reservedBytes += block.size;
+
+    current = blocks.size() - 1;
+    uintptr_t base = (uintptr_t) block.data;
+    size_t start = (size_t) (((base + alignment - 1) & ~(uintptr_t) (alignment - 1)) - base);
+
+    stats.usedBytes += start + size;
+    stats.peakBytes = std::max(stats.peakBytes, stats.usedBytes);
+    stats.allocations++;
+
+    offset = start + size;
+    return block.data + start;
+}
+
+void AtmosArena::reset()
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    current = 0;
+    offset = 0;
+    stats.usedBytes = 0;
+    stats.resets++;
+}
+
+void AtmosArena::release()
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    for(auto& block : blocks)
+        ::operator delete(block.data);
+    blocks.clear();
+
+    current = 0;
+    offset = 0;
+    stats.blocks = 0;
+    stats.reservedBytes = 0;
+    stats.usedBytes = 0;
+}
+
+arenaStatsData AtmosArena::getStats() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return stats;
+}
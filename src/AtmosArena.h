@@ -0,0 +1,105 @@
+﻿#pragma once
+
+#include <vector>
+#include <mutex>
+#include <stddef.h>
+
+// 默认内存块大小
+#define A3_ARENA_BLOCK_SIZE (4 << 20)
+
+struct arenaStatsData
+{
+    arenaStatsData();
+
+    void add(const arenaStatsData& other);
+
+    // 内存块数 / 已申请字节数 / 当前分配字节数 / 分配字节数峰值
+    size_t blocks, reservedBytes, usedBytes, peakBytes;
+
+    long long allocations, resets;
+};
+
+// 帧内存池 按顺序分配 释放单个对象时不回收
+// reset()一次回收全部分配并保留内存块 之后的关键帧复用同一批内存块
+// 分配可由多个线程调用
+class AtmosArena
+{
+public:
+    AtmosArena(size_t blockSize = A3_ARENA_BLOCK_SIZE);
+    ~AtmosArena();
+
+    void* allocate(size_t size, size_t alignment = 16);
+
+    // 回收全部分配 在此分配的对象必须已析构
+    void reset();
+
+    // 释放全部内存块
+    void release();
+
+    arenaStatsData getStats() const;
+
+private:
+    AtmosArena(const AtmosArena&);
+    AtmosArena& operator=(const AtmosArena&);
+
+    struct blockData
+    {
+        char* data;
+        size_t size;
+    };
+
+    mutable std::mutex lock;
+
+    std::vector<blockData> blocks;
+
+    // 当前分配所在的内存块及其已用字节数
+    size_t current, offset;
+
+    size_t blockSize;
+    arenaStatsData stats;
+};
+
+// 可选从AtmosArena分配的STL分配器 arena为NULL时使用堆
+template<typename T>
+class AtmosArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    AtmosArenaAllocator(AtmosArena* arena = NULL) :arena(arena) {}
+
+    template<typename U>
+    AtmosArenaAllocator(const AtmosArenaAllocator<U>& other) :arena(other.arena) {}
+
+    T* allocate(size_t n)
+    {
+        if(arena)
+            return (T*) arena->allocate(n * sizeof(T), alignof(T) > 16 ? alignof(T) : 16);
+
+        return (T*) ::operator new(n * sizeof(T));
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        // 由arena统一回收
+        if(!arena)
+            ::operator delete(p);
+    }
+
+    template<typename U>
+    bool operator==(const AtmosArenaAllocator<U>& other) const
+    {
+        return arena == other.arena;
+    }
+
+    template<typename U>
+    bool operator!=(const AtmosArenaAllocator<U>& other) const
+    {
+        return arena != other.arena;
+    }
+
+    AtmosArena* arena;
+};
+
+template<typename T>
+using arenaVector = std::vector<T, AtmosArenaAllocator<T>>;
@@ -0,0 +1,321 @@
+﻿#include "AtmosBatch.h"
+#include "AtmosSceneIO.h"
+#include "AtmosSceneBuilder.h"
+#include "AtmosTileScheduler.h"
+#include "AtmosStats.h"
+#include "AtmosCheckpoint.h"
+#include "AtmosFrameCache.h"
+#include "AtmosDenoise.h"
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+#define A3_MAX_FRAMES_IN_FLIGHT 8
+
+// 每帧至少保留每线程2个网格以便窃取平衡 剩余核心用于同时渲染更多帧
+static int getFramesInFlight(const renderConfigData& config, int cores, int frameCount)
+{
+    int slots = config.framesInFlight;
+    if(slots <= 0)
+    {
+        int tiles = std::max(1, config.level[0] * config.level[1]);
+        int workersPerFrame = std::max(1, tiles / 2);
+        slots = std::min(cores / workersPerFrame, A3_MAX_FRAMES_IN_FLIGHT);
+    }
+
+    return std::max(1, std::min(std::min(slots, cores), frameCount));
+}
+
+static void saveFrame(const renderConfigData& config, int frame, AtmosFrameWriter& writer,
+                      AtmosFrameWriter::frameData* output, AtmosTileScheduler& scheduler,
+                      AtmosStats& stats, frameStatsData frameStats, uint64_t fingerprint)
+{
+    frameStats.seconds[A3_PHASE_RENDER] = scheduler.getElapsedSeconds();
+    frameStats.tiles = scheduler.getTileStats();
+
+    double render = std::max(frameStats.seconds[A3_PHASE_RENDER], 1e-6);
+    a3Log::debug("Frame %d: import %s, bvh %s, render %s, %.2fM samples/s, %.2fM rays/s\n", frame,
+                 formatSeconds(frameStats.seconds[A3_PHASE_IMPORT]).c_str(),
+                 formatSeconds(frameStats.seconds[A3_PHASE_BVH]).c_str(),
+                 formatSeconds(frameStats.seconds[A3_PHASE_RENDER]).c_str(),
+                 frameStats.tiles.samples / render * 1e-6, frameStats.tiles.rays / render * 1e-6);
+
+    // 保存耗时在写入线程中得到 之后才写入日志
+    std::string path = output->path;
+    output->onSaved = [&stats, &config, frameStats, path, fingerprint](bool saved, double seconds) mutable
+    {
+        frameStats.seconds[A3_PHASE_SAVE] = seconds;
+        frameStats.saved = saved;
+        stats.finishFrame(frameStats);
+
+        // 之后的运行跳过此帧
+        if(saved)
+            commitFrame(config, path, fingerprint);
+    };
+
+    // 编码保存与后续帧的渲染重叠
+    writer.endFrame(output);
+
+    if(config.enableAdaptive && config.saveHeatmap)
+        writer.writeHeatmap(scheduler.getFrameBuffer(), config.getHeatmapPath(frame), config.spp);
+}
+
+// 去噪后重新写入输出帧
+static void denoiseFrame(const renderConfigData& config, int frame, a3GridRenderer* renderer,
+                         AtmosTileScheduler& scheduler, AtmosFrameWriter::frameData* output,
+                         AtmosDenoiser& denoiser, frameStatsData& frameStats)
+{
+    if(!config.enableDenoise)
+        return;
+
+    auto begin = std::chrono::high_resolution_clock::now();
+
+    tileData region = denoiser.denoise(config, scheduler.getFrameBuffer(), renderer->colorList, frame);
+    AtmosFrameWriter::writeTile(output, renderer->colorList, config.imageWidth, region);
+
+    frameStats.seconds[A3_PHASE_DENOISE] = elapsedSeconds(begin);
+}
+
+static AtmosFrameWriter::frameData* beginFrame(const renderConfigData& config, int frame, AtmosFrameWriter& writer,
+                                               AtmosTileScheduler& scheduler, uint64_t fingerprint)
+{
+    AtmosFrameWriter::frameData* output = writer.beginFrame(config.getSavePath(frame), config.imageWidth, config.imageHeight,
+                                                            config.enableToneMapping, config.enableGammaCorrection);
+
+    // 中断的帧从检查点继续
+    if(config.enableResume)
+        scheduler.setCheckpoint(getCheckpointPath(output->path), fingerprint);
+
+    return output;
+}
+
+// 逐帧渲染 全部核心用于当前帧
+static void renderSerial(const renderConfigData& config,
+                         const std::vector<shapeData*>& shapeList,
+                         const std::vector<lightData*>& lightList,
+                         int endFrame,
+                         AtmosSceneBuilder& atmos,
+                         AtmosFrameWriter& writer,
+                         AtmosStats& stats)
+{
+    AtmosTileScheduler scheduler;
+    AtmosDenoiser denoiser;
+
+    // 跳过输出已是最新的帧
+    int frame = findNextFrame(config, shapeList, lightList, config.startFrame, endFrame);
+    while(frame <= endFrame)
+    {
+        a3Log::debug("Frame %d / %d\n", frame, endFrame);
+
+        uint64_t fingerprint = 0;
+        if(config.enableResume || config.enableFrameCache)
+            fingerprint = getFrameFingerprint(config, shapeList, lightList, frame);
+
+        frameStatsData frameStats;
+        frameStats.frame = frame;
+
+        atmos.build(config, shapeList, lightList, frame);
+        frameStats.seconds[A3_PHASE_IMPORT] = atmos.importSeconds;
+        frameStats.seconds[A3_PHASE_BVH] = atmos.bvhSeconds;
+        frameStats.arena = atmos.getArenaStats();
+
+        AtmosFrameWriter::frameData* output = beginFrame(config, frame, writer, scheduler, fingerprint);
+
+        // 全部网格分配至所有核心并行渲染 不受窗口刷新率限制
+        scheduler.start(atmos.renderer, atmos.scene, config, false, output);
+
+        // 渲染当前帧的同时查找并导入下一关键帧
+        atmos.prefetch(config, shapeList, lightList, frame + 1, endFrame);
+
+        scheduler.wait();
+
+        denoiseFrame(config, frame, atmos.renderer, scheduler, output, denoiser, frameStats);
+        saveFrame(config, frame, writer, output, scheduler, stats, frameStats, fingerprint);
+
+        // 在真正跳过时才取出缓存帧
+        int next = findNextFrame(config, shapeList, lightList, frame + 1, endFrame);
+
+        // 保存完成前本帧尚未计入平均值 以本帧耗时代替
+        if(next <= endFrame)
+        {
+            double seconds = frameStats.getFrameSeconds() + scheduler.getElapsedSeconds();
+            double remaining = stats.getSequenceRemaining(seconds, 0.0, endFrame - next + 1);
+            a3Log::debug("Sequence remaining: %s\n", formatSeconds(remaining).c_str());
+        }
+
+        frame = next;
+    }
+}
+
+// 帧并行渲染 网格数不足以占满全部核心时同时渲染多帧
+// 每帧持有独立的renderer与关键帧模型 静态几何与光源共享
+static void renderParallel(const renderConfigData& config,
+                           const std::vector<shapeData*>& shapeList,
+                           const std::vector<lightData*>& lightList,
+                           int endFrame,
+                           int slotCount,
+                           int cores,
+                           AtmosSceneBuilder& atmos,
+                           AtmosFrameWriter& writer,
+                           AtmosStats& stats)
+{
+    struct slotData
+    {
+        slotData() :scheduler(NULL), context(NULL), output(NULL), fingerprint(0) {}
+
+        AtmosTileScheduler* scheduler;
+        AtmosSceneBuilder::frameContextData* context;
+        AtmosFrameWriter::frameData* output;
+        frameStatsData frameStats;
+        uint64_t fingerprint;
+    };
+
+    a3Log::debug("%d frames in flight\n", slotCount);
+
+    // 各帧依次去噪 时间域混合仅在上一帧恰好先完成时生效
+    AtmosDenoiser denoiser(cores);
+
+    // 核心平均分配至各帧
+    std::vector<slotData> slots(slotCount);
+    for(int i = 0; i < slotCount; i++)
+        slots[i].scheduler = new AtmosTileScheduler(cores / slotCount + (i < cores % slotCount ? 1 : 0));
+
+    // 跳过输出已是最新的帧
+    int next = findNextFrame(config, shapeList, lightList, config.startFrame, endFrame);
+    auto launch = [&](slotData& slot)
+    {
+        a3Log::debug("Frame %d / %d\n", next, endFrame);
+
+        slot.fingerprint = 0;
+        if(config.enableResume || config.enableFrameCache)
+            slot.fingerprint = getFrameFingerprint(config, shapeList, lightList, next);
+
+        slot.context = atmos.buildFrame(config, shapeList, lightList, next);
+
+        slot.frameStats = frameStatsData();
+        slot.frameStats.frame = next;
+        slot.frameStats.seconds[A3_PHASE_IMPORT] = atmos.importSeconds;
+        slot.frameStats.seconds[A3_PHASE_BVH] = atmos.bvhSeconds;
+        slot.frameStats.arena = atmos.getArenaStats();
+
+        slot.output = beginFrame(config, next, writer, *slot.scheduler, slot.fingerprint);
+        slot.scheduler->start(slot.context->renderer, slot.context->scene, config, false, slot.output);
+
+        next = findNextFrame(config, shapeList, lightList, next + 1, endFrame);
+    };
+
+    for(auto& slot : slots)
+    {
+        if(next <= endFrame)
+            launch(slot);
+    }
+
+    bool running = true;
+    while(running)
+    {
+        running = false;
+        for(auto& slot : slots)
+        {
+            if(!slot.context)
+                continue;
+
+            if(slot.scheduler->isFinished())
+            {
+                slot.scheduler->wait();
+
+                denoiseFrame(config, slot.context->frame, slot.context->renderer, *slot.scheduler, slot.output, denoiser, slot.frameStats);
+                saveFrame(config, slot.context->frame, writer, slot.output, *slot.scheduler, stats, slot.frameStats, slot.fingerprint);
+
+                if(next <= endFrame)
+                {
+                    double seconds = slot.frameStats.getFrameSeconds() + slot.scheduler->getElapsedSeconds();
+                    double remaining = stats.getSequenceRemaining(seconds, 0.0, endFrame - next + 1, slotCount);
+                    a3Log::debug("Sequence remaining: %s\n", formatSeconds(remaining).c_str());
+                }
+
+                atmos.releaseFrame(slot.context);
+                slot.context = NULL;
+                slot.output = NULL;
+
+                if(next <= endFrame)
+                    launch(slot);
+            }
+
+            running = running || slot.context != NULL;
+        }
+
+        if(running)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    for(auto& slot : slots)
+        delete slot.scheduler;
+}
+
+int batchRender(int argc, char* argv[])
+{
+    if(argc < 1)
+    {
+        a3Log::error("用法: AtmosMovie -batch scene.atmos [startFrame endFrame]\n");
+        return 1;
+    }
+
+    renderConfigData config;
+    std::vector<shapeData*> shapeList;
+    std::vector<lightData*> lightList;
+
+    if(!loadScene(argv[0], config, shapeList, lightList))
+        return 1;
+
+    // 命令行指定的帧范围优先于场景文件
+    if(argc >= 3)
+    {
+        config.startFrame = ofToInt(argv[1]);
+        config.endFrame = ofToInt(argv[2]);
+    }
+
+    // 与编辑器一致: 无关键帧时仅渲染起始帧
+    int endFrame = config.hasKeyFrame ? config.endFrame : config.startFrame;
+    int failed = 0;
+
+    int cores = std::max(1, (int) std::thread::hardware_concurrency());
+    int slots = getFramesInFlight(config, cores, endFrame - config.startFrame + 1);
+
+    AtmosSceneBuilder atmos;
+
+    // 需晚于writer析构: 写入线程保存完成时写入统计
+    AtmosStats stats;
+    stats.begin(config.getStatsPath());
+
+    // 在途帧数需大于同时渲染的帧数 另留出热力图的余量
+    AtmosFrameWriter writer(slots + 2);
+
+    if(slots > 1)
+        renderParallel(config, shapeList, lightList, endFrame, slots, cores, atmos, writer, stats);
+    else
+        renderSerial(config, shapeList, lightList, endFrame, atmos, writer, stats);
+
+    writer.flush();
+
+    for(int frame = config.startFrame; frame <= endFrame; frame++)
+    {
+        string path = config.getSavePath(frame);
+        if(!ofFile::doesFileExist(path, false))
+        {
+            a3Log::error("关键帧%d保存失败: %s\n", frame, path.c_str());
+            failed++;
+        }
+    }
+
+    atmos.release();
+
+    for(auto s : shapeList)
+        delete s;
+    shapeList.clear();
+
+    for(auto l : lightList)
+        delete l;
+    lightList.clear();
+
+    return failed == 0 ? 0 : 1;
+}
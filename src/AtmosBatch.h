@@ -0,0 +1,6 @@
+﻿#pragma once
+
+// 命令行批量渲染 无需OpenGL窗口与ImGui
+// 参数: 场景文件路径 [起始帧 结束帧]
+// 返回值: 0为全部关键帧渲染并保存成功 非0为失败
+int batchRender(int argc, char* argv[]);
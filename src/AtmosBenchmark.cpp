@@ -0,0 +1,71 @@
+﻿#include "AtmosBenchmark.h"
+#include "AtmosQuantize.h"
+#include <stdio.h>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <ofMain.h>
+
+typedef void(*quantizeFunction)(const a3Spectrum*, int, const tileData&, unsigned char*, int, const quantizeOptions&);
+
+// 多次运行取最短耗时(ms)
+static double measure(quantizeFunction function, const std::vector<a3Spectrum>& colorList,
+                      int width, int height, std::vector<unsigned char>& pixels, const quantizeOptions& options)
+{
+    const int repeat = 10;
+
+    double best = 1e30;
+    for(int i = 0; i < repeat; i++)
+    {
+        auto begin = std::chrono::high_resolution_clock::now();
+
+        function(colorList.data(), width, tileData(0, 0, width, height), pixels.data(), width * 3, options);
+
+        std::chrono::duration<double, std::milli> ms = std::chrono::high_resolution_clock::now() - begin;
+        best = std::min(best, ms.count());
+    }
+
+    return best;
+}
+
+int benchmarkRender(int argc, char* argv[])
+{
+    int width = argc >= 2 ? ofToInt(argv[0]) : 3840;
+    int height = argc >= 2 ? ofToInt(argv[1]) : 2160;
+    if(width <= 0 || height <= 0)
+    {
+        a3Log::error("用法: AtmosMovie -benchmark [width height]\n");
+        return 1;
+    }
+
+    // 含负值与超出1的HDR颜色
+    std::vector<a3Spectrum> colorList((size_t) width * height);
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> range(-0.1f, 4.0f);
+    for(auto& c : colorList)
+        c = a3Spectrum(range(random), range(random), range(random));
+
+    std::vector<unsigned char> scalar((size_t) width * height * 3), simd((size_t) width * height * 3);
+
+    printf("Quantize %dx%d, kernel: %s\n", width, height, getQuantizeKernelName());
+
+    const char* names[] = {"Clamp", "Tone Mapping", "Gamma", "Tone Mapping + Gamma"};
+    int failed = 0;
+    for(int i = 0; i < 4; i++)
+    {
+        quantizeOptions options((i & 1) != 0, (i & 2) != 0);
+
+        double scalarTime = measure(quantizeTileScalar, colorList, width, height, scalar, options);
+        double simdTime = measure(quantizeTile, colorList, width, height, simd, options);
+
+        // SIMD结果需与标量逐字节一致
+        bool same = scalar == simd;
+        if(!same)
+            failed++;
+
+        printf("%-22s scalar %8.3f ms  %s %8.3f ms  x%.2f  %s\n", names[i],
+               scalarTime, getQuantizeKernelName(), simdTime, scalarTime / simdTime, same ? "OK" : "MISMATCH");
+    }
+
+    return failed == 0 ? 0 : 1;
+}
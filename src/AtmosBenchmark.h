@@ -0,0 +1,6 @@
+﻿#pragma once
+
+// 命令行性能测试 无需OpenGL窗口
+// 参数: [图像宽度 图像高度]
+// 比较量化内核的SIMD与标量实现 结果不一致时返回非0
+int benchmarkRender(int argc, char* argv[]);
@@ -0,0 +1,233 @@
+﻿#include "AtmosCheckpoint.h"
+#include "AtmosSceneIO.h"
+#include "AtmosHash.h"
+#include "AtmosFrameCache.h"
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+
+#define A3_CHECKPOINT_VERSION 1
+
+struct checkpointHeaderData
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t fingerprint;
+
+    int32_t width, height;
+    int32_t levelX, levelY;
+    int32_t tileCount;
+    int32_t reserved;
+};
+
+uint64_t getFrameFingerprint(const renderConfigData& config,
+                             const std::vector<shapeData*>& shapeList,
+                             const std::vector<lightData*>& lightList,
+                             int frame)
+{
+    // 仅影响渲染顺序 / 调度 / 输出位置的参数不计入
+    renderConfigData normalized = config;
+    normalized.startFrame = 0;
+    normalized.endFrame = 0;
+    normalized.enableProgressive = false;
+    normalized.framesInFlight = 0;
+    normalized.saveHeatmap = false;
+    normalized.enableResume = false;
+    normalized.checkpointInterval = 0;
+    normalized.enableFrameCache = false;
+    normalized.level[0] = normalized.level[1] = 0;
+    normalized.saveToPath[0] = '\0';
+
+    uint64_t hash = fnv1a(sceneToString(normalized, shapeList, lightList));
+
+    // 关键帧模型的路径随帧号变化
+    hash = fnv1a(&frame, sizeof(frame), hash);
+
+    // 场景中仅记录路径 文件内容改变时同样需要重新渲染
+    std::vector<std::string> files;
+    for(auto s : shapeList)
+    {
+        if(s->name != "Mesh")
+            continue;
+
+        const meshData* data = (const meshData*) s;
+        files.push_back(data->supportKeyFrame ? addKeyFrameInPath(frame, data->modelPath) : data->modelPath);
+    }
+
+    for(auto l : lightList)
+    {
+        if(l->name == "Inifinite Area Light")
+            files.push_back(((const infiniteAreaLightData*) l)->imagePath);
+    }
+
+    for(auto& file : files)
+    {
+        // 文件缺失同样计入 之后出现时指纹随之改变
+        uint64_t content = 0;
+        hashSourceFile(file, &content);
+        hash = fnv1a(&content, sizeof(content), hash);
+    }
+
+    return hash;
+}
+
+static std::string getFingerprintPath(const std::string& path)
+{
+    return path + ".a3fp";
+}
+
+bool isFrameUpToDate(const std::string& path, uint64_t fingerprint)
+{
+    if(!ofFile::doesFileExist(path, false))
+        return false;
+
+    std::ifstream in(getFingerprintPath(path).c_str());
+    unsigned long long saved = 0;
+    if(!(in >> std::hex >> saved))
+        return false;
+
+    return saved == fingerprint;
+}
+
+bool writeFrameFingerprint(const std::string& path, uint64_t fingerprint)
+{
+    remove(getCheckpointPath(path).c_str());
+
+    std::ofstream out(getFingerprintPath(path).c_str());
+    out << std::hex << (unsigned long long) fingerprint << "\n";
+
+    return out.good();
+}
+
+std::string getCheckpointPath(const std::string& path)
+{
+    return path + ".a3ckpt";
+}
+
+int findNextFrame(const renderConfigData& config,
+                  const std::vector<shapeData*>& shapeList,
+                  const std::vector<lightData*>& lightList,
+                  int from, int last)
+{
+    if(!config.enableResume && !config.enableFrameCache)
+        return from;
+
+    for(int frame = from; frame <= last; frame++)
+    {
+        std::string path = config.getSavePath(frame);
+        uint64_t fingerprint = getFrameFingerprint(config, shapeList, lightList, frame);
+
+        if(config.enableResume && isFrameUpToDate(path, fingerprint))
+            a3Log::debug("跳过已完成的关键帧%d\n", frame);
+        else if(restoreCachedFrame(config, path, fingerprint))
+            a3Log::debug("关键帧%d从缓存取出\n", frame);
+        else
+            return frame;
+    }
+
+    return last + 1;
+}
+
+int findPendingFrame(const renderConfigData& config,
+                     const std::vector<shapeData*>& shapeList,
+                     const std::vector<lightData*>& lightList,
+                     int from, int last)
+{
+    if(!config.enableResume && !config.enableFrameCache)
+        return from;
+
+    for(int frame = from; frame <= last; frame++)
+    {
+        std::string path = config.getSavePath(frame);
+        uint64_t fingerprint = getFrameFingerprint(config, shapeList, lightList, frame);
+
+        if(!(config.enableResume && isFrameUpToDate(path, fingerprint)) && !hasCachedFrame(config, path, fingerprint))
+            return frame;
+    }
+
+    return last + 1;
+}
+
+bool saveCheckpoint(const std::string& path, const checkpointData& checkpoint)
+{
+    const AtmosFrameBuffer& buffer = checkpoint.buffer;
+    size_t pixels = (size_t) buffer.width * buffer.height;
+    if(buffer.sum.size() != pixels || buffer.count.size() != pixels ||
+       buffer.mean.size() != pixels || buffer.m2.size() != pixels)
+        return false;
+
+    checkpointHeaderData header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "A3CP", 4);
+    header.version = A3_CHECKPOINT_VERSION;
+    header.fingerprint = checkpoint.fingerprint;
+    header.width = buffer.width;
+    header.height = buffer.height;
+    header.levelX = checkpoint.levelX;
+    header.levelY = checkpoint.levelY;
+    header.tileCount = (int32_t) checkpoint.tileSamples.size();
+
+    std::string tempPath = path + ".tmp";
+
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if(!file)
+        return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(checkpoint.tileSamples.data(), sizeof(int), checkpoint.tileSamples.size(), file) == checkpoint.tileSamples.size() &&
+              fwrite(buffer.sum.data(), sizeof(a3Spectrum), pixels, file) == pixels &&
+              fwrite(buffer.count.data(), sizeof(int), pixels, file) == pixels &&
+              fwrite(buffer.mean.data(), sizeof(float), pixels, file) == pixels &&
+              fwrite(buffer.m2.data(), sizeof(float), pixels, file) == pixels;
+    ok = (fclose(file) == 0) && ok;
+
+    if(ok)
+    {
+        remove(path.c_str());
+        ok = rename(tempPath.c_str(), path.c_str()) == 0;
+    }
+
+    if(!ok)
+        remove(tempPath.c_str());
+
+    return ok;
+}
+
+bool loadCheckpoint(const std::string& path, checkpointData& checkpoint)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if(!file)
+        return false;
+
+    checkpointHeaderData header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              memcmp(header.magic, "A3CP", 4) == 0 &&
+              header.version == A3_CHECKPOINT_VERSION &&
+              header.width > 0 && header.height > 0 && header.tileCount > 0;
+
+    if(ok)
+    {
+        size_t pixels = (size_t) header.width * header.height;
+
+        checkpoint.fingerprint = header.fingerprint;
+        checkpoint.levelX = header.levelX;
+        checkpoint.levelY = header.levelY;
+        checkpoint.tileSamples.resize(header.tileCount);
+
+        AtmosFrameBuffer& buffer = checkpoint.buffer;
+        buffer.resize(header.width, header.height);
+
+        ok = fread(checkpoint.tileSamples.data(), sizeof(int), header.tileCount, file) == (size_t) header.tileCount &&
+             fread(buffer.sum.data(), sizeof(a3Spectrum), pixels, file) == pixels &&
+             fread(buffer.count.data(), sizeof(int), pixels, file) == pixels &&
+             fread(buffer.mean.data(), sizeof(float), pixels, file) == pixels &&
+             fread(buffer.m2.data(), sizeof(float), pixels, file) == pixels;
+    }
+
+    fclose(file);
+
+    if(!ok)
+        a3Log::warning("检查点无效: %s\n", path.c_str());
+
+    return ok;
+}
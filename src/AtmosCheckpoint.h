@@ -0,0 +1,62 @@
+﻿#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "AtmosShapeData.h"
+#include "AtmosLightData.h"
+#include "AtmosRenderConfig.h"
+#include "AtmosFrameBuffer.h"
+
+// 断点续渲
+// 帧指纹: 影响该帧像素的全部场景参数与帧号的哈希
+// 保存成功的帧旁写入指纹文件(X.png.a3fp) 重新渲染时输出存在且指纹一致即跳过
+// 渲染中途定期写入检查点(X.png.a3ckpt): 逐像素累积结果与每个网格已完成的采样数
+uint64_t getFrameFingerprint(const renderConfigData& config,
+                             const std::vector<shapeData*>& shapeList,
+                             const std::vector<lightData*>& lightList,
+                             int frame);
+
+// 输出文件存在且指纹一致
+bool isFrameUpToDate(const std::string& path, uint64_t fingerprint);
+
+// 帧保存成功后调用 同时删除该帧的检查点
+bool writeFrameFingerprint(const std::string& path, uint64_t fingerprint);
+
+std::string getCheckpointPath(const std::string& path);
+
+// from至last中第一个需要渲染的帧 均已完成时返回last + 1
+// 跳过输出已是最新的帧 帧缓存中存在时直接取出
+int findNextFrame(const renderConfigData& config,
+                  const std::vector<shapeData*>& shapeList,
+                  const std::vector<lightData*>& lightList,
+                  int from, int last);
+
+// 与findNextFrame相同的判断 但不从帧缓存取出 不修改任何文件
+// 用于渲染当前帧期间预先查找下一帧
+int findPendingFrame(const renderConfigData& config,
+                     const std::vector<shapeData*>& shapeList,
+                     const std::vector<lightData*>& lightList,
+                     int from, int last);
+
+// 一帧渲染中途的状态
+struct checkpointData
+{
+    checkpointData() :fingerprint(0), levelX(0), levelY(0) {}
+
+    uint64_t fingerprint;
+
+    // 网格划分 与当前划分不一致时无法恢复
+    int levelX, levelY;
+
+    // 每个网格已完成的累计采样数
+    std::vector<int> tileSamples;
+
+    AtmosFrameBuffer buffer;
+};
+
+// 先写入临时文件再替换 中断时保留上一次的检查点
+bool saveCheckpoint(const std::string& path, const checkpointData& checkpoint);
+
+// 文件不存在 / 损坏 / 版本不符时返回false
+bool loadCheckpoint(const std::string& path, checkpointData& checkpoint);
@@ -0,0 +1,364 @@
+﻿#include "AtmosDenoise.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <math.h>
+
+// 滤波遍数 最后一遍的间隔为2^(n - 1)
+#define A3_DENOISE_ITERATIONS 5
+
+// 每个线程一次处理的块
+#define A3_DENOISE_TILE_SIZE 64
+
+// 亮度 / 法线 / 深度 / 反射率的权重参数
+#define A3_DENOISE_SIGMA_LUMINANCE 4.0f
+#define A3_DENOISE_NORMAL_POWER 7
+#define A3_DENOISE_SIGMA_DEPTH 1.0f
+#define A3_DENOISE_SIGMA_ALBEDO 0.1f
+
+// 时间域混合中当前帧的比例
+#define A3_DENOISE_TEMPORAL_ALPHA 0.2f
+
+// 历史颜色限制在邻域均值±k倍标准差内
+#define A3_DENOISE_TEMPORAL_CLAMP 1.5f
+
+static const float kernel[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+static inline float luminance(const a3Spectrum& c)
+{
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+// (n0 . n1)^(2^A3_DENOISE_NORMAL_POWER)
+static inline float normalWeight(const t3Vector3f& n0, const t3Vector3f& n1)
+{
+    float w = std::max(0.0f, n0.dot(n1));
+    for(int i = 0; i < A3_DENOISE_NORMAL_POWER; i++)
+        w *= w;
+
+    return w;
+}
+
+AtmosDenoiser::AtmosDenoiser(int numThreads) :numThreads(numThreads), width(0), height(0), hasHistory(false), historyFrame(0)
+{
+    if(this->numThreads <= 0)
+        this->numThreads = std::max(1, (int) std::thread::hardware_concurrency());
+}
+
+int AtmosDenoiser::getRadius()
+{
+    // 各遍的核半径2 * 2^i之和 加上深度梯度的1个像素
+    return 2 * ((1 << A3_DENOISE_ITERATIONS) - 1) + 1;
+}
+
+void AtmosDenoiser::reset()
+{
+    hasHistory = false;
+    historyColor.clear();
+    historyGuides.clear();
+}
+
+tileData AtmosDenoiser::denoise(const renderConfigData& config, const AtmosFrameBuffer& buffer, a3Spectrum* colorList, int frame)
+{
+    tileData region;
+    region.x = std::max(0, config.localStartPos[0]);
+    region.y = std::max(0, config.localStartPos[1]);
+    region.width = std::max(0, std::min(config.localRenderSize[0], buffer.width - region.x));
+    region.height = std::max(0, std::min(config.localRenderSize[1], buffer.height - region.y));
+
+    width = region.width;
+    height = region.height;
+
+    size_t size = (size_t) width * height;
+    if(size == 0)
+        return region;
+
+    guides.resize(size);
+    depthGradient.resize(size);
+    for(int i = 0; i < 2; i++)
+    {
+        color[i].resize(size);
+        variance[i].resize(size);
+    }
+
+    // 区域内的颜色 / 均值的方差 / 辅助缓冲
+    parallelFor(height, [&](int y)
+    {
+        for(int x = 0; x < width; x++)
+        {
+            int index = (region.x + x) + (region.y + y) * buffer.width;
+            size_t i = (size_t) x + (size_t) y * width;
+
+            int n = buffer.count[index];
+            color[0][i] = buffer.getColor(index);
+
+            // 仅一个采样时以亮度本身作为标准差
+            float l = luminance(color[0][i]);
+            variance[0][i] = n > 1 ? buffer.m2[index] / (n - 1) / n : l * l;
+
+            guideData& g = guides[i];
+            g.valid = n > 0;
+            g.hasAOV = buffer.hasAOV() && buffer.aovCount[index] > 0;
+            g.normal = g.hasAOV ? buffer.getNormal(index) : t3Vector3f();
+            g.albedo = g.hasAOV ? buffer.getAlbedo(index) : a3Spectrum();
+            g.depth = g.hasAOV ? buffer.getDepth(index) : 0.0f;
+            g.hit = g.hasAOV && g.depth > 0.0f;
+        }
+    });
+
+    // 深度在屏幕空间的梯度 用于放宽倾斜表面的深度权重
+    parallelFor(height, [&](int y)
+    {
+        for(int x = 0; x < width; x++)
+        {
+            size_t i = (size_t) x + (size_t) y * width;
+            const guideData& g = guides[i];
+
+            float gradient = 0.0f;
+            if(g.hit)
+            {
+                if(x > 0 && guides[i - 1].hit)
+                    gradient = std::max(gradient, fabsf(g.depth - guides[i - 1].depth));
+                if(x < width - 1 && guides[i + 1].hit)
+                    gradient = std::max(gradient, fabsf(g.depth - guides[i + 1].depth));
+                if(y > 0 && guides[i - width].hit)
+                    gradient = std::max(gradient, fabsf(g.depth - guides[i - width].depth));
+                if(y < height - 1 && guides[i + width].hit)
+                    gradient = std::max(gradient, fabsf(g.depth - guides[i + width].depth));
+            }
+
+            depthGradient[i] = gradient;
+        }
+    });
+
+    int source = 0;
+    for(int iteration = 0; iteration < A3_DENOISE_ITERATIONS; iteration++)
+    {
+        filter(1 << iteration, source);
+        source = 1 - source;
+    }
+
+    if(config.enableTemporalDenoise)
+    {
+        bool sameRegion = historyRegion.x == region.x && historyRegion.y == region.y &&
+                          historyRegion.width == region.width && historyRegion.height == region.height;
+
+        if(hasHistory && historyFrame == frame - 1 && sameRegion)
+            blendHistory(source);
+
+        historyColor = color[source];
+        historyGuides = guides;
+        historyRegion = region;
+        historyFrame = frame;
+        hasHistory = true;
+    }
+    else
+        reset();
+
+    parallelFor(height, [&](int y)
+    {
+        for(int x = 0; x < width; x++)
+        {
+            size_t i = (size_t) x + (size_t) y * width;
+            if(guides[i].valid)
+                colorList[(region.x + x) + (region.y + y) * buffer.width] = color[source][i];
+        }
+    });
+
+    return region;
+}
+
+void AtmosDenoiser::filter(int step, int source)
+{
+    const std::vector<a3Spectrum>& src = color[source];
+    const std::vector<float>& srcVariance = variance[source];
+    std::vector<a3Spectrum>& dst = color[1 - source];
+    std::vector<float>& dstVariance = variance[1 - source];
+
+    int tilesX = (width + A3_DENOISE_TILE_SIZE - 1) / A3_DENOISE_TILE_SIZE;
+    int tilesY = (height + A3_DENOISE_TILE_SIZE - 1) / A3_DENOISE_TILE_SIZE;
+
+    parallelFor(tilesX * tilesY, [&](int tile)
+    {
+        int x0 = (tile % tilesX) * A3_DENOISE_TILE_SIZE, y0 = (tile / tilesX) * A3_DENOISE_TILE_SIZE;
+        int x1 = std::min(x0 + A3_DENOISE_TILE_SIZE, width), y1 = std::min(y0 + A3_DENOISE_TILE_SIZE, height);
+
+        for(int y = y0; y < y1; y++)
+        {
+            for(int x = x0; x < x1; x++)
+            {
+                size_t p = (size_t) x + (size_t) y * width;
+                const guideData& gp = guides[p];
+
+                if(!gp.valid)
+                {
+                    dst[p] = src[p];
+                    dstVariance[p] = srcVariance[p];
+                    continue;
+                }
+
+                // 3x3高斯模糊后的方差 避免单个像素的方差估计过小
+                float blurred = 0.0f, blurredWeight = 0.0f;
+                for(int dy = -1; dy <= 1; dy++)
+                {
+                    for(int dx = -1; dx <= 1; dx++)
+                    {
+                        int qx = x + dx, qy = y + dy;
+                        if(qx < 0 || qx >= width || qy < 0 || qy >= height || !guides[(size_t) qx + (size_t) qy * width].valid)
+                            continue;
+
+                        float w = kernel[dx + 2] * kernel[dy + 2];
+                        blurred += w * srcVariance[(size_t) qx + (size_t) qy * width];
+                        blurredWeight += w;
+                    }
+                }
+
+                float sigmaLuminance = A3_DENOISE_SIGMA_LUMINANCE * sqrtf(std::max(0.0f, blurred / blurredWeight)) + 1e-4f;
+                float lp = luminance(src[p]);
+
+                a3Spectrum sum;
+                float sumVariance = 0.0f, sumWeight = 0.0f;
+
+                for(int ky = -2; ky <= 2; ky++)
+                {
+                    int qy = y + ky * step;
+                    if(qy < 0 || qy >= height)
+                        continue;
+
+                    for(int kx = -2; kx <= 2; kx++)
+                    {
+                        int qx = x + kx * step;
+                        if(qx < 0 || qx >= width)
+                            continue;
+
+                        size_t q = (size_t) qx + (size_t) qy * width;
+                        const guideData& gq = guides[q];
+                        if(!gq.valid)
+                            continue;
+
+                        float w = kernel[kx + 2] * kernel[ky + 2];
+
+                        if(q != p)
+                        {
+                            // 各项权重的指数相加 仅计算一次exp
+                            float exponent = fabsf(lp - luminance(src[q])) / sigmaLuminance;
+
+                            if(gp.hasAOV && gq.hasAOV)
+                            {
+                                // 背景之间仅按亮度 背景与物体之间不混合
+                                if(gp.hit != gq.hit)
+                                    continue;
+
+                                if(gp.hit)
+                                {
+                                    float distance = sqrtf((float) (kx * kx + ky * ky)) * step;
+                                    float sigmaDepth = A3_DENOISE_SIGMA_DEPTH * depthGradient[p] * distance + 0.01f * gp.depth + 1e-4f;
+
+                                    a3Spectrum da = gp.albedo - gq.albedo;
+
+                                    exponent += fabsf(gp.depth - gq.depth) / sigmaDepth +
+                                                da.dot(da) / (A3_DENOISE_SIGMA_ALBEDO * A3_DENOISE_SIGMA_ALBEDO);
+                                    w *= normalWeight(gp.normal, gq.normal);
+                                }
+                            }
+
+                            w *= expf(-exponent);
+                        }
+
+                        sum += src[q] * w;
+                        sumVariance += w * w * srcVariance[q];
+                        sumWeight += w;
+                    }
+                }
+
+                // 中心像素的权重总大于0
+                dst[p] = sum / sumWeight;
+                dstVariance[p] = sumVariance / (sumWeight * sumWeight);
+            }
+        }
+    });
+}
+
+void AtmosDenoiser::blendHistory(int source)
+{
+    const std::vector<a3Spectrum>& current = color[source];
+    std::vector<a3Spectrum> blended = current;
+
+    parallelFor(height, [&](int y)
+    {
+        for(int x = 0; x < width; x++)
+        {
+            size_t p = (size_t) x + (size_t) y * width;
+            const guideData& g = guides[p];
+            const guideData& h = historyGuides[p];
+
+            if(!g.valid || !h.valid || !g.hasAOV || !h.hasAOV || g.hit != h.hit)
+                continue;
+
+            // 辅助缓冲不一致: 物体移动或被遮挡
+            if(g.hit)
+            {
+                a3Spectrum da = g.albedo - h.albedo;
+                if(g.normal.dot(h.normal) < 0.9f ||
+                   fabsf(g.depth - h.depth) > 0.05f * g.depth ||
+                   da.dot(da) > A3_DENOISE_SIGMA_ALBEDO * A3_DENOISE_SIGMA_ALBEDO)
+                    continue;
+            }
+
+            // 当前邻域的均值与标准差
+            a3Spectrum mean, meanSquare;
+            int count = 0;
+            for(int dy = -1; dy <= 1; dy++)
+            {
+                for(int dx = -1; dx <= 1; dx++)
+                {
+                    int qx = x + dx, qy = y + dy;
+                    if(qx < 0 || qx >= width || qy < 0 || qy >= height)
+                        continue;
+
+                    size_t q = (size_t) qx + (size_t) qy * width;
+                    if(!guides[q].valid)
+                        continue;
+
+                    mean += current[q];
+                    meanSquare += current[q] * current[q];
+                    count++;
+                }
+            }
+
+            mean = mean / (float) count;
+            meanSquare = meanSquare / (float) count;
+
+            a3Spectrum history = historyColor[p];
+            for(int c = 0; c < 3; c++)
+            {
+                float sigma = sqrtf(std::max(0.0f, meanSquare[c] - mean[c] * mean[c]));
+                history[c] = t3Math::clamp(history[c], mean[c] - A3_DENOISE_TEMPORAL_CLAMP * sigma,
+                                           mean[c] + A3_DENOISE_TEMPORAL_CLAMP * sigma);
+            }
+
+            blended[p] = history * (1.0f - A3_DENOISE_TEMPORAL_ALPHA) + current[p] * A3_DENOISE_TEMPORAL_ALPHA;
+        }
+    });
+
+    color[source].swap(blended);
+}
+
+void AtmosDenoiser::parallelFor(int count, const std::function<void(int)>& task)
+{
+    std::atomic<int> next(0);
+    auto run = [&]()
+    {
+        for(int i = next++; i < count; i = next++)
+            task(i);
+    };
+
+    std::vector<std::thread> threads;
+    for(int i = 1; i < std::min(numThreads, count); i++)
+        threads.push_back(std::thread(run));
+
+    run();
+
+    for(auto& t : threads)
+        t.join();
+}
@@ -0,0 +1,70 @@
+﻿#pragma once
+
+#include <vector>
+#include <functional>
+#include <Atmos.h>
+#include "AtmosTileQueue.h"
+#include "AtmosFrameBuffer.h"
+#include "AtmosRenderConfig.h"
+
+// 以辅助缓冲引导的边缘保持À-trous去噪(SVGF的空间滤波)
+// 5x5 B3样条核的间隔逐遍加倍 权重由法线 / 深度 / 反射率与按方差缩放的亮度差决定
+// 方差由帧缓冲中逐像素的亮度方差得到 随每一遍滤波一同传播 噪声越大平滑越强
+// 图像分块后由多个线程并行滤波
+// 时间域: 与上一关键帧的结果在辅助缓冲一致的像素上混合
+// 历史颜色先限制在当前3x3邻域的范围内 动画物体与移动的阴影不会拖影
+class AtmosDenoiser
+{
+public:
+    // numThreads为0时每个核心一个线程
+    AtmosDenoiser(int numThreads = 0);
+
+    // 对config的局部渲染区域去噪 结果写入colorList(宽为buffer.width) 返回该区域
+    // buffer需已完成本帧的全部采样 未采样的像素保持不变
+    // enableTemporalDenoise时使用frame - 1帧的结果 并保留本帧供下一帧使用
+    tileData denoise(const renderConfigData& config, const AtmosFrameBuffer& buffer, a3Spectrum* colorList, int frame);
+
+    // 丢弃历史 之后的第一帧仅做空间滤波
+    void reset();
+
+    // 一个像素的结果最远依赖的距离(像素)
+    // 分块渲染时各块向外扩展此距离后去噪再裁剪 结果与整体去噪一致
+    static int getRadius();
+
+private:
+    struct guideData
+    {
+        t3Vector3f normal;
+        a3Spectrum albedo;
+        float depth;
+
+        // 像素已有采样 / 带有辅助缓冲 / 主光线击中物体
+        bool valid, hasAOV, hit;
+    };
+
+    // 间隔为step的一遍滤波 由color[source]写入color[1 - source]
+    void filter(int step, int source);
+
+    // 与上一帧的结果混合 结果写回color[source]
+    void blendHistory(int source);
+
+    // 以全部线程执行task(0...count - 1)
+    void parallelFor(int count, const std::function<void(int)>& task);
+
+    int numThreads;
+
+    // 当前区域的大小 以下数组均按区域内的行优先存放
+    int width, height;
+
+    std::vector<guideData> guides;
+    std::vector<float> depthGradient;
+    std::vector<a3Spectrum> color[2];
+    std::vector<float> variance[2];
+
+    // 上一帧的结果
+    bool hasHistory;
+    int historyFrame;
+    tileData historyRegion;
+    std::vector<a3Spectrum> historyColor;
+    std::vector<guideData> historyGuides;
+};
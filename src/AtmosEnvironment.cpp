@@ -0,0 +1,371 @@
+﻿#include "AtmosEnvironment.h"
+#include "AtmosHash.h"
+#include "util.h"
+#include <ofMain.h>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define A3_ENVIRONMENT_CACHE_VERSION 1
+
+static const float pi = 3.14159265358979f;
+
+std::mutex AtmosEnvironmentCache::lock;
+std::map<std::string, AtmosEnvironmentCache::entryData> AtmosEnvironmentCache::entries;
+std::vector<const AtmosEnvironmentMap*> AtmosEnvironmentCache::retired;
+
+AtmosEnvironmentMap::AtmosEnvironmentMap() :width(0), height(0), totalWeight(0.0f)
+{
+
+}
+
+float AtmosEnvironmentMap::getWeight(int x, int y) const
+{
+    // 纬度越高像素对应的立体角越小
+    const float* texel = &texels[((size_t) x + (size_t) y * width) * 3];
+    float luminance = 0.2126f * texel[0] + 0.7152f * texel[1] + 0.0722f * texel[2];
+    return std::max(0.0f, luminance) * sinf(((float) y + 0.5f) / height * pi);
+}
+
+void AtmosEnvironmentMap::setTexels(int width, int height, std::vector<float>& texels)
+{
+    this->width = width;
+    this->height = height;
+    this->texels.swap(texels);
+
+    size_t count = (size_t) width * height;
+    std::vector<float> weights(count);
+
+    // double累加 避免大贴图的舍入误差
+    double total = 0.0;
+    for(int y = 0; y < height; y++)
+    {
+        for(int x = 0; x < width; x++)
+        {
+            weights[(size_t) x + (size_t) y * width] = getWeight(x, y);
+            total += weights[(size_t) x + (size_t) y * width];
+        }
+    }
+
+    totalWeight = (float) total;
+    probability.assign(count, 1.0f);
+    alias.resize(count);
+    for(size_t i = 0; i < count; i++)
+        alias[i] = (uint32_t) i;
+
+    if(total <= 0.0)
+        return;
+
+    // Vose: 权重低于平均的像素由高于平均的像素补足
+    std::vector<uint32_t> small, large;
+    std::vector<double> scaled(count);
+    for(size_t i = 0; i < count; i++)
+    {
+        scaled[i] = weights[i] * count / total;
+        if(scaled[i] < 1.0)
+            small.push_back((uint32_t) i);
+        else
+            large.push_back((uint32_t) i);
+    }
+
+    while(!small.empty() && !large.empty())
+    {
+        uint32_t s = small.back(), l = large.back();
+        small.pop_back();
+
+        probability[s] = (float) scaled[s];
+        alias[s] = l;
+
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+        if(scaled[l] < 1.0)
+        {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    // 剩余的概率为1(舍入误差)
+    for(auto i : small)
+        probability[i] = 1.0f;
+    for(auto i : large)
+        probability[i] = 1.0f;
+}
+
+int AtmosEnvironmentMap::getPixel(const t3Vector3f& d, float* sinTheta) const
+{
+    float length = sqrtf(d.dot(d));
+    float cosTheta = t3Math::clamp(d.z / length, -1.0f, 1.0f);
+
+    float u = atan2f(d.y, d.x) / (2.0f * pi);
+    if(u < 0.0f)
+        u += 1.0f;
+
+    int x = std::min((int) (u * width), width - 1);
+    int y = std::min((int) (acosf(cosTheta) / pi * height), height - 1);
+
+    if(sinTheta)
+        *sinTheta = sqrtf(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+
+    return x + y * width;
+}
+
+a3Spectrum AtmosEnvironmentMap::lookup(const t3Vector3f& d) const
+{
+    if(texels.empty())
+        return a3Spectrum(0.0f);
+
+    const float* texel = &texels[(size_t) getPixel(d, NULL) * 3];
+    return a3Spectrum(texel[0], texel[1], texel[2]);
+}
+
+bool AtmosEnvironmentMap::canSample() const
+{
+    return !texels.empty() && totalWeight > 0.0f;
+}
+
+t3Vector3f AtmosEnvironmentMap::sample(float u0, float u1, float u2, float* pdf) const
+{
+    size_t count = (size_t) width * height;
+
+    // 别名表: u0的整数部分选格 小数部分决定保留或替代
+    float scaled = u0 * count;
+    size_t i = std::min((size_t) scaled, count - 1);
+    if(scaled - (float) i >= probability[i])
+        i = alias[i];
+
+    int x = (int) (i % width), y = (int) (i / width);
+
+    float phi = ((float) x + u1) / width * 2.0f * pi;
+    float theta = ((float) y + u2) / height * pi;
+    float sinTheta = sinf(theta);
+
+    // 像素内(u, v)均匀: p(u, v) = weight / total * count 换算至立体角除以2 * pi^2 * sin(theta)
+    *pdf = sinTheta > 0.0f ? getWeight(x, y) / totalWeight * count / (2.0f * pi * pi * sinTheta) : 0.0f;
+
+    return t3Vector3f(sinTheta * cosf(phi), sinTheta * sinf(phi), cosf(theta));
+}
+
+float AtmosEnvironmentMap::pdf(const t3Vector3f& d) const
+{
+    if(!canSample())
+        return 0.0f;
+
+    float sinTheta = 0.0f;
+    int pixel = getPixel(d, &sinTheta);
+    if(sinTheta <= 0.0f)
+        return 0.0f;
+
+    size_t count = (size_t) width * height;
+    return getWeight(pixel % width, pixel / width) / totalWeight * count / (2.0f * pi * pi * sinTheta);
+}
+
+const AtmosEnvironmentMap* AtmosEnvironmentCache::load(const std::string& path)
+{
+    uint64_t size = 0;
+    int64_t time = 0;
+    if(!getFileInfo(path, &size, &time))
+    {
+        a3Log::warning("环境贴图不存在: %s\n", path.c_str());
+        return NULL;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto iter = entries.find(path);
+    if(iter != entries.end())
+    {
+        if(iter->second.size == size && iter->second.time == time)
+            return iter->second.map;
+
+        // 文件已改变 旧版本可能仍被渲染中的帧引用
+        retired.push_back(iter->second.map);
+        entries.erase(iter);
+    }
+
+    AtmosEnvironmentMap* map = new AtmosEnvironmentMap();
+    if(!read(path, size, time, map))
+    {
+        if(!decode(path, map))
+        {
+            a3Log::warning("环境贴图读取失败: %s\n", path.c_str());
+            delete map;
+            return NULL;
+        }
+
+        if(!write(path, size, time, map))
+            a3Log::warning("环境贴图缓存写入失败: %s\n", getCachePath(path).c_str());
+    }
+
+    entryData& entry = entries[path];
+    entry.size = size;
+    entry.time = time;
+    entry.map = map;
+
+    return map;
+}
+
+std::string AtmosEnvironmentCache::getCachePath(const std::string& path)
+{
+    return path + ".a3env";
+}
+
+bool AtmosEnvironmentCache::getModifiedTime(const std::string& path, int64_t* time)
+{
+    uint64_t size = 0;
+    return getFileInfo(path, &size, time);
+}
+
+bool AtmosEnvironmentCache::getFileInfo(const std::string& path, uint64_t* size, int64_t* time)
+{
+#ifdef _WIN32
+    struct _stat64 info;
+    if(_stat64(path.c_str(), &info) != 0)
+        return false;
+#else
+    struct stat info;
+    if(stat(path.c_str(), &info) != 0)
+        return false;
+#endif
+
+    *size = (uint64_t) info.st_size;
+    *time = (int64_t) info.st_mtime;
+    return true;
+}
+
+bool AtmosEnvironmentCache::decode(const std::string& path, AtmosEnvironmentMap* map)
+{
+    ofFloatPixels pixels;
+    if(!ofLoadImage(pixels, path) || pixels.getWidth() <= 0 || pixels.getHeight() <= 0)
+        return false;
+
+    int width = (int) pixels.getWidth(), height = (int) pixels.getHeight();
+    int channels = (int) pixels.getNumChannels();
+    const float* data = pixels.getData();
+
+    std::vector<float> texels((size_t) width * height * 3);
+    for(size_t i = 0; i < (size_t) width * height; i++)
+    {
+        for(int c = 0; c < 3; c++)
+            texels[i * 3 + c] = data[i * channels + std::min(c, channels - 1)];
+    }
+
+    map->setTexels(width, height, texels);
+    return true;
+}
+
+bool AtmosEnvironmentCache::read(const std::string& path, uint64_t sourceSize, int64_t sourceTime, AtmosEnvironmentMap* map)
+{
+    std::string cachePath = getCachePath(path);
+
+    FILE* file = fopen(cachePath.c_str(), "rb");
+    if(!file)
+        return false;
+
+    headerData header;
+    bool ok = fread(&header, sizeof(headerData), 1, file) == 1 &&
+              memcmp(header.magic, "A3EV", 4) == 0 && header.version == A3_ENVIRONMENT_CACHE_VERSION &&
+              header.sourceSize == sourceSize && header.width > 0 && header.height > 0;
+
+    // 修改时间不同(复制 / 重新导出)时比较内容
+    bool touched = false;
+    if(ok && header.sourceTime != sourceTime)
+    {
+        uint64_t hash = 0;
+        ok = fnv1aFileCached(path.c_str(), &hash) && hash == header.sourceHash;
+        touched = ok;
+    }
+
+    if(ok)
+    {
+        size_t count = (size_t) header.width * header.height;
+        map->width = header.width;
+        map->height = header.height;
+        map->totalWeight = header.totalWeight;
+        map->texels.resize(count * 3);
+        map->probability.resize(count);
+        map->alias.resize(count);
+
+        ok = fread(map->texels.data(), sizeof(float), count * 3, file) == count * 3 &&
+             fread(map->probability.data(), sizeof(float), count, file) == count &&
+             fread(map->alias.data(), sizeof(uint32_t), count, file) == count;
+
+        // 替代的像素越界视为缓存损坏
+        for(size_t i = 0; ok && i < count; i++)
+            ok = map->alias[i] < count;
+
+        if(!ok)
+            a3Log::warning("环境贴图缓存不完整: %s\n", cachePath.c_str());
+    }
+
+    fclose(file);
+
+    if(!ok)
+    {
+        *map = AtmosEnvironmentMap();
+        return false;
+    }
+
+    // 内容一致 更新修改时间避免下次再计算哈希
+    if(touched)
+    {
+        file = fopen(cachePath.c_str(), "r+b");
+        if(file)
+        {
+            fseek(file, offsetof(headerData, sourceTime), SEEK_SET);
+            fwrite(&sourceTime, sizeof(sourceTime), 1, file);
+            fclose(file);
+        }
+    }
+
+    return true;
+}
+
+bool AtmosEnvironmentCache::write(const std::string& path, uint64_t sourceSize, int64_t sourceTime, const AtmosEnvironmentMap* map)
+{
+    headerData header;
+    memset(&header, 0, sizeof(headerData));
+    memcpy(header.magic, "A3EV", 4);
+    header.version = A3_ENVIRONMENT_CACHE_VERSION;
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+    header.width = map->width;
+    header.height = map->height;
+    header.totalWeight = map->totalWeight;
+
+    if(!fnv1aFileCached(path.c_str(), &header.sourceHash))
+        return false;
+
+    size_t count = (size_t) map->width * map->height;
+
+    // 先写入临时文件 避免中断后留下不完整的缓存
+    std::string cachePath = getCachePath(path);
+    std::string tempPath = getTempPath(cachePath);
+
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if(!file)
+        return false;
+
+    bool ok = fwrite(&header, sizeof(headerData), 1, file) == 1 &&
+              fwrite(map->texels.data(), sizeof(float), count * 3, file) == count * 3 &&
+              fwrite(map->probability.data(), sizeof(float), count, file) == count &&
+              fwrite(map->alias.data(), sizeof(uint32_t), count, file) == count;
+    ok = (fclose(file) == 0) && ok;
+
+    if(!ok)
+    {
+        remove(tempPath.c_str());
+        return false;
+    }
+
+    // 替换失败说明另一写入者已写入同一缓存(内容相同) 不视为错误
+    remove(cachePath.c_str());
+    if(rename(tempPath.c_str(), cachePath.c_str()) != 0)
+    {
+        remove(tempPath.c_str());
+        ok = ofFile::doesFileExist(cachePath, false);
+    }
+
+    return ok;
+}
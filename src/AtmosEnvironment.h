@@ -0,0 +1,99 @@
+﻿#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <Atmos.h>
+
+// 经纬度展开的环境贴图 z轴朝上 逐像素RGB
+// 附带按亮度 * sin(theta)建立的别名表 O(1)按辐射亮度重要性采样方向
+class AtmosEnvironmentMap
+{
+public:
+    AtmosEnvironmentMap();
+
+    // 由RGB像素建立 同时建立别名表
+    void setTexels(int width, int height, std::vector<float>& texels);
+
+    // 方向d上的辐射亮度 贴图为空时为0
+    a3Spectrum lookup(const t3Vector3f& d) const;
+
+    // 全黑或为空时无法采样
+    bool canSample() const;
+
+    // u0选取像素 u1, u2为像素内的位置 pdf为立体角上的概率密度
+    t3Vector3f sample(float u0, float u1, float u2, float* pdf) const;
+
+    // sample选中方向d的概率密度
+    float pdf(const t3Vector3f& d) const;
+
+    int width, height;
+    std::vector<float> texels;
+
+    // 别名表: 保留自身的概率 / 替代的像素
+    std::vector<float> probability;
+    std::vector<uint32_t> alias;
+
+    // 全部像素的采样权重之和
+    float totalWeight;
+
+private:
+    // 像素的采样权重
+    float getWeight(int x, int y) const;
+
+    // 方向所在的像素
+    int getPixel(const t3Vector3f& d, float* sinTheta) const;
+};
+
+// 环境贴图缓存
+// 进程内按路径常驻 文件大小或修改时间改变时重新读取 多帧 / 多个AtmosSceneBuilder共享
+// 解码后的像素与别名表写入X.exr.a3env 之后的会话直接读取 无需解码与建表
+// 缓存文件以源文件的大小与修改时间校验 修改时间不一致时再比较内容哈希
+class AtmosEnvironmentCache
+{
+public:
+    // 读取失败返回NULL 返回的贴图常驻至进程结束(被替换的旧版本同样保留 仍在渲染的帧可继续使用)
+    static const AtmosEnvironmentMap* load(const std::string& path);
+
+    // 缓存文件路径
+    static std::string getCachePath(const std::string& path);
+
+    // 源文件的修改时间 不存在时返回false
+    static bool getModifiedTime(const std::string& path, int64_t* time);
+
+private:
+    struct headerData
+    {
+        char magic[4];
+        uint32_t version;
+
+        // 源文件信息
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        uint64_t sourceHash;
+
+        int32_t width, height;
+        float totalWeight;
+    };
+
+    struct entryData
+    {
+        uint64_t size;
+        int64_t time;
+        const AtmosEnvironmentMap* map;
+    };
+
+    static bool read(const std::string& path, uint64_t sourceSize, int64_t sourceTime, AtmosEnvironmentMap* map);
+    static bool write(const std::string& path, uint64_t sourceSize, int64_t sourceTime, const AtmosEnvironmentMap* map);
+
+    // 解码图片
+    static bool decode(const std::string& path, AtmosEnvironmentMap* map);
+
+    static bool getFileInfo(const std::string& path, uint64_t* size, int64_t* time);
+
+    static std::mutex lock;
+    static std::map<std::string, entryData> entries;
+    static std::vector<const AtmosEnvironmentMap*> retired;
+};
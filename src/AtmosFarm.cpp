@@ -0,0 +1,531 @@
+﻿#include "AtmosFarm.h"
+#include "AtmosSocket.h"
+#include "AtmosSceneIO.h"
+#include "AtmosSceneBuilder.h"
+#include "AtmosTileScheduler.h"
+#include "AtmosFrameWriter.h"
+#include "AtmosCheckpoint.h"
+#include "AtmosFrameCache.h"
+#include "AtmosDenoise.h"
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <stdlib.h>
+
+#define A3_FARM_DEFAULT_PORT 7340
+
+// 单个任务连续失败的次数上限 超过后放弃该任务
+#define A3_FARM_MAX_ATTEMPTS 3
+
+// 工作进程渲染期间发送BUSY的间隔
+#define A3_FARM_HEARTBEAT_MS 5000
+
+// 协调进程超过此时间未收到工作进程的任何数据即视为断开
+#define A3_FARM_TIMEOUT_MS 60000
+
+// 一帧中的一个区域
+struct farmJobData
+{
+    farmJobData() :id(0), frame(0), x(0), y(0), width(0), height(0), attempts(0) {}
+
+    int id, frame;
+    int x, y, width, height;
+    int attempts;
+};
+
+// 收集中的一帧
+struct farmFrameData
+{
+    farmFrameData() :remaining(0), fingerprint(0) {}
+
+    std::vector<unsigned char> pixels;
+    int remaining;
+    uint64_t fingerprint;
+};
+
+// 协调进程各连接线程共享的状态
+struct farmStateData
+{
+    farmStateData() :finishedJobs(0), failedJobs(0), totalJobs(0) {}
+
+    std::mutex lock;
+    std::condition_variable changed;
+
+    // 待分配的任务 失败的任务放回队首优先重新分配
+    std::deque<farmJobData> jobs;
+    int finishedJobs, failedJobs, totalJobs;
+
+    std::map<int, farmFrameData> frames;
+
+    renderConfigData config;
+    std::string sceneText;
+
+    AtmosFrameWriter* writer;
+};
+
+static bool isAllFinished(farmStateData& state)
+{
+    return state.finishedJobs + state.failedJobs == state.totalJobs;
+}
+
+// 将任务结果写入对应帧 一帧全部完成后提交保存
+static void storeResult(farmStateData& state, const farmJobData& job, const std::vector<unsigned char>& data)
+{
+    const renderConfigData& config = state.config;
+    int rowSize = config.imageWidth * 3;
+
+    farmFrameData* frame = NULL;
+    {
+        std::lock_guard<std::mutex> guard(state.lock);
+        frame = &state.frames[job.frame];
+        if(frame->pixels.empty())
+            frame->pixels.assign((size_t) rowSize * config.imageHeight, 0);
+    }
+
+    // 不同任务的区域互不重叠 无需加锁
+    for(int y = 0; y < job.height; y++)
+        memcpy(&frame->pixels[(size_t) (job.y + y) * rowSize + job.x * 3], &data[(size_t) y * job.width * 3], job.width * 3);
+
+    bool frameFinished = false;
+    std::vector<unsigned char> pixels;
+    uint64_t fingerprint = 0;
+    {
+        std::lock_guard<std::mutex> guard(state.lock);
+        state.finishedJobs++;
+
+        if(--frame->remaining == 0)
+        {
+            frameFinished = true;
+            pixels.swap(frame->pixels);
+            fingerprint = frame->fingerprint;
+            state.frames.erase(job.frame);
+        }
+    }
+
+    if(frameFinished)
+    {
+        AtmosFrameWriter::frameData* output = state.writer->beginFrame(config.getSavePath(job.frame),
+                                                                       config.imageWidth, config.imageHeight,
+                                                                       false, false);
+        memcpy(output->pixels.getData(), pixels.data(), pixels.size());
+
+        std::string path = output->path;
+        output->onSaved = [&config, path, fingerprint](bool saved, double)
+        {
+            if(saved)
+                commitFrame(config, path, fingerprint);
+        };
+
+        state.writer->endFrame(output);
+
+        a3Log::debug("Frame %d finished\n", job.frame);
+    }
+
+    state.changed.notify_all();
+}
+
+// 任务失败: 放回队首 超过次数上限则放弃
+static void retryJob(farmStateData& state, farmJobData job)
+{
+    {
+        std::lock_guard<std::mutex> guard(state.lock);
+        if(++job.attempts < A3_FARM_MAX_ATTEMPTS)
+            state.jobs.push_front(job);
+        else
+        {
+            a3Log::error("任务多次失败 放弃: 帧%d 区域(%d, %d, %d, %d)\n", job.frame, job.x, job.y, job.width, job.height);
+            state.failedJobs++;
+        }
+    }
+
+    state.changed.notify_all();
+}
+
+// 协调进程中服务一个工作进程的线程
+static void serveWorker(AtmosSocket* connection, farmStateData* state)
+{
+    // 挂起或网络中断的工作进程不会关闭连接
+    connection->setTimeout(A3_FARM_TIMEOUT_MS);
+
+    std::string line;
+    std::ostringstream scene;
+    scene << "SCENE " << state->sceneText.size();
+
+    if(!connection->recvLine(line) || line != "HELLO" ||
+       !connection->sendLine(scene.str()) ||
+       !connection->sendAll(state->sceneText.data(), state->sceneText.size()))
+    {
+        a3Log::warning("工作进程握手失败\n");
+        delete connection;
+        return;
+    }
+
+    while(true)
+    {
+        farmJobData job;
+        {
+            std::unique_lock<std::mutex> guard(state->lock);
+            state->changed.wait(guard, [state]() { return !state->jobs.empty() || isAllFinished(*state); });
+
+            if(state->jobs.empty())
+                break;
+
+            job = state->jobs.front();
+            state->jobs.pop_front();
+        }
+
+        std::ostringstream command;
+        command << "JOB " << job.id << " " << job.frame << " " << job.x << " " << job.y << " " << job.width << " " << job.height;
+
+        // 渲染期间为BUSY <id>
+        // DONE <id> <字节数> 之后为区域内逐行的RGB数据
+        std::string reply, type;
+        int id = -1;
+        size_t size = 0;
+        bool ok = connection->sendLine(command.str()) && connection->recvLine(reply);
+        while(ok && reply.compare(0, 5, "BUSY ") == 0)
+            ok = connection->recvLine(reply);
+
+        if(ok)
+        {
+            std::istringstream in(reply);
+            in >> type >> id >> size;
+        }
+
+        std::vector<unsigned char> data;
+        if(ok && type == "DONE" && id == job.id && size == (size_t) job.width * job.height * 3)
+        {
+            data.resize(size);
+            ok = connection->recvAll(data.data(), size);
+        }
+        else if(ok && type == "FAIL")
+        {
+            retryJob(*state, job);
+            continue;
+        }
+        else
+            ok = false;
+
+        if(!ok)
+        {
+            // 工作进程断开或无响应 未完成的任务交给其余工作进程
+            if(connection->hasTimedOut())
+                a3Log::warning("工作进程无响应 重新分配帧%d的任务\n", job.frame);
+            else
+                a3Log::warning("工作进程断开 重新分配帧%d的任务\n", job.frame);
+            retryJob(*state, job);
+            delete connection;
+            return;
+        }
+
+        storeResult(*state, job, data);
+    }
+
+    connection->sendLine("QUIT");
+    delete connection;
+}
+
+int farmCoordinator(const char* exePath, int argc, char* argv[])
+{
+    if(argc < 1)
+    {
+        a3Log::error("用法: AtmosMovie -farm scene.atmos [-port 7340] [-frames start end] [-strips 1] [-spawn 0]\n");
+        return 1;
+    }
+
+    farmStateData state;
+    std::vector<shapeData*> shapeList;
+    std::vector<lightData*> lightList;
+    if(!loadScene(argv[0], state.config, shapeList, lightList))
+        return 1;
+
+    renderConfigData& config = state.config;
+    int port = A3_FARM_DEFAULT_PORT, strips = 1, spawn = 0;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        if(option == "-port" && i + 1 < argc)
+            port = ofToInt(argv[++i]);
+        else if(option == "-strips" && i + 1 < argc)
+            strips = std::max(1, ofToInt(argv[++i]));
+        else if(option == "-spawn" && i + 1 < argc)
+            spawn = std::max(0, ofToInt(argv[++i]));
+        else if(option == "-frames" && i + 2 < argc)
+        {
+            config.startFrame = ofToInt(argv[++i]);
+            config.endFrame = ofToInt(argv[++i]);
+        }
+        else
+            a3Log::warning("忽略未知参数: %s\n", option.c_str());
+    }
+
+    // 工作进程仅需场景内容 模型路径需在各机器上可访问
+    state.sceneText = sceneToString(config, shapeList, lightList);
+
+    // 与编辑器一致: 无关键帧时仅渲染起始帧
+    int endFrame = config.hasKeyFrame ? config.endFrame : config.startFrame;
+
+    // 每帧按局部渲染区域划分为水平条带 跳过输出已是最新的帧
+    int regionY = config.localStartPos[1], regionHeight = config.localRenderSize[1];
+    strips = std::min(strips, std::max(1, regionHeight));
+    for(int frame = findNextFrame(config, shapeList, lightList, config.startFrame, endFrame); frame <= endFrame;
+        frame = findNextFrame(config, shapeList, lightList, frame + 1, endFrame))
+    {
+        for(int i = 0; i < strips; i++)
+        {
+            farmJobData job;
+            job.id = state.totalJobs++;
+            job.frame = frame;
+            job.x = config.localStartPos[0];
+            job.width = config.localRenderSize[0];
+            job.y = regionY + regionHeight * i / strips;
+            job.height = regionY + regionHeight * (i + 1) / strips - job.y;
+
+            state.jobs.push_back(job);
+        }
+
+        state.frames[frame].remaining = strips;
+        state.frames[frame].fingerprint = getFrameFingerprint(config, shapeList, lightList, frame);
+    }
+
+    for(auto s : shapeList)
+        delete s;
+    for(auto l : lightList)
+        delete l;
+
+    if(state.totalJobs == 0)
+    {
+        a3Log::debug("全部关键帧均已完成\n");
+        return 0;
+    }
+
+    AtmosSocket server;
+    if(!server.listen(port))
+    {
+        a3Log::error("无法监听端口: %d\n", port);
+        return 1;
+    }
+
+    AtmosFrameWriter writer;
+    state.writer = &writer;
+
+    // 本机工作进程
+    std::vector<std::thread> spawned;
+    for(int i = 0; i < spawn; i++)
+    {
+        std::ostringstream command;
+        command << "\"" << exePath << "\" -worker 127.0.0.1 " << port;
+
+        std::string line = command.str();
+        spawned.push_back(std::thread([line]() { system(line.c_str()); }));
+    }
+
+    a3Log::debug("Farm: %d jobs, listening on port %d\n", state.totalJobs, port);
+
+    std::vector<std::thread> connections;
+    while(true)
+    {
+        {
+            std::lock_guard<std::mutex> guard(state.lock);
+            if(isAllFinished(state))
+                break;
+        }
+
+        AtmosSocket* connection = server.accept(200);
+        if(connection)
+            connections.push_back(std::thread(serveWorker, connection, &state));
+    }
+
+    // 通知空闲的连接线程发送QUIT
+    state.changed.notify_all();
+
+    for(auto& t : connections)
+        t.join();
+    for(auto& t : spawned)
+        t.join();
+
+    writer.flush();
+
+    int failed = 0;
+    for(int frame = config.startFrame; frame <= endFrame; frame++)
+    {
+        string path = config.getSavePath(frame);
+        if(!ofFile::doesFileExist(path, false))
+        {
+            a3Log::error("关键帧%d保存失败: %s\n", frame, path.c_str());
+            failed++;
+        }
+    }
+
+    return failed == 0 ? 0 : 1;
+}
+
+// 渲染一个任务 返回区域内逐行的RGB数据
+static std::vector<unsigned char> renderJob(const renderConfigData& sceneConfig,
+                                            const std::vector<shapeData*>& shapeList,
+                                            const std::vector<lightData*>& lightList,
+                                            const farmJobData& job,
+                                            AtmosSceneBuilder& atmos,
+                                            AtmosTileScheduler& scheduler,
+                                            AtmosFrameWriter& writer)
+{
+    renderConfigData config = sceneConfig;
+    config.localStartPos[0] = job.x;
+    config.localStartPos[1] = job.y;
+    config.localRenderSize[0] = job.width;
+    config.localRenderSize[1] = job.height;
+
+    // 去噪时条带上下各多渲染滤波半径的行(不超出整帧的区域) 去噪后仅返回条带本身 条带交界处无接缝
+    if(config.enableDenoise)
+    {
+        int radius = AtmosDenoiser::getRadius();
+        int top = std::max(sceneConfig.localStartPos[1], job.y - radius);
+        int bottom = std::min(sceneConfig.localStartPos[1] + sceneConfig.localRenderSize[1], job.y + job.height + radius);
+
+        config.localStartPos[1] = top;
+        config.localRenderSize[1] = std::max(job.height, bottom - top);
+    }
+
+    // 条带高度可能小于level
+    config.level[0] = std::min(config.level[0], job.width);
+    config.level[1] = std::min(config.level[1], config.localRenderSize[1]);
+
+    atmos.build(config, shapeList, lightList, job.frame);
+
+    // 仅借用输出帧的量化 不保存
+    AtmosFrameWriter::frameData* output = writer.beginFrame("", config.imageWidth, config.imageHeight,
+                                                            config.enableToneMapping, config.enableGammaCorrection);
+    scheduler.start(atmos.renderer, atmos.scene, config, false, output);
+    scheduler.wait();
+
+    // 在含扩展行的区域内去噪 不做时间域混合
+    if(config.enableDenoise)
+    {
+        config.enableTemporalDenoise = false;
+
+        AtmosDenoiser denoiser;
+        tileData region = denoiser.denoise(config, scheduler.getFrameBuffer(), atmos.renderer->colorList, job.frame);
+        AtmosFrameWriter::writeTile(output, atmos.renderer->colorList, config.imageWidth, region);
+    }
+
+    std::vector<unsigned char> data((size_t) job.width * job.height * 3);
+    const unsigned char* pixels = output->pixels.getData();
+    for(int y = 0; y < job.height; y++)
+        memcpy(&data[(size_t) y * job.width * 3], pixels + ((size_t) (job.y + y) * config.imageWidth + job.x) * 3, job.width * 3);
+
+    writer.cancelFrame(output);
+
+    return data;
+}
+
+int farmWorker(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        a3Log::error("用法: AtmosMovie -worker host port\n");
+        return 1;
+    }
+
+    // 协调进程可能稍后启动
+    AtmosSocket connection;
+    bool connected = false;
+    for(int i = 0; i < 50 && !connected; i++)
+    {
+        connected = connection.connect(argv[0], ofToInt(argv[1]));
+        if(!connected)
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    if(!connected)
+    {
+        a3Log::error("无法连接协调进程: %s:%s\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    std::string line, type;
+    size_t size = 0;
+    if(!connection.sendLine("HELLO") || !connection.recvLine(line))
+        return 1;
+
+    std::istringstream header(line);
+    header >> type >> size;
+
+    std::string sceneText(size, '\0');
+    if(type != "SCENE" || !connection.recvAll(&sceneText[0], size))
+        return 1;
+
+    renderConfigData config;
+    std::vector<shapeData*> shapeList;
+    std::vector<lightData*> lightList;
+    if(!loadSceneFromString(sceneText, config, shapeList, lightList))
+        return 1;
+
+    AtmosSceneBuilder atmos;
+    AtmosTileScheduler scheduler;
+    AtmosFrameWriter writer(1);
+
+    int result = 0;
+    while(connection.recvLine(line))
+    {
+        std::istringstream in(line);
+        in >> type;
+        if(type == "QUIT")
+            break;
+
+        farmJobData job;
+        in >> job.id >> job.frame >> job.x >> job.y >> job.width >> job.height;
+
+        bool valid = type == "JOB" && !in.fail() && job.width > 0 && job.height > 0 &&
+                     job.x >= 0 && job.y >= 0 &&
+                     job.x + job.width <= config.imageWidth && job.y + job.height <= config.imageHeight;
+        if(!valid)
+        {
+            connection.sendLine("FAIL " + ofToString(job.id));
+            continue;
+        }
+
+        a3Log::debug("Worker: frame %d (%d, %d, %d, %d)\n", job.frame, job.x, job.y, job.width, job.height);
+
+        // 渲染期间定期告知协调进程仍在工作
+        std::mutex heartbeatLock;
+        std::condition_variable heartbeatChanged;
+        bool rendering = true;
+        std::thread heartbeat([&]()
+        {
+            std::unique_lock<std::mutex> guard(heartbeatLock);
+            while(!heartbeatChanged.wait_for(guard, std::chrono::milliseconds(A3_FARM_HEARTBEAT_MS), [&rendering]() { return !rendering; }))
+                connection.sendLine("BUSY " + ofToString(job.id));
+        });
+
+        std::vector<unsigned char> data = renderJob(config, shapeList, lightList, job, atmos, scheduler, writer);
+
+        {
+            std::lock_guard<std::mutex> guard(heartbeatLock);
+            rendering = false;
+        }
+        heartbeatChanged.notify_all();
+        heartbeat.join();
+
+        std::ostringstream reply;
+        reply << "DONE " << job.id << " " << data.size();
+        if(!connection.sendLine(reply.str()) || !connection.sendAll(data.data(), data.size()))
+        {
+            result = 1;
+            break;
+        }
+    }
+
+    atmos.release();
+
+    for(auto s : shapeList)
+        delete s;
+    for(auto l : lightList)
+        delete l;
+
+    return result;
+}
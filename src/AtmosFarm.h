@@ -0,0 +1,15 @@
+﻿#pragma once
+
+// 渲染农场: 一个协调进程与任意个工作进程通过TCP通信
+// 协调进程将场景文件发送至工作进程 按帧(或帧内的水平条带)分配任务并收集结果
+// 工作进程断开时其未完成的任务重新分配给其余工作进程
+
+// 协调进程
+// 参数: 场景文件路径 [-port 端口] [-frames 起始帧 结束帧] [-strips 每帧条带数] [-spawn 本机工作进程数]
+// exePath用于-spawn启动本机工作进程
+// 返回值: 0为全部关键帧保存成功
+int farmCoordinator(const char* exePath, int argc, char* argv[]);
+
+// 工作进程
+// 参数: 协调进程地址 端口
+int farmWorker(int argc, char* argv[]);
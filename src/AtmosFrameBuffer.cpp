@@ -0,0 +1,137 @@
+﻿#include "AtmosFrameBuffer.h"
+#include <algorithm>
+#include <math.h>
+
+AtmosFrameBuffer::AtmosFrameBuffer() :width(0), height(0)
+{
+
+}
+
+void AtmosFrameBuffer::resize(int width, int height, bool aov)
+{
+    this->width = width;
+    this->height = height;
+
+    size_t size = (size_t) width * height;
+    sum.assign(size, a3Spectrum());
+    count.assign(size, 0);
+    mean.assign(size, 0.0f);
+    m2.assign(size, 0.0f);
+
+    if(aov)
+    {
+        albedo.assign(size, a3Spectrum());
+        normal.assign(size, t3Vector3f());
+        depth.assign(size, 0.0f);
+        aovCount.assign(size, 0);
+    }
+    else
+    {
+        albedo.clear();
+        albedo.shrink_to_fit();
+        normal.clear();
+        normal.shrink_to_fit();
+        depth.clear();
+        depth.shrink_to_fit();
+        aovCount.clear();
+        aovCount.shrink_to_fit();
+    }
+}
+
+void AtmosFrameBuffer::add(int index, const a3Spectrum& color)
+{
+    sum[index] += color;
+    int n = ++count[index];
+
+    // Welford
+    float luminance = 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
+    float delta = luminance - mean[index];
+    mean[index] += delta / n;
+    m2[index] += delta * (luminance - mean[index]);
+}
+
+void AtmosFrameBuffer::addAOV(int index, const a3Ray& ray, const a3IntersectRecord* record)
+{
+    aovCount[index]++;
+
+    if(!record)
+        return;
+
+    // 反射率: 材质表中的BSDF反射率均为1 有纹理的材质同样以1近似
+    const a3Shape* shape = record->shape;
+    if(shape->bsdf)
+        albedo[index] += a3Spectrum(1.0f);
+
+    // 朝向相机的法线
+    t3Vector3f p = ray.o + ray.d * record->t;
+    t3Vector3f n = shape->getNormal(p, record->u, record->v).getNormalized();
+    if(n.dot(ray.d) > 0.0f)
+        n = n * -1.0f;
+    normal[index] += n;
+
+    depth[index] += record->t * sqrtf(ray.d.dot(ray.d));
+}
+
+bool AtmosFrameBuffer::hasAOV() const
+{
+    return !aovCount.empty();
+}
+
+a3Spectrum AtmosFrameBuffer::getAlbedo(int index) const
+{
+    if(aovCount[index] == 0)
+        return a3Spectrum();
+
+    return albedo[index] / (float) aovCount[index];
+}
+
+t3Vector3f AtmosFrameBuffer::getNormal(int index) const
+{
+    if(aovCount[index] == 0)
+        return t3Vector3f();
+
+    return normal[index] / (float) aovCount[index];
+}
+
+float AtmosFrameBuffer::getDepth(int index) const
+{
+    if(aovCount[index] == 0)
+        return 0.0f;
+
+    return depth[index] / aovCount[index];
+}
+
+a3Spectrum AtmosFrameBuffer::getColor(int index) const
+{
+    if(count[index] == 0)
+        return a3Spectrum();
+
+    return sum[index] / (float) count[index];
+}
+
+bool AtmosFrameBuffer::isConverged(int index, const adaptiveSamplingData& adaptive) const
+{
+    int n = count[index];
+    if(n < std::max(2, adaptive.minSamples))
+        return false;
+
+    // 均值的标准误差 sqrt(s^2 / n)
+    float error = sqrtf(m2[index] / (n - 1) / n);
+
+    // 暗部以固定下限避免除零
+    return error <= adaptive.threshold * std::max(mean[index], 1e-3f);
+}
+
+int AtmosFrameBuffer::getSamples(int x, int y) const
+{
+    return count[x + y * width];
+}
+
+int AtmosFrameBuffer::getMaxSamples() const
+{
+    int samples = 0;
+    for(auto c : count)
+        samples = std::max(samples, c);
+
+    return samples;
+}
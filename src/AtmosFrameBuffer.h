@@ -0,0 +1,70 @@
+﻿#pragma once
+
+#include <vector>
+#include <Atmos.h>
+
+// 自适应采样参数
+struct adaptiveSamplingData
+{
+    adaptiveSamplingData() :enable(false), threshold(0.01f), minSamples(8) {}
+
+    bool enable;
+
+    // 亮度均值的相对标准误差低于阈值即视为收敛
+    float threshold;
+
+    // 收敛判断前至少需要的采样数
+    int minSamples;
+};
+
+// 逐像素累积的采样结果
+// 渐进式渲染的每一遍都在此累加 colorList中始终为已有采样的均值
+// 同时以Welford算法记录亮度的方差 用于自适应采样与去噪
+// 启用辅助缓冲(AOV)时另外累积主光线交点的反射率 / 法线 / 深度 作为去噪的引导
+class AtmosFrameBuffer
+{
+public:
+    AtmosFrameBuffer();
+
+    // 重新分配并清零 aov为false时不分配辅助缓冲
+    void resize(int width, int height, bool aov = false);
+
+    // 累加一个像素的单个采样
+    void add(int index, const a3Spectrum& color);
+
+    // 累加一个像素的主光线交点 record为NULL表示未击中
+    void addAOV(int index, const a3Ray& ray, const a3IntersectRecord* record);
+
+    bool hasAOV() const;
+
+    // 当前均值
+    a3Spectrum getColor(int index) const;
+
+    // 辅助缓冲的均值 未击中的部分计为0
+    a3Spectrum getAlbedo(int index) const;
+    t3Vector3f getNormal(int index) const;
+    float getDepth(int index) const;
+
+    // 是否已满足自适应采样的收敛条件
+    bool isConverged(int index, const adaptiveSamplingData& adaptive) const;
+
+    int getSamples(int x, int y) const;
+
+    // 全部像素中最大的采样数
+    int getMaxSamples() const;
+
+    int width, height;
+
+    // 采样之和 / 采样数
+    std::vector<a3Spectrum> sum;
+    std::vector<int> count;
+
+    // 亮度的均值与离差平方和
+    std::vector<float> mean, m2;
+
+    // 辅助缓冲之和 / 采样数 不写入检查点 恢复后从0开始累积
+    std::vector<a3Spectrum> albedo;
+    std::vector<t3Vector3f> normal;
+    std::vector<float> depth;
+    std::vector<int> aovCount;
+};
@@ -0,0 +1,110 @@
+﻿#include "AtmosFrameCache.h"
+#include "AtmosCheckpoint.h"
+#include "AtmosMeshCache.h"
+#include "AtmosHash.h"
+#include <map>
+#include <mutex>
+#include <stdio.h>
+#include <sys/stat.h>
+
+// 已计算过的文件哈希
+struct sourceHashData
+{
+    uint64_t size;
+    int64_t time;
+    uint64_t hash;
+};
+
+static std::mutex sourceHashLock;
+static std::map<std::string, sourceHashData> sourceHashes;
+
+bool hashSourceFile(const std::string& path, uint64_t* hash)
+{
+#ifdef _WIN32
+    struct _stat64 info;
+    if(_stat64(path.c_str(), &info) != 0)
+        return false;
+#else
+    struct stat info;
+    if(stat(path.c_str(), &info) != 0)
+        return false;
+#endif
+
+    sourceHashData data;
+    data.size = (uint64_t) info.st_size;
+    data.time = (int64_t) info.st_mtime;
+
+    {
+        std::lock_guard<std::mutex> guard(sourceHashLock);
+        auto iter = sourceHashes.find(path);
+        if(iter != sourceHashes.end() && iter->second.size == data.size && iter->second.time == data.time)
+        {
+            *hash = iter->second.hash;
+            return true;
+        }
+    }
+
+    // 模型缓存有效时其中已记录源文件哈希 无需读取整个OBJ
+    // 否则与写入模型缓存时共用同一次计算
+    if(!AtmosMeshCache::getSourceHash(path.c_str(), &data.hash) && !fnv1aFileCached(path.c_str(), &data.hash))
+        return false;
+
+    {
+        std::lock_guard<std::mutex> guard(sourceHashLock);
+        sourceHashes[path] = data;
+    }
+
+    *hash = data.hash;
+    return true;
+}
+
+std::string getFrameCachePath(const std::string& path, uint64_t fingerprint)
+{
+    char name[32];
+    sprintf(name, "%016llx.", (unsigned long long) fingerprint);
+
+    std::string dir = ofFilePath::getEnclosingDirectory(path, false);
+    return ofFilePath::join(ofFilePath::join(dir, ".a3cache"), name + ofFilePath::getFileExt(path));
+}
+
+bool hasCachedFrame(const renderConfigData& config, const std::string& path, uint64_t fingerprint)
+{
+    return config.enableFrameCache && ofFile::doesFileExist(getFrameCachePath(path, fingerprint), false);
+}
+
+bool restoreCachedFrame(const renderConfigData& config, const std::string& path, uint64_t fingerprint)
+{
+    if(!config.enableFrameCache)
+        return false;
+
+    std::string cachePath = getFrameCachePath(path, fingerprint);
+    if(!ofFile::doesFileExist(cachePath, false))
+        return false;
+
+    if(!ofFile::copyFromTo(cachePath, path, false, true))
+        return false;
+
+    writeFrameFingerprint(path, fingerprint);
+    return true;
+}
+
+void commitFrame(const renderConfigData& config, const std::string& path, uint64_t fingerprint)
+{
+    if(config.enableResume)
+        writeFrameFingerprint(path, fingerprint);
+
+    if(config.enableFrameCache)
+    {
+        std::string cachePath = getFrameCachePath(path, fingerprint);
+        std::string tempPath = cachePath + ".tmp";
+        ofFilePath::createEnclosingDirectory(cachePath, false, true);
+
+        // 先复制至临时文件 避免中断后留下不完整的缓存
+        if(!ofFile::copyFromTo(path, tempPath, false, true) ||
+           !ofFile::moveFromTo(tempPath, cachePath, false, true))
+        {
+            ofFile::removeFile(tempPath, false);
+            a3Log::warning("无法写入帧缓存: %s\n", cachePath.c_str());
+        }
+    }
+}
@@ -0,0 +1,26 @@
+﻿#pragma once
+
+#include <stdint.h>
+#include <string>
+#include "AtmosRenderConfig.h"
+
+// 内容寻址的帧缓存
+// 渲染完成的帧以其指纹(场景参数 + 帧号 + 引用文件的内容)为名复制至输出目录下的.a3cache
+// 之后指纹相同的帧直接从缓存取出 编辑序列后仅重新渲染受影响的帧 撤销修改时无需重新渲染
+// 缓存目录可随时删除
+
+// 文件内容哈希 按路径 / 大小 / 修改时间记忆 OBJ优先使用模型缓存中记录的哈希
+bool hashSourceFile(const std::string& path, uint64_t* hash);
+
+// 缓存中指纹对应的文件 扩展名与输出一致
+std::string getFrameCachePath(const std::string& path, uint64_t fingerprint);
+
+// 缓存中是否存在该指纹 不修改任何文件
+bool hasCachedFrame(const renderConfigData& config, const std::string& path, uint64_t fingerprint);
+
+// 缓存中存在该指纹时复制至path并写入指纹文件
+bool restoreCachedFrame(const renderConfigData& config, const std::string& path, uint64_t fingerprint);
+
+// 帧保存成功后调用(写入线程)
+// 写入指纹文件(enableResume) 并复制至缓存(enableFrameCache)
+void commitFrame(const renderConfigData& config, const std::string& path, uint64_t fingerprint);
@@ -0,0 +1,156 @@
+﻿#include "AtmosFrameWriter.h"
+#include "AtmosQuantize.h"
+#include "AtmosStats.h"
+#include <algorithm>
+
+AtmosFrameWriter::AtmosFrameWriter(int maxFramesInFlight) :inFlight(0), submitted(0), maxFramesInFlight(std::max(1, maxFramesInFlight)), failedFrames(0), stopRequested(false)
+{
+    thread = std::thread(&AtmosFrameWriter::run, this);
+}
+
+AtmosFrameWriter::~AtmosFrameWriter()
+{
+    // 已提交的帧仍需保存
+    flush();
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopRequested = true;
+    }
+    changed.notify_all();
+
+    thread.join();
+}
+
+AtmosFrameWriter::frameData* AtmosFrameWriter::beginFrame(const std::string& path, int width, int height,
+                                                           bool enableToneMapping, bool enableGammaCorrection)
+{
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this]() { return inFlight < maxFramesInFlight; });
+        inFlight++;
+    }
+
+    frameData* frame = new frameData();
+    frame->path = path;
+    frame->enableToneMapping = enableToneMapping;
+    frame->enableGammaCorrection = enableGammaCorrection;
+
+    // 局部渲染区域外保持黑色
+    frame->pixels.allocate(width, height, OF_PIXELS_RGB);
+    memset(frame->pixels.getData(), 0, (size_t) width * height * 3);
+
+    return frame;
+}
+
+void AtmosFrameWriter::writeTile(frameData* frame, const a3Spectrum* colorList, int imageWidth, const tileData& tile)
+{
+    unsigned char* dst = frame->pixels.getData() + (tile.x + tile.y * imageWidth) * 3;
+    quantizeTile(colorList, imageWidth, tile, dst, imageWidth * 3,
+                 quantizeOptions(frame->enableToneMapping, frame->enableGammaCorrection));
+}
+
+void AtmosFrameWriter::endFrame(frameData* frame)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queue.push_back(frame);
+        submitted++;
+    }
+    changed.notify_all();
+}
+
+void AtmosFrameWriter::writeHeatmap(const AtmosFrameBuffer& buffer, const std::string& path, int maxSamples)
+{
+    frameData* frame = beginFrame(path, buffer.width, buffer.height, false, false);
+
+    unsigned char* data = frame->pixels.getData();
+    float invMax = 1.0f / std::max(1, maxSamples);
+    for(size_t i = 0; i < buffer.count.size(); i++)
+    {
+        // jet
+        float t = std::min(buffer.count[i] * invMax, 1.0f);
+        float r = t3Math::clamp(1.5f - fabsf(4.0f * t - 3.0f), 0.0f, 1.0f);
+        float g = t3Math::clamp(1.5f - fabsf(4.0f * t - 2.0f), 0.0f, 1.0f);
+        float b = t3Math::clamp(1.5f - fabsf(4.0f * t - 1.0f), 0.0f, 1.0f);
+
+        // 未渲染的像素保持黑色
+        if(buffer.count[i] == 0)
+            r = g = b = 0.0f;
+
+        data[i * 3 + 0] = (unsigned char) (r * 255.0f + 0.5f);
+        data[i * 3 + 1] = (unsigned char) (g * 255.0f + 0.5f);
+        data[i * 3 + 2] = (unsigned char) (b * 255.0f + 0.5f);
+    }
+
+    endFrame(frame);
+}
+
+void AtmosFrameWriter::cancelFrame(frameData* frame)
+{
+    delete frame;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        inFlight--;
+    }
+    changed.notify_all();
+}
+
+void AtmosFrameWriter::flush()
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    // 仅等待已提交的帧 尚在渲染中的帧不计入
+    changed.wait(guard, [this]() { return submitted == 0; });
+}
+
+int AtmosFrameWriter::getPendingFrames()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return inFlight;
+}
+
+int AtmosFrameWriter::getFailedFrames()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return failedFrames;
+}
+
+void AtmosFrameWriter::run()
+{
+    while(true)
+    {
+        frameData* frame = NULL;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [this]() { return stopRequested || !queue.empty(); });
+
+            if(queue.empty())
+                return;
+
+            frame = queue.front();
+            queue.pop_front();
+        }
+
+        // 编码与写入磁盘不占用UI / 渲染线程
+        auto begin = std::chrono::high_resolution_clock::now();
+        bool saved = ofSaveImage(frame->pixels, frame->path);
+        if(!saved)
+            a3Log::error("帧保存失败: %s\n", frame->path.c_str());
+
+        if(frame->onSaved)
+            frame->onSaved(saved, elapsedSeconds(begin));
+
+        delete frame;
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            inFlight--;
+            submitted--;
+            if(!saved)
+                failedFrames++;
+        }
+        changed.notify_all();
+    }
+}
@@ -0,0 +1,72 @@
+﻿#pragma once
+
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <ofMain.h>
+#include <Atmos.h>
+#include "AtmosTileQueue.h"
+#include "AtmosFrameBuffer.h"
+
+// 异步帧输出
+// 工作线程在网格完成时直接量化写入8位帧(不再保留第二份浮点图像)
+// 整帧完成后交由写入线程编码保存 与下一帧的渲染重叠
+// 同时在途(渲染中 + 等待保存)的帧数有上限 超出时beginFrame阻塞
+class AtmosFrameWriter
+{
+public:
+    struct frameData
+    {
+        std::string path;
+        ofPixels pixels;
+
+        bool enableToneMapping;
+        bool enableGammaCorrection;
+
+        // 保存完成后在写入线程中调用 参数为是否成功与编码保存的耗时
+        std::function<void(bool saved, double seconds)> onSaved;
+    };
+
+    AtmosFrameWriter(int maxFramesInFlight = 2);
+    ~AtmosFrameWriter();
+
+    // 分配新的一帧 在途帧数达到上限时等待之前的帧保存完毕
+    frameData* beginFrame(const std::string& path, int width, int height,
+                          bool enableToneMapping, bool enableGammaCorrection);
+
+    // 工作线程调用 将已完成的网格转换至帧中 不同网格互不重叠无需加锁
+    static void writeTile(frameData* frame, const a3Spectrum* colorList, int imageWidth, const tileData& tile);
+
+    // 全部网格已写入 提交至写入线程
+    void endFrame(frameData* frame);
+
+    // 将每个像素的采样数转换为热力图(蓝: 少 / 红: maxSamples)并提交保存
+    void writeHeatmap(const AtmosFrameBuffer& buffer, const std::string& path, int maxSamples);
+
+    // 中途停止渲染的帧 直接丢弃
+    void cancelFrame(frameData* frame);
+
+    // 阻塞至全部已提交的帧保存完毕
+    void flush();
+
+    // 在途帧数
+    int getPendingFrames();
+
+    // 保存失败的帧数
+    int getFailedFrames();
+
+private:
+    void run();
+
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable changed;
+
+    std::deque<frameData*> queue;
+    // submitted: 已提交等待 / 正在保存的帧
+    int inFlight, submitted, maxFramesInFlight, failedFrames;
+    bool stopRequested;
+};
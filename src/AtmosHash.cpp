@@ -0,0 +1,75 @@
+﻿#include "AtmosHash.h"
+#include <map>
+#include <mutex>
+#include <stdio.h>
+#include <sys/stat.h>
+
+// 已计算过的文件哈希
+struct fileHashData
+{
+    uint64_t size;
+    int64_t time;
+    uint64_t hash;
+};
+
+static std::mutex fileHashLock;
+static std::map<std::string, fileHashData> fileHashes;
+
+bool fnv1aFile(const char* path, uint64_t* hash)
+{
+    FILE* file = fopen(path, "rb");
+    if(!file)
+        return false;
+
+    uint64_t h = A3_FNV_OFFSET_BASIS;
+    unsigned char buffer[64 * 1024];
+    size_t count = 0;
+    while((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        h = fnv1a(buffer, count, h);
+
+    bool ok = !ferror(file);
+    fclose(file);
+
+    if(ok)
+        *hash = h;
+
+    return ok;
+}
+
+bool fnv1aFileCached(const char* path, uint64_t* hash)
+{
+#ifdef _WIN32
+    struct _stat64 info;
+    if(_stat64(path, &info) != 0)
+        return false;
+#else
+    struct stat info;
+    if(stat(path, &info) != 0)
+        return false;
+#endif
+
+    fileHashData data;
+    data.size = (uint64_t) info.st_size;
+    data.time = (int64_t) info.st_mtime;
+
+    {
+        std::lock_guard<std::mutex> guard(fileHashLock);
+        auto iter = fileHashes.find(path);
+        if(iter != fileHashes.end() && iter->second.size == data.size && iter->second.time == data.time)
+        {
+            *hash = iter->second.hash;
+            return true;
+        }
+    }
+
+    if(!fnv1aFile(path, &data.hash))
+        return false;
+
+    {
+        std::lock_guard<std::mutex> guard(fileHashLock);
+        fileHashes[path] = data;
+    }
+
+    *hash = data.hash;
+    return true;
+}
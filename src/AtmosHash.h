@@ -0,0 +1,33 @@
+﻿#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+// 64位FNV-1a 用于校验缓存文件与源文件是否一致
+#define A3_FNV_OFFSET_BASIS 14695981039346656037ULL
+#define A3_FNV_PRIME 1099511628211ULL
+
+inline uint64_t fnv1a(const void* data, size_t size, uint64_t hash = A3_FNV_OFFSET_BASIS)
+{
+    const unsigned char* bytes = (const unsigned char*) data;
+    for(size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= A3_FNV_PRIME;
+    }
+
+    return hash;
+}
+
+inline uint64_t fnv1a(const std::string& s, uint64_t hash = A3_FNV_OFFSET_BASIS)
+{
+    return fnv1a(s.data(), s.size(), hash);
+}
+
+// 整个文件的哈希 读取失败返回false
+bool fnv1aFile(const char* path, uint64_t* hash);
+
+// 同fnv1aFile 按路径 / 大小 / 修改时间记忆结果 进程内同一文件仅读取一次
+// 帧指纹与模型 / 环境贴图缓存共用
+bool fnv1aFileCached(const char* path, uint64_t* hash);
@@ -0,0 +1,402 @@
+﻿#include "AtmosIndexedMesh.h"
+#include "AtmosHash.h"
+#include <algorithm>
+#include <unordered_map>
+#include <cmath>
+#include <cfloat>
+#include <string.h>
+
+// 合并顶点时的键: position xyz, normal xyz, uv
+struct vertexKeyData
+{
+    float value[8];
+
+    bool operator==(const vertexKeyData& other) const
+    {
+        return memcmp(value, other.value, sizeof(value)) == 0;
+    }
+};
+
+struct vertexKeyHash
+{
+    size_t operator()(const vertexKeyData& key) const
+    {
+        return (size_t) fnv1a(key.value, sizeof(key.value));
+    }
+};
+
+static inline float signNotZero(float x)
+{
+    return x < 0.0f ? -1.0f : 1.0f;
+}
+
+// 八面体编码 两个16位有符号定点数
+static uint32_t encodeNormal(const float n[3])
+{
+    float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+    if(l1 <= 0.0f)
+        return 0;
+
+    float x = n[0] / l1, y = n[1] / l1;
+    if(n[2] < 0.0f)
+    {
+        float ox = (1.0f - fabsf(y)) * signNotZero(x);
+        float oy = (1.0f - fabsf(x)) * signNotZero(y);
+        x = ox;
+        y = oy;
+    }
+
+    int16_t qx = (int16_t) lroundf(std::min(std::max(x, -1.0f), 1.0f) * 32767.0f);
+    int16_t qy = (int16_t) lroundf(std::min(std::max(y, -1.0f), 1.0f) * 32767.0f);
+    return (uint32_t) (uint16_t) qx | ((uint32_t) (uint16_t) qy << 16);
+}
+
+static void decodeNormal(uint32_t packed, float n[3])
+{
+    float x = (int16_t) (packed & 0xffff) / 32767.0f;
+    float y = (int16_t) (packed >> 16) / 32767.0f;
+    float z = 1.0f - fabsf(x) - fabsf(y);
+    if(z < 0.0f)
+    {
+        float ox = (1.0f - fabsf(y)) * signNotZero(x);
+        float oy = (1.0f - fabsf(x)) * signNotZero(y);
+        x = ox;
+        y = oy;
+    }
+
+    float length = sqrtf(x * x + y * y + z * z);
+    n[0] = x / length;
+    n[1] = y / length;
+    n[2] = z / length;
+}
+
+AtmosMeshTriangle::AtmosMeshTriangle() :mesh(NULL), index(0)
+{
+
+}
+
+bool AtmosMeshTriangle::intersect(const a3Ray& ray, float* t, float* u, float* v) const
+{
+    return mesh->intersect(index, ray, t, u, v) && *t > ray.minT && *t < ray.maxT;
+}
+
+t3Vector3f AtmosMeshTriangle::getNormal(const t3Vector3f&, float u, float v) const
+{
+    return mesh->getNormal(index, u, v);
+}
+
+float AtmosMeshTriangle::area() const
+{
+    return mesh->getArea(index);
+}
+
+AtmosIndexedMesh::AtmosIndexedMesh(AtmosArena* arena) :positions(arena), normals(arena), uvs(arena),
+                                                        packedNormals(arena), packedUVs(arena),
+                                                        indices(arena), triangles(arena)
+{
+    uvMin[0] = uvMin[1] = 0.0f;
+    uvScale[0] = uvScale[1] = 0.0f;
+}
+
+bool AtmosIndexedMesh::setTriangles(const std::vector<a3Shape*>& primitives)
+{
+    // 先在堆上合并 数量确定后再一次写入(可能位于arena的)数组
+    std::vector<float> vertices;
+    std::vector<uint32_t> index;
+
+    std::unordered_map<vertexKeyData, uint32_t, vertexKeyHash> vertexMap;
+    vertexMap.reserve(primitives.size() * 2);
+    index.reserve(primitives.size() * 3);
+
+    for(auto p : primitives)
+    {
+        const a3Triangle* triangle = dynamic_cast<const a3Triangle*>(p);
+        if(!triangle)
+            return false;
+
+        const t3Vector3f* v[3] = {&triangle->v0, &triangle->v1, &triangle->v2};
+        const t3Vector3f* n[3] = {&triangle->n0, &triangle->n1, &triangle->n2};
+        const t3Vector3f* vt[3] = {&triangle->vt0, &triangle->vt1, &triangle->vt2};
+        for(int k = 0; k < 3; k++)
+        {
+            vertexKeyData key = {{v[k]->x, v[k]->y, v[k]->z,
+                                  n[k]->x, n[k]->y, n[k]->z,
+                                  vt[k]->x, vt[k]->y}};
+
+            auto result = vertexMap.insert(std::make_pair(key, (uint32_t) vertexMap.size()));
+            if(result.second)
+                vertices.insert(vertices.end(), key.value, key.value + 8);
+
+            index.push_back(result.first->second);
+        }
+    }
+
+    uint32_t count = (uint32_t) vertexMap.size();
+
+    positions.resize(count * 3);
+    normals.resize(count * 3);
+    uvs.resize(count * 2);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        const float* v = &vertices[i * 8];
+        std::copy(v, v + 3, &positions[i * 3]);
+        std::copy(v + 3, v + 6, &normals[i * 3]);
+        std::copy(v + 6, v + 8, &uvs[i * 2]);
+    }
+
+    packedNormals.clear();
+    packedUVs.clear();
+    indices.assign(index.begin(), index.end());
+
+    setShapes();
+    return true;
+}
+
+void AtmosIndexedMesh::setVertices(uint32_t vertexCount, const float* p, const float* n, const float* uv,
+                                   uint32_t triangleCount, const uint32_t* index, bool compact)
+{
+    positions.assign(p, p + vertexCount * 3);
+
+    normals.clear();
+    uvs.clear();
+    packedNormals.clear();
+    packedUVs.clear();
+
+    if(compact)
+        pack(vertexCount, n, uv);
+    else
+    {
+        if(n)
+            normals.assign(n, n + vertexCount * 3);
+        if(uv)
+            uvs.assign(uv, uv + vertexCount * 2);
+    }
+
+    indices.assign(index, index + triangleCount * 3);
+
+    setShapes();
+}
+
+void AtmosIndexedMesh::pack(uint32_t vertexCount, const float* n, const float* uv)
+{
+    if(n)
+    {
+        packedNormals.resize(vertexCount);
+        for(uint32_t i = 0; i < vertexCount; i++)
+            packedNormals[i] = encodeNormal(&n[i * 3]);
+    }
+
+    if(uv)
+    {
+        float uvMax[2] = {-FLT_MAX, -FLT_MAX};
+        uvMin[0] = uvMin[1] = FLT_MAX;
+        for(uint32_t i = 0; i < vertexCount; i++)
+        {
+            for(int k = 0; k < 2; k++)
+            {
+                uvMin[k] = std::min(uvMin[k], uv[i * 2 + k]);
+                uvMax[k] = std::max(uvMax[k], uv[i * 2 + k]);
+            }
+        }
+
+        for(int k = 0; k < 2; k++)
+            uvScale[k] = (uvMax[k] - uvMin[k]) / 65535.0f;
+
+        packedUVs.resize(vertexCount);
+        for(uint32_t i = 0; i < vertexCount; i++)
+        {
+            uint32_t q[2] = {0, 0};
+            for(int k = 0; k < 2; k++)
+            {
+                if(uvScale[k] > 0.0f)
+                    q[k] = (uint32_t) std::min(lroundf((uv[i * 2 + k] - uvMin[k]) / uvScale[k]), 65535L);
+            }
+
+            packedUVs[i] = q[0] | (q[1] << 16);
+        }
+    }
+}
+
+void AtmosIndexedMesh::compact()
+{
+    if(isCompact())
+        return;
+
+    pack(getVertexCount(), normals.empty() ? NULL : normals.data(), uvs.empty() ? NULL : uvs.data());
+
+    normals.clear();
+    normals.shrink_to_fit();
+    uvs.clear();
+    uvs.shrink_to_fit();
+}
+
+void AtmosIndexedMesh::setMaterial(a3BSDF* bsdf, const a3Spectrum& emission)
+{
+    for(auto& t : triangles)
+    {
+        t.emission = emission;
+        t.bsdf = bsdf;
+        if(bsdf && bsdf->texture)
+            t.bCalTextureCoordinate = true;
+    }
+}
+
+std::vector<a3Shape*> AtmosIndexedMesh::getPrimitives()
+{
+    std::vector<a3Shape*> primitives(triangles.size());
+    for(size_t i = 0; i < triangles.size(); i++)
+        primitives[i] = &triangles[i];
+
+    return primitives;
+}
+
+void AtmosIndexedMesh::setShapes()
+{
+    // 三角形shape只在此处分配 之后地址不变
+    triangles.clear();
+    triangles.shrink_to_fit();
+    triangles.resize(indices.size() / 3);
+    for(size_t i = 0; i < triangles.size(); i++)
+    {
+        triangles[i].mesh = this;
+        triangles[i].index = (uint32_t) i;
+    }
+}
+
+uint32_t AtmosIndexedMesh::getTriangleCount() const
+{
+    return (uint32_t) (indices.size() / 3);
+}
+
+uint32_t AtmosIndexedMesh::getVertexCount() const
+{
+    return (uint32_t) (positions.size() / 3);
+}
+
+const AtmosMeshTriangle* AtmosIndexedMesh::getTriangle(uint32_t triangle) const
+{
+    return &triangles[triangle];
+}
+
+const float* AtmosIndexedMesh::getPosition(uint32_t vertex) const
+{
+    return &positions[vertex * 3];
+}
+
+const uint32_t* AtmosIndexedMesh::getIndices(uint32_t triangle) const
+{
+    return &indices[triangle * 3];
+}
+
+void AtmosIndexedMesh::getVertexNormal(uint32_t vertex, float n[3]) const
+{
+    if(!packedNormals.empty())
+        decodeNormal(packedNormals[vertex], n);
+    else if(!normals.empty())
+    {
+        n[0] = normals[vertex * 3];
+        n[1] = normals[vertex * 3 + 1];
+        n[2] = normals[vertex * 3 + 2];
+    }
+    else
+        n[0] = n[1] = n[2] = 0.0f;
+}
+
+void AtmosIndexedMesh::getVertexTexcoord(uint32_t vertex, float uv[2]) const
+{
+    if(!packedUVs.empty())
+    {
+        uv[0] = uvMin[0] + (packedUVs[vertex] & 0xffff) * uvScale[0];
+        uv[1] = uvMin[1] + (packedUVs[vertex] >> 16) * uvScale[1];
+    }
+    else if(!uvs.empty())
+    {
+        uv[0] = uvs[vertex * 2];
+        uv[1] = uvs[vertex * 2 + 1];
+    }
+    else
+        uv[0] = uv[1] = 0.0f;
+}
+
+t3Vector3f AtmosIndexedMesh::getNormal(uint32_t triangle, float u, float v) const
+{
+    const uint32_t* index = getIndices(triangle);
+    float w[3] = {1.0f - u - v, u, v};
+
+    float n[3] = {0.0f, 0.0f, 0.0f};
+    for(int k = 0; k < 3; k++)
+    {
+        float vn[3];
+        getVertexNormal(index[k], vn);
+        for(int j = 0; j < 3; j++)
+            n[j] += w[k] * vn[j];
+    }
+
+    float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if(length < 1e-6f)
+    {
+        // 缺少顶点法线 使用几何法线
+        const float* p0 = getPosition(index[0]);
+        const float* p1 = getPosition(index[1]);
+        const float* p2 = getPosition(index[2]);
+        float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+        float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+
+        n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if(length <= 0.0f)
+            return t3Vector3f(0.0f, 0.0f, 1.0f);
+    }
+
+    return t3Vector3f(n[0] / length, n[1] / length, n[2] / length);
+}
+
+t3Vector3f AtmosIndexedMesh::getTexcoord(uint32_t triangle, float u, float v) const
+{
+    const uint32_t* index = getIndices(triangle);
+    float w[3] = {1.0f - u - v, u, v};
+
+    float uv[2] = {0.0f, 0.0f};
+    for(int k = 0; k < 3; k++)
+    {
+        float vt[2];
+        getVertexTexcoord(index[k], vt);
+        uv[0] += w[k] * vt[0];
+        uv[1] += w[k] * vt[1];
+    }
+
+    return t3Vector3f(uv[0], uv[1], 0.0f);
+}
+
+float AtmosIndexedMesh::getArea(uint32_t triangle) const
+{
+    const uint32_t* index = getIndices(triangle);
+    const float* p0 = getPosition(index[0]);
+    const float* p1 = getPosition(index[1]);
+    const float* p2 = getPosition(index[2]);
+    float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+
+    float c[3] = {e1[1] * e2[2] - e1[2] * e2[1],
+                  e1[2] * e2[0] - e1[0] * e2[2],
+                  e1[0] * e2[1] - e1[1] * e2[0]};
+    return 0.5f * sqrtf(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+}
+
+bool AtmosIndexedMesh::isCompact() const
+{
+    return !packedNormals.empty() || !packedUVs.empty();
+}
+
+size_t AtmosIndexedMesh::getMemorySize() const
+{
+    return positions.capacity() * sizeof(float) +
+           normals.capacity() * sizeof(float) +
+           uvs.capacity() * sizeof(float) +
+           packedNormals.capacity() * sizeof(uint32_t) +
+           packedUVs.capacity() * sizeof(uint32_t) +
+           indices.capacity() * sizeof(uint32_t) +
+           triangles.capacity() * sizeof(AtmosMeshTriangle);
+}
@@ -0,0 +1,143 @@
+﻿#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <Atmos.h>
+#include "AtmosArena.h"
+
+class AtmosIndexedMesh;
+
+// 网格中的一个三角形 仅作为交点记录中的shape提供bsdf与法线
+// 顶点由所属网格持有 自身不保存顶点数据
+class AtmosMeshTriangle : public a3Shape
+{
+public:
+    AtmosMeshTriangle();
+
+    virtual bool intersect(const a3Ray& ray, float* t, float* u, float* v) const;
+
+    virtual t3Vector3f getNormal(const t3Vector3f& hitPoint, float u, float v) const;
+
+    virtual float area() const;
+
+    const AtmosIndexedMesh* mesh;
+    uint32_t index;
+};
+
+// 共享顶点的三角形网格
+// 位置 / 法线 / 纹理坐标各自连续存储 每个三角形仅为3个32位顶点索引
+// 压缩模式下法线为32位八面体编码 纹理坐标为2个16位定点数
+// 给定arena时全部数组从arena分配 网格析构后随arena一起回收
+class AtmosIndexedMesh
+{
+public:
+    AtmosIndexedMesh(AtmosArena* arena = NULL);
+
+    // 由导入器输出的独立三角形合并相同顶点 存在非三角形primitive时返回false
+    // primitives内存不归此处管理
+    bool setTriangles(const std::vector<a3Shape*>& primitives);
+
+    // 直接设定顶点与索引(读取缓存) normals / uvs可为NULL
+    // compact时直接写入压缩后的法线与纹理坐标 不分配浮点数组
+    void setVertices(uint32_t vertexCount, const float* positions, const float* normals, const float* uvs,
+                     uint32_t triangleCount, const uint32_t* indices, bool compact = false);
+
+    // 压缩法线与纹理坐标 不可逆
+    // 仅用于堆上的网格: arena无法归还已分配的浮点数组 arena中的网格应由setVertices在写入时压缩
+    void compact();
+
+    // 全部三角形共用的材质与自发光
+    void setMaterial(a3BSDF* bsdf, const a3Spectrum& emission);
+
+    // 每个三角形对应的shape 内存由网格持有
+    std::vector<a3Shape*> getPrimitives();
+
+    uint32_t getTriangleCount() const;
+    uint32_t getVertexCount() const;
+
+    const AtmosMeshTriangle* getTriangle(uint32_t triangle) const;
+    const float* getPosition(uint32_t vertex) const;
+    const uint32_t* getIndices(uint32_t triangle) const;
+
+    // 三角形求交 u, v为v1, v2的重心坐标
+    bool intersect(uint32_t triangle, const a3Ray& ray, float* t, float* u, float* v) const;
+
+    // 插值后的单位法线 顶点法线缺失时为几何法线
+    t3Vector3f getNormal(uint32_t triangle, float u, float v) const;
+
+    // 插值后的纹理坐标
+    t3Vector3f getTexcoord(uint32_t triangle, float u, float v) const;
+
+    float getArea(uint32_t triangle) const;
+
+    // 未压缩时的法线 / 纹理坐标
+    void getVertexNormal(uint32_t vertex, float n[3]) const;
+    void getVertexTexcoord(uint32_t vertex, float uv[2]) const;
+
+    bool isCompact() const;
+
+    // 顶点 / 索引 / 三角形shape占用的字节数
+    size_t getMemorySize() const;
+
+private:
+    // 三角形shape引用网格地址 不可复制
+    AtmosIndexedMesh(const AtmosIndexedMesh&);
+    AtmosIndexedMesh& operator=(const AtmosIndexedMesh&);
+
+    void setShapes();
+
+    // 由浮点法线 / 纹理坐标写入packedNormals / packedUVs 为NULL时跳过
+    void pack(uint32_t vertexCount, const float* normals, const float* uvs);
+
+    arenaVector<float> positions;
+    arenaVector<float> normals;
+    arenaVector<float> uvs;
+
+    // 压缩后的法线与纹理坐标 纹理坐标按包围范围归一化
+    arenaVector<uint32_t> packedNormals;
+    arenaVector<uint32_t> packedUVs;
+    float uvMin[2], uvScale[2];
+
+    arenaVector<uint32_t> indices;
+    arenaVector<AtmosMeshTriangle> triangles;
+};
+
+inline bool AtmosIndexedMesh::intersect(uint32_t triangle, const a3Ray& ray, float* t, float* u, float* v) const
+{
+    const uint32_t* index = &indices[triangle * 3];
+    const float* p0 = &positions[index[0] * 3];
+    const float* p1 = &positions[index[1] * 3];
+    const float* p2 = &positions[index[2] * 3];
+
+    // Moller-Trumbore
+    float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+
+    float pv[3] = {ray.d.y * e2[2] - ray.d.z * e2[1],
+                   ray.d.z * e2[0] - ray.d.x * e2[2],
+                   ray.d.x * e2[1] - ray.d.y * e2[0]};
+
+    float det = e1[0] * pv[0] + e1[1] * pv[1] + e1[2] * pv[2];
+    if(det > -1e-10f && det < 1e-10f)
+        return false;
+
+    float invDet = 1.0f / det;
+
+    float tv[3] = {ray.o.x - p0[0], ray.o.y - p0[1], ray.o.z - p0[2]};
+    float b1 = (tv[0] * pv[0] + tv[1] * pv[1] + tv[2] * pv[2]) * invDet;
+    if(b1 < 0.0f || b1 > 1.0f)
+        return false;
+
+    float qv[3] = {tv[1] * e1[2] - tv[2] * e1[1],
+                   tv[2] * e1[0] - tv[0] * e1[2],
+                   tv[0] * e1[1] - tv[1] * e1[0]};
+
+    float b2 = (ray.d.x * qv[0] + ray.d.y * qv[1] + ray.d.z * qv[2]) * invDet;
+    if(b2 < 0.0f || b1 + b2 > 1.0f)
+        return false;
+
+    *t = (e2[0] * qv[0] + e2[1] * qv[1] + e2[2] * qv[2]) * invDet;
+    *u = b1;
+    *v = b2;
+    return true;
+}
@@ -0,0 +1,83 @@
+﻿#include "AtmosMaterialTable.h"
+#include "AtmosShapeData.h"
+#include <tuple>
+
+bool AtmosMaterialTable::keyData::operator<(const keyData& other) const
+{
+    return std::tie(type, r, g, b, texture) < std::tie(other.type, other.r, other.g, other.b, other.texture);
+}
+
+AtmosMaterialTable::AtmosMaterialTable()
+{
+
+}
+
+AtmosMaterialTable::~AtmosMaterialTable()
+{
+    clear();
+}
+
+a3BSDF* AtmosMaterialTable::get(int type, const a3Spectrum& R, a3Texture<a3Spectrum>* texture)
+{
+    keyData key;
+    key.type = type;
+    key.r = R.x;
+    key.g = R.y;
+    key.b = R.z;
+    key.texture = texture;
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto iter = materials.find(key);
+    if(iter != materials.end())
+        return iter->second;
+
+    a3BSDF* bsdf = NULL;
+    switch(type)
+    {
+    case DIFFUSE:
+        bsdf = new a3Diffuse(R);
+        break;
+    case MIRROR:
+        bsdf = new a3Conductor(R);
+        break;
+    case GLASS:
+        bsdf = new a3Dieletric(R);
+        break;
+    default:
+        a3Log::error("未找到指定类型材质: %d\n", type);
+        return NULL;
+    }
+
+    bsdf->texture = texture;
+    materials[key] = bsdf;
+
+    return bsdf;
+}
+
+int AtmosMaterialTable::getType(const a3BSDF* bsdf)
+{
+    if(dynamic_cast<const a3Diffuse*>(bsdf))
+        return DIFFUSE;
+    else if(dynamic_cast<const a3Conductor*>(bsdf))
+        return MIRROR;
+    else if(dynamic_cast<const a3Dieletric*>(bsdf))
+        return GLASS;
+
+    return NONE;
+}
+
+void AtmosMaterialTable::clear()
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    for(auto& m : materials)
+        delete m.second;
+    materials.clear();
+}
+
+int AtmosMaterialTable::getCount()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return (int) materials.size();
+}
@@ -0,0 +1,40 @@
+﻿#pragma once
+
+#include <map>
+#include <mutex>
+#include <Atmos.h>
+
+// 共享的材质表
+// 类型 / 反射率 / 纹理相同的shape共用同一个BSDF: 一个Mesh的全部三角形仅对应一个BSDF
+// BSDF由材质表持有 释放primitive时不再逐个删除
+class AtmosMaterialTable
+{
+public:
+    AtmosMaterialTable();
+    ~AtmosMaterialTable();
+
+    // 查找或创建 类型无效时返回NULL
+    // 可被后台预取线程同时调用
+    a3BSDF* get(int type, const a3Spectrum& R, a3Texture<a3Spectrum>* texture);
+
+    // BSDF对应的a3MaterialType 未知类型返回NONE
+    static int getType(const a3BSDF* bsdf);
+
+    // 释放全部BSDF 调用前需确保已没有primitive引用
+    void clear();
+
+    int getCount();
+
+private:
+    struct keyData
+    {
+        int type;
+        float r, g, b;
+        const a3Texture<a3Spectrum>* texture;
+
+        bool operator<(const keyData& other) const;
+    };
+
+    std::mutex lock;
+    std::map<keyData, a3BSDF*> materials;
+};
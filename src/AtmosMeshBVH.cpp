@@ -0,0 +1,423 @@
+﻿#include "AtmosMeshBVH.h"
+#include <algorithm>
+#include <cfloat>
+
+// 叶节点三角形数上限
+#define A3_MESH_BVH_LEAF_SIZE 4
+// SAH分桶数
+#define A3_MESH_BVH_BINS 16
+// 深度上限 保证遍历栈不会溢出
+#define A3_MESH_BVH_MAX_DEPTH 60
+
+static const float traversalCost = 1.0f;
+static const float intersectCost = 1.5f;
+
+AtmosMeshBVH::bounds::bounds()
+{
+    for(int i = 0; i < 3; i++)
+    {
+        bmin[i] = FLT_MAX;
+        bmax[i] = -FLT_MAX;
+    }
+}
+
+void AtmosMeshBVH::bounds::grow(const bounds& b)
+{
+    for(int i = 0; i < 3; i++)
+    {
+        bmin[i] = std::min(bmin[i], b.bmin[i]);
+        bmax[i] = std::max(bmax[i], b.bmax[i]);
+    }
+}
+
+void AtmosMeshBVH::bounds::grow(const float p[3])
+{
+    for(int i = 0; i < 3; i++)
+    {
+        bmin[i] = std::min(bmin[i], p[i]);
+        bmax[i] = std::max(bmax[i], p[i]);
+    }
+}
+
+float AtmosMeshBVH::bounds::area() const
+{
+    float dx = bmax[0] - bmin[0], dy = bmax[1] - bmin[1], dz = bmax[2] - bmin[2];
+    if(dx < 0.0f || dy < 0.0f || dz < 0.0f)
+        return 0.0f;
+
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+AtmosMeshBVH::AtmosMeshBVH(AtmosArena* arena) :rebuildThreshold(1.5f), buildCount(0), refitCount(0),
+                                                nodes(arena), mesh(NULL), indices(arena), buildCost(0.0f),
+                                                wide(arena), enableWide(false)
+{
+
+}
+
+AtmosMeshBVH::bounds AtmosMeshBVH::getTriangleBounds(int index) const
+{
+    const uint32_t* vertex = mesh->getIndices(index);
+
+    bounds b;
+    b.grow(mesh->getPosition(vertex[0]));
+    b.grow(mesh->getPosition(vertex[1]));
+    b.grow(mesh->getPosition(vertex[2]));
+    return b;
+}
+
+void AtmosMeshBVH::build(const AtmosIndexedMesh* m)
+{
+    nodes.clear();
+    indices.clear();
+    wide.clear();
+
+    mesh = m;
+
+    int count = (int) mesh->getTriangleCount();
+    if(count == 0)
+        return;
+
+    std::vector<bounds> primBounds(count), centroids(count);
+    indices.reserve(count);
+    for(int i = 0; i < count; i++)
+    {
+        primBounds[i] = getTriangleBounds(i);
+
+        float c[3];
+        for(int k = 0; k < 3; k++)
+            c[k] = 0.5f * (primBounds[i].bmin[k] + primBounds[i].bmax[k]);
+        centroids[i].grow(c);
+
+        indices.push_back(i);
+    }
+
+    nodes.reserve(2 * count);
+    nodes.push_back(node());
+    buildNode(0, 0, count, primBounds, centroids, 0);
+
+    buildCost = computeCost();
+    buildCount++;
+
+    if(enableWide)
+        wide.build(*this);
+}
+
+void AtmosMeshBVH::update(const AtmosIndexedMesh* m)
+{
+    // 拓扑改变 只能重新建立
+    // 上一个网格可能已释放 以indices判断三角形数
+    if(nodes.empty() || m->getTriangleCount() != indices.size())
+    {
+        build(m);
+        return;
+    }
+
+    mesh = m;
+
+    refit();
+    refitCount++;
+
+    // 形变过大导致包围盒严重重叠
+    if(computeCost() > buildCost * rebuildThreshold)
+        build(m);
+    else if(enableWide)
+        wide.build(*this);
+}
+
+void AtmosMeshBVH::buildNode(int nodeIndex, int first, int count, const std::vector<bounds>& primBounds, const std::vector<bounds>& centroids, int depth)
+{
+    bounds box, centroidBox;
+    for(int i = first; i < first + count; i++)
+    {
+        box.grow(primBounds[indices[i]]);
+        centroidBox.grow(centroids[indices[i]]);
+    }
+
+    nodes[nodeIndex].box = box;
+    nodes[nodeIndex].first = first;
+    nodes[nodeIndex].count = count;
+
+    if(count <= A3_MESH_BVH_LEAF_SIZE || depth >= A3_MESH_BVH_MAX_DEPTH)
+        return;
+
+    // 质心分布最广的轴
+    int axis = 0;
+    float extent = centroidBox.bmax[0] - centroidBox.bmin[0];
+    for(int k = 1; k < 3; k++)
+    {
+        if(centroidBox.bmax[k] - centroidBox.bmin[k] > extent)
+        {
+            extent = centroidBox.bmax[k] - centroidBox.bmin[k];
+            axis = k;
+        }
+    }
+
+    // 全部质心重合 无法划分
+    if(extent <= 0.0f)
+        return;
+
+    // 分桶SAH
+    bounds binBounds[A3_MESH_BVH_BINS];
+    int binCount[A3_MESH_BVH_BINS] = {0};
+    float scale = A3_MESH_BVH_BINS / extent;
+
+    auto binOf = [&](int prim)->int
+    {
+        int b = (int) ((centroids[prim].bmin[axis] - centroidBox.bmin[axis]) * scale);
+        return std::min(b, A3_MESH_BVH_BINS - 1);
+    };
+
+    for(int i = first; i < first + count; i++)
+    {
+        int b = binOf(indices[i]);
+        binCount[b]++;
+        binBounds[b].grow(primBounds[indices[i]]);
+    }
+
+    float bestCost = FLT_MAX;
+    int bestSplit = -1;
+    for(int split = 1; split < A3_MESH_BVH_BINS; split++)
+    {
+        bounds left, right;
+        int leftCount = 0, rightCount = 0;
+        for(int b = 0; b < split; b++)
+        {
+            left.grow(binBounds[b]);
+            leftCount += binCount[b];
+        }
+        for(int b = split; b < A3_MESH_BVH_BINS; b++)
+        {
+            right.grow(binBounds[b]);
+            rightCount += binCount[b];
+        }
+
+        if(leftCount == 0 || rightCount == 0)
+            continue;
+
+        float cost = traversalCost + intersectCost * (left.area() * leftCount + right.area() * rightCount) / box.area();
+        if(cost < bestCost)
+        {
+            bestCost = cost;
+            bestSplit = split;
+        }
+    }
+
+    // 划分不如直接作为叶节点
+    if(bestSplit < 0 || bestCost >= intersectCost * count)
+        return;
+
+    int* middle = std::partition(&indices[first], &indices[first] + count, [&](int prim)
+    {
+        return binOf(prim) < bestSplit;
+    });
+    int leftCount = (int) (middle - &indices[first]);
+
+    int left = (int) nodes.size();
+    nodes.push_back(node());
+    nodes.push_back(node());
+
+    nodes[nodeIndex].first = left;
+    nodes[nodeIndex].count = 0;
+
+    buildNode(left, first, leftCount, primBounds, centroids, depth + 1);
+    buildNode(left + 1, first + leftCount, count - leftCount, primBounds, centroids, depth + 1);
+}
+
+void AtmosMeshBVH::refit()
+{
+    for(int i = (int) nodes.size() - 1; i >= 0; i--)
+    {
+        node& n = nodes[i];
+        n.box = bounds();
+
+        if(n.count > 0)
+        {
+            for(int k = n.first; k < n.first + n.count; k++)
+                n.box.grow(getTriangleBounds(indices[k]));
+        }
+        else
+        {
+            n.box.grow(nodes[n.first].box);
+            n.box.grow(nodes[n.first + 1].box);
+        }
+    }
+}
+
+float AtmosMeshBVH::computeCost() const
+{
+    if(nodes.empty())
+        return 0.0f;
+
+    float rootArea = nodes[0].box.area();
+    if(rootArea <= 0.0f)
+        return 0.0f;
+
+    float cost = 0.0f;
+    for(auto& n : nodes)
+    {
+        float p = n.box.area() / rootArea;
+        cost += n.count > 0 ? p * n.count * intersectCost : p * traversalCost;
+    }
+
+    return cost;
+}
+
+bool AtmosMeshBVH::isEmpty() const
+{
+    return nodes.empty();
+}
+
+bool AtmosMeshBVH::getBounds(float bmin[3], float bmax[3]) const
+{
+    if(nodes.empty())
+        return false;
+
+    for(int k = 0; k < 3; k++)
+    {
+        bmin[k] = nodes[0].box.bmin[k];
+        bmax[k] = nodes[0].box.bmax[k];
+    }
+
+    return true;
+}
+
+const AtmosIndexedMesh* AtmosMeshBVH::getMesh() const
+{
+    return mesh;
+}
+
+AtmosArena* AtmosMeshBVH::getArena() const
+{
+    return nodes.get_allocator().arena;
+}
+
+void AtmosMeshBVH::setWide(bool enable)
+{
+    if(enable == enableWide)
+        return;
+
+    enableWide = enable;
+    if(enableWide)
+        wide.build(*this);
+    else
+        wide.clear();
+}
+
+bool AtmosMeshBVH::isWide() const
+{
+    return enableWide;
+}
+
+// slab测试 返回光线是否穿过包围盒的(tMin, tMax)区间
+static inline bool hitBounds(const float bmin[3], const float bmax[3], const float origin[3], const float invDir[3], float tMin, float tMax)
+{
+    for(int k = 0; k < 3; k++)
+    {
+        float t0 = (bmin[k] - origin[k]) * invDir[k];
+        float t1 = (bmax[k] - origin[k]) * invDir[k];
+        if(t0 > t1)
+            std::swap(t0, t1);
+
+        tMin = std::max(tMin, t0);
+        tMax = std::min(tMax, t1);
+        if(tMin > tMax)
+            return false;
+    }
+
+    return true;
+}
+
+bool AtmosMeshBVH::intersect(const a3Ray& ray, float tMax, a3IntersectRecord* intersection) const
+{
+    if(enableWide)
+        return wide.intersect(ray, tMax, intersection);
+
+    if(nodes.empty())
+        return false;
+
+    float origin[3] = {ray.o.x, ray.o.y, ray.o.z};
+    float invDir[3] = {1.0f / ray.d.x, 1.0f / ray.d.y, 1.0f / ray.d.z};
+
+    float closest = tMax;
+    bool hit = false;
+
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+
+    while(top > 0)
+    {
+        const node& n = nodes[stack[--top]];
+        if(!hitBounds(n.box.bmin, n.box.bmax, origin, invDir, ray.minT, closest))
+            continue;
+
+        if(n.count > 0)
+        {
+            for(int k = n.first; k < n.first + n.count; k++)
+            {
+                uint32_t triangle = (uint32_t) indices[k];
+
+                float t, u, v;
+                if(mesh->intersect(triangle, ray, &t, &u, &v) && t > ray.minT && t < closest)
+                {
+                    closest = t;
+                    hit = true;
+
+                    intersection->t = t;
+                    intersection->u = u;
+                    intersection->v = v;
+                    intersection->shape = mesh->getTriangle(triangle);
+                    intersection->p = ray(t);
+                }
+            }
+        }
+        else
+        {
+            stack[top++] = n.first;
+            stack[top++] = n.first + 1;
+        }
+    }
+
+    return hit;
+}
+
+bool AtmosMeshBVH::intersect(const a3Ray& ray, float tMax) const
+{
+    if(enableWide)
+        return wide.intersect(ray, tMax);
+
+    if(nodes.empty())
+        return false;
+
+    float origin[3] = {ray.o.x, ray.o.y, ray.o.z};
+    float invDir[3] = {1.0f / ray.d.x, 1.0f / ray.d.y, 1.0f / ray.d.z};
+
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+
+    while(top > 0)
+    {
+        const node& n = nodes[stack[--top]];
+        if(!hitBounds(n.box.bmin, n.box.bmax, origin, invDir, ray.minT, tMax))
+            continue;
+
+        if(n.count > 0)
+        {
+            for(int k = n.first; k < n.first + n.count; k++)
+            {
+                float t, u, v;
+                if(mesh->intersect((uint32_t) indices[k], ray, &t, &u, &v) && t > ray.minT && t < tMax)
+                    return true;
+            }
+        }
+        else
+        {
+            stack[top++] = n.first;
+            stack[top++] = n.first + 1;
+        }
+    }
+
+    return false;
+}
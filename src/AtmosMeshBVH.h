@@ -0,0 +1,92 @@
+﻿#pragma once
+
+#include <vector>
+#include <Atmos.h>
+#include "AtmosIndexedMesh.h"
+#include "AtmosMeshBVH4.h"
+
+// 单个模型的BVH 直接在网格的共享顶点上求交
+// 关键帧序列拓扑不变时(X_000001.obj, X_000002.obj...)只需自底向上更新包围盒(refit)
+// refit后SAH代价劣化超过阈值才重新建立
+// 给定arena时节点从arena分配
+class AtmosMeshBVH
+{
+public:
+    AtmosMeshBVH(AtmosArena* arena = NULL);
+
+    // 建立BVH 网格内存不归此处管理
+    void build(const AtmosIndexedMesh* mesh);
+
+    // 新一帧的网格 三角形数一致时refit 否则重新建立
+    void update(const AtmosIndexedMesh* mesh);
+
+    // 最近交点 仅接受(ray.minT, tMax)内的交点
+    bool intersect(const a3Ray& ray, float tMax, a3IntersectRecord* intersection) const;
+
+    // 是否存在遮挡
+    bool intersect(const a3Ray& ray, float tMax) const;
+
+    bool isEmpty() const;
+
+    // 根节点包围盒(已随refit更新) 空BVH返回false
+    bool getBounds(float bmin[3], float bmax[3]) const;
+
+    // 最近一次build / update的网格
+    const AtmosIndexedMesh* getMesh() const;
+
+    // 节点所在的arena 使用堆时为NULL
+    AtmosArena* getArena() const;
+
+    // 求交改用合并后的4叉BVH 每次建立 / refit后重新合并
+    void setWide(bool enable);
+    bool isWide() const;
+
+    // refit后的SAH代价超过建立时的倍数即重建
+    float rebuildThreshold;
+
+    // 统计: 建立 / refit次数
+    int buildCount, refitCount;
+
+private:
+    friend class AtmosMeshBVH4;
+
+    struct bounds
+    {
+        bounds();
+
+        void grow(const bounds& b);
+        void grow(const float p[3]);
+        float area() const;
+
+        float bmin[3], bmax[3];
+    };
+
+    struct node
+    {
+        bounds box;
+
+        // 内部节点: 左子节点索引(右子节点紧随其后) / 叶节点: indices中的起始位置
+        int first;
+
+        // 叶节点中的三角形数 内部节点为0
+        int count;
+    };
+
+    bounds getTriangleBounds(int index) const;
+
+    void buildNode(int nodeIndex, int first, int count, const std::vector<bounds>& primBounds, const std::vector<bounds>& centroids, int depth);
+
+    // 子节点索引总大于父节点 逆序遍历即为自底向上
+    void refit();
+
+    float computeCost() const;
+
+    arenaVector<node> nodes;
+    const AtmosIndexedMesh* mesh;
+    arenaVector<int> indices;
+
+    float buildCost;
+
+    AtmosMeshBVH4 wide;
+    bool enableWide;
+};
@@ -0,0 +1,442 @@
+﻿#include "AtmosMeshBVH4.h"
+#include "AtmosMeshBVH.h"
+#include <cfloat>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define A3_BVH4_SSE
+#include <emmintrin.h>
+#endif
+
+// 合并后深度不超过二叉树 每次出栈最多压入4个子节点
+#define A3_MESH_BVH4_STACK_SIZE 256
+
+AtmosMeshBVH4::AtmosMeshBVH4(AtmosArena* arena) :nodes(arena), packets(arena), mesh(NULL)
+{
+
+}
+
+void AtmosMeshBVH4::clear()
+{
+    nodes.clear();
+    packets.clear();
+    mesh = NULL;
+}
+
+bool AtmosMeshBVH4::isEmpty() const
+{
+    return nodes.empty();
+}
+
+void AtmosMeshBVH4::build(const AtmosMeshBVH& bvh)
+{
+    clear();
+
+    if(bvh.nodes.empty())
+        return;
+
+    mesh = bvh.mesh;
+
+    // 4叉树节点数不超过二叉树内部节点数 叶节点每个至少一组三角形
+    nodes.reserve(bvh.nodes.size() / 2 + 1);
+    packets.reserve(bvh.indices.size() / 2 + 1);
+
+    collapse(bvh, 0);
+}
+
+void AtmosMeshBVH4::addLeaf(const AtmosMeshBVH& bvh, int binaryIndex, int& child, int& count)
+{
+    const AtmosMeshBVH::node& leaf = bvh.nodes[binaryIndex];
+
+    child = ~(int) packets.size();
+    count = (leaf.count + 3) / 4;
+
+    for(int first = leaf.first; first < leaf.first + leaf.count; first += 4)
+    {
+        trianglePacket packet;
+        memset(&packet, 0, sizeof(trianglePacket));
+
+        for(int lane = 0; lane < 4 && first + lane < leaf.first + leaf.count; lane++)
+        {
+            uint32_t triangle = (uint32_t) bvh.indices[first + lane];
+            const uint32_t* vertex = mesh->getIndices(triangle);
+            const float* p0 = mesh->getPosition(vertex[0]);
+            const float* p1 = mesh->getPosition(vertex[1]);
+            const float* p2 = mesh->getPosition(vertex[2]);
+
+            // 与AtmosIndexedMesh::intersect相同的边 保证结果一致
+            for(int k = 0; k < 3; k++)
+            {
+                packet.v0[k][lane] = p0[k];
+                packet.e1[k][lane] = p1[k] - p0[k];
+                packet.e2[k][lane] = p2[k] - p0[k];
+            }
+
+            packet.triangle[lane] = triangle;
+        }
+
+        packets.push_back(packet);
+    }
+}
+
+int AtmosMeshBVH4::collapse(const AtmosMeshBVH& bvh, int binaryIndex)
+{
+    int wideIndex = (int) nodes.size();
+    nodes.push_back(wideNode());
+
+    // 反复展开面积最大的内部子节点 直至4个
+    int children[4];
+    int childCount = 0;
+
+    const AtmosMeshBVH::node& n = bvh.nodes[binaryIndex];
+    if(n.count > 0)
+        children[childCount++] = binaryIndex;
+    else
+    {
+        children[childCount++] = n.first;
+        children[childCount++] = n.first + 1;
+
+        while(childCount < 4)
+        {
+            int best = -1;
+            float bestArea = -1.0f;
+            for(int i = 0; i < childCount; i++)
+            {
+                const AtmosMeshBVH::node& c = bvh.nodes[children[i]];
+                if(c.count == 0 && c.box.area() > bestArea)
+                {
+                    best = i;
+                    bestArea = c.box.area();
+                }
+            }
+
+            if(best < 0)
+                break;
+
+            int expand = children[best];
+            children[best] = bvh.nodes[expand].first;
+            children[childCount++] = bvh.nodes[expand].first + 1;
+        }
+    }
+
+    for(int i = 0; i < 4; i++)
+    {
+        // 空位的包围盒为空 永远不会被穿过
+        float bmin[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+        float bmax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+        int child = 0, count = -1;
+
+        if(i < childCount)
+        {
+            const AtmosMeshBVH::node& c = bvh.nodes[children[i]];
+            for(int k = 0; k < 3; k++)
+            {
+                bmin[k] = c.box.bmin[k];
+                bmax[k] = c.box.bmax[k];
+            }
+
+            if(c.count > 0)
+                addLeaf(bvh, children[i], child, count);
+            else
+            {
+                child = collapse(bvh, children[i]);
+                count = 0;
+            }
+        }
+
+        // collapse可能使nodes重新分配 按索引写入
+        wideNode& w = nodes[wideIndex];
+        for(int k = 0; k < 3; k++)
+        {
+            w.bmin[k][i] = bmin[k];
+            w.bmax[k][i] = bmax[k];
+        }
+        w.child[i] = child;
+        w.count[i] = count;
+    }
+
+    return wideIndex;
+}
+
+int AtmosMeshBVH4::hitChildren(const wideNode& n, const float origin[3], const float invDir[3], const int sign[3],
+                               float tMin, float tMax, float tNear[4]) const
+{
+#if defined(A3_BVH4_SSE)
+    __m128 enter = _mm_set1_ps(tMin);
+    __m128 leave = _mm_set1_ps(tMax);
+
+    for(int k = 0; k < 3; k++)
+    {
+        // 按方向的符号选择近 / 远平面 空包围盒因此总是不相交
+        __m128 o = _mm_set1_ps(origin[k]);
+        __m128 inv = _mm_set1_ps(invDir[k]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(sign[k] ? n.bmax[k] : n.bmin[k]), o), inv);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(sign[k] ? n.bmin[k] : n.bmax[k]), o), inv);
+
+        // NaN(0 * inf)时保留第二个操作数
+        enter = _mm_max_ps(t0, enter);
+        leave = _mm_min_ps(t1, leave);
+    }
+
+    _mm_storeu_ps(tNear, enter);
+    return _mm_movemask_ps(_mm_cmple_ps(enter, leave));
+#else
+    int mask = 0;
+    for(int i = 0; i < 4; i++)
+    {
+        float enter = tMin, leave = tMax;
+        for(int k = 0; k < 3; k++)
+        {
+            float t0 = ((sign[k] ? n.bmax[k][i] : n.bmin[k][i]) - origin[k]) * invDir[k];
+            float t1 = ((sign[k] ? n.bmin[k][i] : n.bmax[k][i]) - origin[k]) * invDir[k];
+
+            if(t0 > enter)
+                enter = t0;
+            if(t1 < leave)
+                leave = t1;
+        }
+
+        tNear[i] = enter;
+        if(enter <= leave)
+            mask |= 1 << i;
+    }
+
+    return mask;
+#endif
+}
+
+int AtmosMeshBVH4::intersectPacket(const trianglePacket& packet, const float origin[3], const float direction[3],
+                                   float tMin, float tMax, float* t, float* u, float* v) const
+{
+    float tHit[4], b1Hit[4], b2Hit[4];
+    int mask = 0;
+
+#if defined(A3_BVH4_SSE)
+    // 运算顺序与AtmosIndexedMesh::intersect逐项相同
+    __m128 dx = _mm_set1_ps(direction[0]), dy = _mm_set1_ps(direction[1]), dz = _mm_set1_ps(direction[2]);
+    __m128 e1x = _mm_loadu_ps(packet.e1[0]), e1y = _mm_loadu_ps(packet.e1[1]), e1z = _mm_loadu_ps(packet.e1[2]);
+    __m128 e2x = _mm_loadu_ps(packet.e2[0]), e2y = _mm_loadu_ps(packet.e2[1]), e2z = _mm_loadu_ps(packet.e2[2]);
+
+    __m128 pvx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 pvy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 pvz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, pvx), _mm_mul_ps(e1y, pvy)), _mm_mul_ps(e1z, pvz));
+    __m128 valid = _mm_or_ps(_mm_cmple_ps(det, _mm_set1_ps(-1e-10f)), _mm_cmpge_ps(det, _mm_set1_ps(1e-10f)));
+    if(!_mm_movemask_ps(valid))
+        return -1;
+
+    __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    __m128 tvx = _mm_sub_ps(_mm_set1_ps(origin[0]), _mm_loadu_ps(packet.v0[0]));
+    __m128 tvy = _mm_sub_ps(_mm_set1_ps(origin[1]), _mm_loadu_ps(packet.v0[1]));
+    __m128 tvz = _mm_sub_ps(_mm_set1_ps(origin[2]), _mm_loadu_ps(packet.v0[2]));
+
+    __m128 b1 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tvx, pvx), _mm_mul_ps(tvy, pvy)), _mm_mul_ps(tvz, pvz)), invDet);
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(b1, _mm_setzero_ps()), _mm_cmple_ps(b1, _mm_set1_ps(1.0f))));
+
+    __m128 qvx = _mm_sub_ps(_mm_mul_ps(tvy, e1z), _mm_mul_ps(tvz, e1y));
+    __m128 qvy = _mm_sub_ps(_mm_mul_ps(tvz, e1x), _mm_mul_ps(tvx, e1z));
+    __m128 qvz = _mm_sub_ps(_mm_mul_ps(tvx, e1y), _mm_mul_ps(tvy, e1x));
+
+    __m128 b2 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qvx), _mm_mul_ps(dy, qvy)), _mm_mul_ps(dz, qvz)), invDet);
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(b2, _mm_setzero_ps()), _mm_cmple_ps(_mm_add_ps(b1, b2), _mm_set1_ps(1.0f))));
+
+    __m128 tv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qvx), _mm_mul_ps(e2y, qvy)), _mm_mul_ps(e2z, qvz)), invDet);
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(tv, _mm_set1_ps(tMin)), _mm_cmplt_ps(tv, _mm_set1_ps(tMax))));
+
+    mask = _mm_movemask_ps(valid);
+    if(!mask)
+        return -1;
+
+    _mm_storeu_ps(tHit, tv);
+    _mm_storeu_ps(b1Hit, b1);
+    _mm_storeu_ps(b2Hit, b2);
+#else
+    for(int i = 0; i < 4; i++)
+    {
+        const float e1[3] = {packet.e1[0][i], packet.e1[1][i], packet.e1[2][i]};
+        const float e2[3] = {packet.e2[0][i], packet.e2[1][i], packet.e2[2][i]};
+
+        float pv[3] = {direction[1] * e2[2] - direction[2] * e2[1],
+                       direction[2] * e2[0] - direction[0] * e2[2],
+                       direction[0] * e2[1] - direction[1] * e2[0]};
+
+        float det = e1[0] * pv[0] + e1[1] * pv[1] + e1[2] * pv[2];
+        if(det > -1e-10f && det < 1e-10f)
+            continue;
+
+        float invDet = 1.0f / det;
+
+        float tv[3] = {origin[0] - packet.v0[0][i], origin[1] - packet.v0[1][i], origin[2] - packet.v0[2][i]};
+        float b1 = (tv[0] * pv[0] + tv[1] * pv[1] + tv[2] * pv[2]) * invDet;
+        if(b1 < 0.0f || b1 > 1.0f)
+            continue;
+
+        float qv[3] = {tv[1] * e1[2] - tv[2] * e1[1],
+                       tv[2] * e1[0] - tv[0] * e1[2],
+                       tv[0] * e1[1] - tv[1] * e1[0]};
+
+        float b2 = (direction[0] * qv[0] + direction[1] * qv[1] + direction[2] * qv[2]) * invDet;
+        if(b2 < 0.0f || b1 + b2 > 1.0f)
+            continue;
+
+        float tHitLane = (e2[0] * qv[0] + e2[1] * qv[1] + e2[2] * qv[2]) * invDet;
+        if(tHitLane > tMin && tHitLane < tMax)
+        {
+            tHit[i] = tHitLane;
+            b1Hit[i] = b1;
+            b2Hit[i] = b2;
+            mask |= 1 << i;
+        }
+    }
+
+    if(!mask)
+        return -1;
+#endif
+
+    int best = -1;
+    for(int i = 0; i < 4; i++)
+    {
+        if((mask & (1 << i)) && (best < 0 || tHit[i] < tHit[best]))
+            best = i;
+    }
+
+    *t = tHit[best];
+    *u = b1Hit[best];
+    *v = b2Hit[best];
+    return best;
+}
+
+bool AtmosMeshBVH4::intersect(const a3Ray& ray, float tMax, a3IntersectRecord* intersection) const
+{
+    if(nodes.empty())
+        return false;
+
+    float origin[3] = {ray.o.x, ray.o.y, ray.o.z};
+    float direction[3] = {ray.d.x, ray.d.y, ray.d.z};
+    float invDir[3] = {1.0f / ray.d.x, 1.0f / ray.d.y, 1.0f / ray.d.z};
+    int sign[3] = {invDir[0] < 0.0f, invDir[1] < 0.0f, invDir[2] < 0.0f};
+
+    float closest = tMax;
+    bool hit = false;
+
+    int stack[A3_MESH_BVH4_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+
+    while(top > 0)
+    {
+        const wideNode& n = nodes[stack[--top]];
+
+        float tNear[4];
+        int mask = hitChildren(n, origin, invDir, sign, ray.minT, closest, tNear);
+        if(!mask)
+            continue;
+
+        // 按进入距离由近至远排序
+        int order[4], hits = 0;
+        for(int i = 0; i < 4; i++)
+        {
+            if(!(mask & (1 << i)))
+                continue;
+
+            int k = hits++;
+            while(k > 0 && tNear[order[k - 1]] > tNear[i])
+            {
+                order[k] = order[k - 1];
+                k--;
+            }
+            order[k] = i;
+        }
+
+        // 叶节点由近至远求交 较近的交点可剔除之后的叶节点
+        for(int k = 0; k < hits; k++)
+        {
+            int i = order[k];
+            if(n.count[i] <= 0 || tNear[i] > closest)
+                continue;
+
+            int first = ~n.child[i];
+            for(int p = first; p < first + n.count[i]; p++)
+            {
+                float t, u, v;
+                int lane = intersectPacket(packets[p], origin, direction, ray.minT, closest, &t, &u, &v);
+                if(lane >= 0)
+                {
+                    closest = t;
+                    hit = true;
+
+                    intersection->t = t;
+                    intersection->u = u;
+                    intersection->v = v;
+                    intersection->shape = mesh->getTriangle(packets[p].triangle[lane]);
+                    intersection->p = ray(t);
+                }
+            }
+        }
+
+        // 内部节点由远至近入栈 近的先出栈
+        for(int k = hits - 1; k >= 0; k--)
+        {
+            int i = order[k];
+            if(n.count[i] == 0 && tNear[i] <= closest)
+                stack[top++] = n.child[i];
+        }
+    }
+
+    return hit;
+}
+
+bool AtmosMeshBVH4::intersect(const a3Ray& ray, float tMax) const
+{
+    if(nodes.empty())
+        return false;
+
+    float origin[3] = {ray.o.x, ray.o.y, ray.o.z};
+    float direction[3] = {ray.d.x, ray.d.y, ray.d.z};
+    float invDir[3] = {1.0f / ray.d.x, 1.0f / ray.d.y, 1.0f / ray.d.z};
+    int sign[3] = {invDir[0] < 0.0f, invDir[1] < 0.0f, invDir[2] < 0.0f};
+
+    int stack[A3_MESH_BVH4_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+
+    while(top > 0)
+    {
+        const wideNode& n = nodes[stack[--top]];
+
+        float tNear[4];
+        int mask = hitChildren(n, origin, invDir, sign, ray.minT, tMax, tNear);
+
+        for(int i = 0; i < 4; i++)
+        {
+            if(!(mask & (1 << i)))
+                continue;
+
+            if(n.count[i] > 0)
+            {
+                int first = ~n.child[i];
+                for(int p = first; p < first + n.count[i]; p++)
+                {
+                    float t, u, v;
+                    if(intersectPacket(packets[p], origin, direction, ray.minT, tMax, &t, &u, &v) >= 0)
+                        return true;
+                }
+            }
+            else if(n.count[i] == 0)
+                stack[top++] = n.child[i];
+        }
+    }
+
+    return false;
+}
+
+const char* AtmosMeshBVH4::getKernelName()
+{
+#if defined(A3_BVH4_SSE)
+    return "SSE2";
+#else
+    return "Scalar";
+#endif
+}
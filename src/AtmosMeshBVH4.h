@@ -0,0 +1,67 @@
+﻿#pragma once
+
+#include <stdint.h>
+#include <Atmos.h>
+#include "AtmosArena.h"
+
+class AtmosMeshBVH;
+class AtmosIndexedMesh;
+
+// 由AtmosMeshBVH的二叉树合并而成的4叉BVH
+// 子节点包围盒按SoA存放 一次SSE指令测试4个子节点
+// 叶节点三角形预先展开为每组4个的SoA数据 一次求交4个三角形
+// 不支持SSE时按相同的运算顺序逐个计算 结果与AtmosMeshBVH一致
+class AtmosMeshBVH4
+{
+public:
+    AtmosMeshBVH4(AtmosArena* arena = NULL);
+
+    // 由二叉树重新合并 建立或refit之后调用
+    void build(const AtmosMeshBVH& bvh);
+
+    void clear();
+
+    bool isEmpty() const;
+
+    bool intersect(const a3Ray& ray, float tMax, a3IntersectRecord* intersection) const;
+
+    bool intersect(const a3Ray& ray, float tMax) const;
+
+    // 当前使用的实现名称
+    static const char* getKernelName();
+
+private:
+    struct wideNode
+    {
+        // [轴][子节点]
+        float bmin[3][4], bmax[3][4];
+
+        // 内部节点: 子节点索引 / 叶节点: ~packets中的起始位置
+        int child[4];
+
+        // 叶节点的三角形组数 内部节点为0 空位为-1
+        int count[4];
+    };
+
+    // 4个三角形 v0与两条边按[分量][三角形]存放 空位的边为0 求交总是失败
+    struct trianglePacket
+    {
+        float v0[3][4], e1[3][4], e2[3][4];
+        uint32_t triangle[4];
+    };
+
+    int collapse(const AtmosMeshBVH& bvh, int binaryIndex);
+    void addLeaf(const AtmosMeshBVH& bvh, int binaryIndex, int& child, int& count);
+
+    // 返回packet中最近交点的位置 没有交点时返回-1
+    int intersectPacket(const trianglePacket& packet, const float origin[3], const float direction[3],
+                        float tMin, float tMax, float* t, float* u, float* v) const;
+
+    // 4个子节点中被光线穿过的 返回掩码 tNear为进入距离
+    int hitChildren(const wideNode& n, const float origin[3], const float invDir[3], const int sign[3],
+                    float tMin, float tMax, float tNear[4]) const;
+
+    arenaVector<wideNode> nodes;
+    arenaVector<trianglePacket> packets;
+    const AtmosIndexedMesh* mesh;
+};
@@ -0,0 +1,352 @@
+﻿#include "AtmosMeshCache.h"
+#include "AtmosHash.h"
+#include "util.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// 2: 共享顶点 + 索引
+#define A3_MESH_CACHE_VERSION 2
+
+// 每个顶点的float分量: position xyz, normal xyz, uv
+// 文件中依次为全部position / normal / uv 之后为每个三角形3个uint32索引
+#define A3_MESH_CACHE_VERTEX_FLOATS 8
+
+// 只读映射整个文件
+class mappedFile
+{
+public:
+    mappedFile() :data(NULL), size(0)
+    {
+#ifdef _WIN32
+        file = INVALID_HANDLE_VALUE;
+        mapping = NULL;
+#else
+        file = -1;
+#endif
+    }
+
+    ~mappedFile()
+    {
+        close();
+    }
+
+    bool open(const char* path)
+    {
+#ifdef _WIN32
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if(file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize;
+        if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+            return false;
+        size = (size_t) fileSize.QuadPart;
+
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if(!mapping)
+            return false;
+
+        data = (const char*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        file = ::open(path, O_RDONLY);
+        if(file < 0)
+            return false;
+
+        struct stat info;
+        if(fstat(file, &info) != 0 || info.st_size == 0)
+            return false;
+        size = (size_t) info.st_size;
+
+        void* view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+        data = view == MAP_FAILED ? NULL : (const char*) view;
+#endif
+        return data != NULL;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if(data)
+            UnmapViewOfFile(data);
+        if(mapping)
+            CloseHandle(mapping);
+        if(file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+
+        file = INVALID_HANDLE_VALUE;
+        mapping = NULL;
+#else
+        if(data)
+            munmap((void*) data, size);
+        if(file >= 0)
+            ::close(file);
+
+        file = -1;
+#endif
+        data = NULL;
+        size = 0;
+    }
+
+    const char* data;
+    size_t size;
+
+private:
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int file;
+#endif
+};
+
+AtmosIndexedMesh* AtmosMeshCache::load(const char* path, AtmosArena* arena, bool compact)
+{
+    AtmosIndexedMesh* mesh = new AtmosIndexedMesh(arena);
+    if(read(path, mesh, compact))
+        return mesh;
+
+    // 位于arena的网格先在堆上导入并写入缓存 再一次复制(压缩)至arena
+    AtmosIndexedMesh* imported = arena ? new AtmosIndexedMesh() : mesh;
+
+    a3ModelImporter importer;
+    std::vector<a3Shape*> primitives = importer.load(path);
+
+    bool ok = !primitives.empty() && imported->setTriangles(primitives);
+
+    // 顶点已复制至网格
+    for(auto p : primitives)
+        delete p;
+
+    if(!ok)
+    {
+        if(!primitives.empty())
+            a3Log::warning("模型包含非三角形primitive: %s\n", path);
+
+        if(imported != mesh)
+            delete imported;
+        delete mesh;
+        return NULL;
+    }
+
+    if(!write(path, imported))
+        a3Log::warning("模型缓存写入失败: %s\n", getCachePath(path).c_str());
+
+    if(imported != mesh)
+    {
+        std::vector<float> vertices;
+        getVertices(imported, vertices);
+
+        size_t count = imported->getVertexCount();
+        mesh->setVertices((uint32_t) count, &vertices[0], &vertices[count * 3], &vertices[count * 6],
+                          imported->getTriangleCount(), imported->getIndices(0), compact);
+        delete imported;
+    }
+    else if(compact)
+        mesh->compact();
+
+    return mesh;
+}
+
+std::string AtmosMeshCache::getCachePath(const char* path)
+{
+    return std::string(path) + ".a3mesh";
+}
+
+bool AtmosMeshCache::getFileInfo(const char* path, uint64_t* size, int64_t* time)
+{
+#ifdef _WIN32
+    struct _stat64 info;
+    if(_stat64(path, &info) != 0)
+        return false;
+#else
+    struct stat info;
+    if(stat(path, &info) != 0)
+        return false;
+#endif
+
+    *size = (uint64_t) info.st_size;
+    *time = (int64_t) info.st_mtime;
+    return true;
+}
+
+bool AtmosMeshCache::getSourceHash(const char* path, uint64_t* hash)
+{
+    uint64_t sourceSize = 0;
+    int64_t sourceTime = 0;
+    if(!getFileInfo(path, &sourceSize, &sourceTime))
+        return false;
+
+    FILE* file = fopen(getCachePath(path).c_str(), "rb");
+    if(!file)
+        return false;
+
+    headerData header;
+    bool ok = fread(&header, sizeof(headerData), 1, file) == 1;
+    fclose(file);
+
+    if(!ok || memcmp(header.magic, "A3MC", 4) != 0 || header.version != A3_MESH_CACHE_VERSION ||
+       header.sourceSize != sourceSize || header.sourceTime != sourceTime)
+        return false;
+
+    *hash = header.sourceHash;
+    return true;
+}
+
+bool AtmosMeshCache::read(const char* path, AtmosIndexedMesh* mesh, bool compact)
+{
+    uint64_t sourceSize = 0;
+    int64_t sourceTime = 0;
+    if(!getFileInfo(path, &sourceSize, &sourceTime))
+        return false;
+
+    std::string cachePath = getCachePath(path);
+
+    bool touched = false;
+    {
+        mappedFile cache;
+        if(!cache.open(cachePath.c_str()) || cache.size < sizeof(headerData))
+            return false;
+
+        headerData header;
+        memcpy(&header, cache.data, sizeof(headerData));
+
+        if(memcmp(header.magic, "A3MC", 4) != 0 || header.version != A3_MESH_CACHE_VERSION)
+            return false;
+
+        size_t vertexBytes = (size_t) header.vertexCount * A3_MESH_CACHE_VERTEX_FLOATS * sizeof(float);
+        size_t indexBytes = (size_t) header.triangleCount * 3 * sizeof(uint32_t);
+        if(header.triangleCount == 0 || cache.size != sizeof(headerData) + vertexBytes + indexBytes)
+        {
+            a3Log::warning("模型缓存不完整: %s\n", cachePath.c_str());
+            return false;
+        }
+
+        if(header.sourceSize != sourceSize)
+            return false;
+
+        // 修改时间不同(复制 / 重新导出)时比较内容
+        if(header.sourceTime != sourceTime)
+        {
+            uint64_t hash = 0;
+            if(!fnv1aFileCached(path, &hash) || hash != header.sourceHash)
+                return false;
+
+            touched = true;
+        }
+
+        const float* positions = (const float*) (cache.data + sizeof(headerData));
+        const float* normals = positions + header.vertexCount * 3;
+        const float* uvs = normals + header.vertexCount * 3;
+        const uint32_t* indices = (const uint32_t*) (uvs + header.vertexCount * 2);
+
+        // 索引越界视为缓存损坏
+        for(size_t i = 0; i < (size_t) header.triangleCount * 3; i++)
+        {
+            if(indices[i] >= header.vertexCount)
+            {
+                a3Log::warning("模型缓存索引越界: %s\n", cachePath.c_str());
+                return false;
+            }
+        }
+
+        mesh->setVertices(header.vertexCount, positions, normals, uvs, header.triangleCount, indices, compact);
+    }
+
+    // 内容一致 更新修改时间避免下次再计算哈希
+    if(touched)
+    {
+        FILE* file = fopen(cachePath.c_str(), "r+b");
+        if(file)
+        {
+            fseek(file, offsetof(headerData, sourceTime), SEEK_SET);
+            fwrite(&sourceTime, sizeof(sourceTime), 1, file);
+            fclose(file);
+        }
+    }
+
+    return true;
+}
+
+bool AtmosMeshCache::write(const char* path, const AtmosIndexedMesh* mesh)
+{
+    headerData header;
+    memset(&header, 0, sizeof(headerData));
+    memcpy(header.magic, "A3MC", 4);
+    header.version = A3_MESH_CACHE_VERSION;
+    header.triangleCount = mesh->getTriangleCount();
+    header.vertexCount = mesh->getVertexCount();
+
+    // 仅缓存未压缩的网格
+    if(mesh->isCompact() || header.triangleCount == 0)
+        return false;
+
+    if(!getFileInfo(path, &header.sourceSize, &header.sourceTime) ||
+       !fnv1aFileCached(path, &header.sourceHash))
+        return false;
+
+    std::vector<float> vertices;
+    getVertices(mesh, vertices);
+
+    const uint32_t* indices = mesh->getIndices(0);
+    size_t indexCount = (size_t) header.triangleCount * 3;
+
+    // 先写入临时文件 避免中断后留下不完整的缓存
+    std::string cachePath = getCachePath(path);
+    std::string tempPath = getTempPath(cachePath);
+
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if(!file)
+        return false;
+
+    bool ok = fwrite(&header, sizeof(headerData), 1, file) == 1 &&
+              fwrite(vertices.data(), sizeof(float), vertices.size(), file) == vertices.size() &&
+              fwrite(indices, sizeof(uint32_t), indexCount, file) == indexCount;
+    ok = (fclose(file) == 0) && ok;
+
+    if(!ok)
+    {
+        remove(tempPath.c_str());
+        return false;
+    }
+
+    // 替换失败说明另一写入者已写入同一缓存(内容相同) 不视为错误
+    remove(cachePath.c_str());
+    if(rename(tempPath.c_str(), cachePath.c_str()) != 0)
+    {
+        remove(tempPath.c_str());
+
+        uint64_t size;
+        int64_t time;
+        ok = getFileInfo(cachePath.c_str(), &size, &time);
+    }
+
+    return ok;
+}
+
+void AtmosMeshCache::getVertices(const AtmosIndexedMesh* mesh, std::vector<float>& vertices)
+{
+    size_t count = mesh->getVertexCount();
+    vertices.resize(count * A3_MESH_CACHE_VERTEX_FLOATS);
+    for(size_t i = 0; i < count; i++)
+    {
+        const float* p = mesh->getPosition((uint32_t) i);
+        float* position = &vertices[i * 3];
+        float* normal = &vertices[count * 3 + i * 3];
+        float* uv = &vertices[count * 6 + i * 2];
+
+        position[0] = p[0];
+        position[1] = p[1];
+        position[2] = p[2];
+        mesh->getVertexNormal((uint32_t) i, normal);
+        mesh->getVertexTexcoord((uint32_t) i, uv);
+    }
+}
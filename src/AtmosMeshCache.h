@@ -0,0 +1,48 @@
+﻿#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <Atmos.h>
+#include "AtmosIndexedMesh.h"
+
+// OBJ模型的二进制缓存(X.obj -> X.obj.a3mesh)
+// 首次导入OBJ并合并相同顶点后写入 之后直接映射缓存文件复制顶点与索引 不再解析文本
+// 缓存以源文件的大小与修改时间校验 修改时间不一致时再比较内容哈希
+class AtmosMeshCache
+{
+public:
+    // 优先读取缓存 缓存缺失或失效时导入OBJ并重新写入缓存
+    // 导入失败或模型为空时返回NULL 网格数组从arena分配(可为NULL)
+    // compact时写入网格的同时压缩法线与纹理坐标 arena中不会分配浮点数组
+    static AtmosIndexedMesh* load(const char* path, AtmosArena* arena = NULL, bool compact = false);
+
+    // 缓存文件路径
+    static std::string getCachePath(const char* path);
+
+    // 源文件的内容哈希 缓存有效(大小与修改时间一致)时直接读取缓存头 否则返回false
+    static bool getSourceHash(const char* path, uint64_t* hash);
+
+private:
+    struct headerData
+    {
+        char magic[4];
+        uint32_t version;
+
+        // 源文件信息
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        uint64_t sourceHash;
+
+        uint32_t triangleCount;
+        uint32_t vertexCount;
+    };
+
+    static bool read(const char* path, AtmosIndexedMesh* mesh, bool compact);
+    static bool write(const char* path, const AtmosIndexedMesh* mesh);
+
+    // 按缓存文件的布局取出未压缩网格的顶点
+    static void getVertices(const AtmosIndexedMesh* mesh, std::vector<float>& vertices);
+
+    // 源文件大小与修改时间
+    static bool getFileInfo(const char* path, uint64_t* size, int64_t* time);
+};
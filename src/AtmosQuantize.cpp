@@ -0,0 +1,272 @@
+﻿#include "AtmosQuantize.h"
+#include <math.h>
+
+#if defined(__AVX2__)
+#define A3_QUANTIZE_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define A3_QUANTIZE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define A3_QUANTIZE_NEON
+#include <arm_neon.h>
+#endif
+
+// 每行的颜色按float数组处理 RGB顺序与输出一致
+static_assert(sizeof(a3Spectrum) == 3 * sizeof(float), "a3Spectrum must be 3 packed floats");
+
+// gamma查找表的精度
+#define A3_GAMMA_LUT_SIZE 65536
+
+static const unsigned char* getGammaTable()
+{
+    static unsigned char table[A3_GAMMA_LUT_SIZE];
+    static bool initialized = [] ()
+    {
+        for(int i = 0; i < A3_GAMMA_LUT_SIZE; i++)
+            table[i] = (unsigned char) (powf(i / (float) (A3_GAMMA_LUT_SIZE - 1), 1.0f / 2.2f) * 255.0f + 0.5f);
+
+        return true;
+    }();
+    (void) initialized;
+
+    return table;
+}
+
+// 截断并色调映射至[0, 1]
+static inline float prepare(float value, bool enableToneMapping)
+{
+    value = value > 0.0f ? value : 0.0f;
+    if(enableToneMapping)
+        value = value / (1.0f + value);
+
+    return value < 1.0f ? value : 1.0f;
+}
+
+// 标量处理一行中[begin, count)的分量
+static void quantizeRowScalar(const float* src, int begin, int count, unsigned char* dst,
+                              const quantizeOptions& options, const unsigned char* gamma)
+{
+    for(int i = begin; i < count; i++)
+    {
+        float value = prepare(src[i], options.enableToneMapping);
+
+        if(gamma)
+            dst[i] = gamma[(int) (value * (A3_GAMMA_LUT_SIZE - 1) + 0.5f)];
+        else
+            dst[i] = (unsigned char) (value * 255.0f + 0.5f);
+    }
+}
+
+#if defined(A3_QUANTIZE_AVX2)
+
+static inline __m256 prepare8(__m256 value, bool enableToneMapping, __m256 one)
+{
+    value = _mm256_max_ps(value, _mm256_setzero_ps());
+    if(enableToneMapping)
+        value = _mm256_div_ps(value, _mm256_add_ps(one, value));
+
+    return _mm256_min_ps(value, one);
+}
+
+// 每次处理32个分量
+static int quantizeRowSIMD(const float* src, int count, unsigned char* dst,
+                           const quantizeOptions& options, const unsigned char* gamma)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 scale = _mm256_set1_ps(gamma ? (float) (A3_GAMMA_LUT_SIZE - 1) : 255.0f);
+
+    // packs在128位通道内交错 需要重新排列
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    int i = 0;
+    for(; i + 32 <= count; i += 32)
+    {
+        __m256i v[4];
+        for(int k = 0; k < 4; k++)
+        {
+            __m256 value = prepare8(_mm256_loadu_ps(src + i + k * 8), options.enableToneMapping, one);
+            v[k] = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(value, scale), half));
+        }
+
+        if(gamma)
+        {
+            alignas(32) int index[32];
+            for(int k = 0; k < 4; k++)
+                _mm256_store_si256((__m256i*) (index + k * 8), v[k]);
+
+            for(int k = 0; k < 32; k++)
+                dst[i + k] = gamma[index[k]];
+        }
+        else
+        {
+            __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(v[0], v[1]), _mm256_packs_epi32(v[2], v[3]));
+            _mm256_storeu_si256((__m256i*) (dst + i), _mm256_permutevar8x32_epi32(packed, order));
+        }
+    }
+
+    return i;
+}
+
+#elif defined(A3_QUANTIZE_SSE2)
+
+static inline __m128 prepare4(__m128 value, bool enableToneMapping, __m128 one)
+{
+    value = _mm_max_ps(value, _mm_setzero_ps());
+    if(enableToneMapping)
+        value = _mm_div_ps(value, _mm_add_ps(one, value));
+
+    return _mm_min_ps(value, one);
+}
+
+// 每次处理16个分量
+static int quantizeRowSIMD(const float* src, int count, unsigned char* dst,
+                           const quantizeOptions& options, const unsigned char* gamma)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 scale = _mm_set1_ps(gamma ? (float) (A3_GAMMA_LUT_SIZE - 1) : 255.0f);
+
+    int i = 0;
+    for(; i + 16 <= count; i += 16)
+    {
+        __m128i v[4];
+        for(int k = 0; k < 4; k++)
+        {
+            __m128 value = prepare4(_mm_loadu_ps(src + i + k * 4), options.enableToneMapping, one);
+            v[k] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, scale), half));
+        }
+
+        if(gamma)
+        {
+            int index[16];
+            for(int k = 0; k < 4; k++)
+                _mm_storeu_si128((__m128i*) (index + k * 4), v[k]);
+
+            for(int k = 0; k < 16; k++)
+                dst[i + k] = gamma[index[k]];
+        }
+        else
+        {
+            __m128i packed = _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+            _mm_storeu_si128((__m128i*) (dst + i), packed);
+        }
+    }
+
+    return i;
+}
+
+#elif defined(A3_QUANTIZE_NEON)
+
+static inline float32x4_t prepare4(float32x4_t value, bool enableToneMapping, float32x4_t one)
+{
+    value = vmaxq_f32(value, vdupq_n_f32(0.0f));
+    if(enableToneMapping)
+    {
+#if defined(__aarch64__)
+        value = vdivq_f32(value, vaddq_f32(one, value));
+#else
+        // ARMv7 NEON没有除法 与标量版本一致逐个计算
+        float lane[4];
+        vst1q_f32(lane, value);
+        for(int k = 0; k < 4; k++)
+            lane[k] = lane[k] / (1.0f + lane[k]);
+        value = vld1q_f32(lane);
+#endif
+    }
+
+    return vminq_f32(value, one);
+}
+
+// 每次处理16个分量
+static int quantizeRowSIMD(const float* src, int count, unsigned char* dst,
+                           const quantizeOptions& options, const unsigned char* gamma)
+{
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t half = vdupq_n_f32(0.5f);
+    const float32x4_t scale = vdupq_n_f32(gamma ? (float) (A3_GAMMA_LUT_SIZE - 1) : 255.0f);
+
+    int i = 0;
+    for(; i + 16 <= count; i += 16)
+    {
+        uint32x4_t v[4];
+        for(int k = 0; k < 4; k++)
+        {
+            float32x4_t value = prepare4(vld1q_f32(src + i + k * 4), options.enableToneMapping, one);
+            v[k] = vcvtq_u32_f32(vaddq_f32(vmulq_f32(value, scale), half));
+        }
+
+        if(gamma)
+        {
+            uint32_t index[16];
+            for(int k = 0; k < 4; k++)
+                vst1q_u32(index + k * 4, v[k]);
+
+            for(int k = 0; k < 16; k++)
+                dst[i + k] = gamma[index[k]];
+        }
+        else
+        {
+            uint16x8_t low = vcombine_u16(vmovn_u32(v[0]), vmovn_u32(v[1]));
+            uint16x8_t high = vcombine_u16(vmovn_u32(v[2]), vmovn_u32(v[3]));
+            vst1q_u8(dst + i, vcombine_u8(vmovn_u16(low), vmovn_u16(high)));
+        }
+    }
+
+    return i;
+}
+
+#else
+
+static int quantizeRowSIMD(const float* src, int count, unsigned char* dst,
+                           const quantizeOptions& options, const unsigned char* gamma)
+{
+    return 0;
+}
+
+#endif
+
+void quantizeTile(const a3Spectrum* colorList, int imageWidth, const tileData& tile,
+                  unsigned char* dst, int dstStride,
+                  const quantizeOptions& options)
+{
+    const unsigned char* gamma = options.enableGammaCorrection ? getGammaTable() : NULL;
+
+    for(int y = 0; y < tile.height; y++)
+    {
+        const float* src = (const float*) (colorList + tile.x + (tile.y + y) * imageWidth);
+        unsigned char* row = dst + y * dstStride;
+
+        // 余下不足一组的分量由标量处理
+        int count = tile.width * 3;
+        int done = quantizeRowSIMD(src, count, row, options, gamma);
+        quantizeRowScalar(src, done, count, row, options, gamma);
+    }
+}
+
+void quantizeTileScalar(const a3Spectrum* colorList, int imageWidth, const tileData& tile,
+                        unsigned char* dst, int dstStride,
+                        const quantizeOptions& options)
+{
+    const unsigned char* gamma = options.enableGammaCorrection ? getGammaTable() : NULL;
+
+    for(int y = 0; y < tile.height; y++)
+    {
+        const float* src = (const float*) (colorList + tile.x + (tile.y + y) * imageWidth);
+        quantizeRowScalar(src, 0, tile.width * 3, dst + y * dstStride, options, gamma);
+    }
+}
+
+const char* getQuantizeKernelName()
+{
+#if defined(A3_QUANTIZE_AVX2)
+    return "AVX2";
+#elif defined(A3_QUANTIZE_SSE2)
+    return "SSE2";
+#elif defined(A3_QUANTIZE_NEON)
+    return "NEON";
+#else
+    return "Scalar";
+#endif
+}
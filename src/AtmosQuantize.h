@@ -0,0 +1,32 @@
+﻿#pragma once
+
+#include <Atmos.h>
+#include "AtmosTileQueue.h"
+
+// 量化前的后期处理
+struct quantizeOptions
+{
+    quantizeOptions(bool enableToneMapping = false, bool enableGammaCorrection = false)
+        :enableToneMapping(enableToneMapping), enableGammaCorrection(enableGammaCorrection) {}
+
+    // Reinhard x / (1 + x)
+    bool enableToneMapping;
+
+    // 1 / 2.2 由查找表完成
+    bool enableGammaCorrection;
+};
+
+// 将colorList中一个网格的颜色截断并量化为8位RGB 预览与输出共用
+// 按行遍历 dst为网格左上角 dstStride为dst每行的字节数
+// 编译时按指令集选择AVX2 / SSE2 / NEON实现 结果与标量版本逐字节一致
+void quantizeTile(const a3Spectrum* colorList, int imageWidth, const tileData& tile,
+                  unsigned char* dst, int dstStride,
+                  const quantizeOptions& options = quantizeOptions());
+
+// 标量参考实现
+void quantizeTileScalar(const a3Spectrum* colorList, int imageWidth, const tileData& tile,
+                        unsigned char* dst, int dstStride,
+                        const quantizeOptions& options = quantizeOptions());
+
+// 当前使用的实现名称
+const char* getQuantizeKernelName();
@@ -0,0 +1,154 @@
+﻿#pragma once
+
+#include <string>
+#include <ofMain.h>
+#include "util.h"
+
+// 渲染配置 编辑器与命令行渲染共用
+struct renderConfigData
+{
+    renderConfigData()
+    {
+        // config
+        startFrame = 1;
+        endFrame = 10;
+        spp = 16;
+        hasKeyFrame = true;
+        enableProgressive = false;
+        framesInFlight = 0;
+        enableAdaptive = false;
+        adaptiveThreshold = 0.01f;
+        adaptiveMinSpp = 8;
+        saveHeatmap = false;
+        enableResume = true;
+        checkpointInterval = 60;
+        enableFrameCache = true;
+
+        level[0] = 8;
+        level[1] = 6;
+
+        // image
+        imageWidth = 1280;
+        imageHeight = 720;
+
+        localStartPos[0] = 0;
+        localStartPos[1] = 0;
+        localRenderSize[0] = imageWidth;
+        localRenderSize[1] = imageHeight;
+
+        // 动态获取当前可执行文件目录
+        string exePath = ofFilePath::getCurrentWorkingDirectory();
+        exePath += "\\data\\movie\\Test.png";
+        strcpy(saveToPath, exePath.c_str());
+
+        // integrator
+        enablePath = true;
+        enableWavefront = false;
+        enableBVH = true;
+        enableWideBVH = false;
+        enableCompactMesh = false;
+        maxDepth = -1;
+        russianRouletteDepth = 3;
+        sampler = 0;
+
+        // post effect
+        enableGammaCorrection = false;
+        enableToneMapping = false;
+        enableDenoise = false;
+        enableTemporalDenoise = false;
+
+        // camera
+        cameraLookat[0] = -2.0f;
+        cameraLookat[1] = 0.0f;
+        cameraLookat[2] = 3.5f;
+        cameraUp[0] = 0.0f;
+        cameraUp[1] = 0.0f;
+        cameraUp[2] = 1.0f;
+        cameraOrigin[0] = -2.0f;
+        cameraOrigin[1] = 77.0f;
+        cameraOrigin[2] = 17.0f;
+
+        cameraFov = 40.0f;
+        cameraFocalDistance = 100.0f;
+        cameraLensRadius = 0.0f;
+    }
+
+    // 指定关键帧的图片保存路径
+    std::string getSavePath(int frame) const
+    {
+        if(hasKeyFrame)
+            return addKeyFrameInPath(frame, saveToPath);
+        else
+            return saveToPath;
+    }
+
+    // 指定关键帧的采样数热力图保存路径
+    std::string getHeatmapPath(int frame) const
+    {
+        return ofFilePath::removeExt(getSavePath(frame)) + "_spp.png";
+    }
+
+    // 每帧统计日志(JSON Lines) 整个序列一个文件
+    std::string getStatsPath() const
+    {
+        return ofFilePath::removeExt(saveToPath) + "_stats.jsonl";
+    }
+
+    // config
+    int startFrame, endFrame;
+    int spp;
+    bool hasKeyFrame;
+
+    // 渐进式渲染 按1, 2, 4...spp分遍刷新整帧
+    bool enableProgressive;
+
+    // 命令行渲染同时进行的关键帧数 0为按网格数与核心数自动选择
+    int framesInFlight;
+
+    // 自适应采样 spp为每个像素的采样上限
+    bool enableAdaptive;
+    float adaptiveThreshold;
+    int adaptiveMinSpp;
+
+    // 额外保存采样数热力图(X_spp.png)
+    bool saveHeatmap;
+
+    // 跳过输出与场景指纹一致的帧 从检查点恢复中断的帧
+    bool enableResume;
+    // 检查点写入间隔(秒) 0为仅在中途停止时写入
+    int checkpointInterval;
+
+    // 按指纹缓存已渲染的帧(输出目录/.a3cache) 相同输入的帧直接取出
+    bool enableFrameCache;
+
+    int level[2];
+
+    // image
+    int imageWidth, imageHeight;
+    int localStartPos[2], localRenderSize[2];
+    char saveToPath[1024];
+
+    // integrator / primitive set
+    bool enablePath, enableBVH;
+    // 路径追踪按网格成批进行(AtmosWavefrontIntegrator) 仅enablePath时有效
+    bool enableWavefront;
+    // 模型的BVH合并为4叉 以SSE求交(仅enableBVH时有效)
+    bool enableWideBVH;
+    // 网格法线压缩为八面体编码 纹理坐标压缩为16位定点数
+    bool enableCompactMesh;
+    int maxDepth, russianRouletteDepth;
+    // 0: Random / 1: Sobol(Owen扰乱) / 2: Blue Noise
+    int sampler;
+
+    // post effect
+    bool enableGammaCorrection, enableToneMapping;
+    // 以辅助缓冲(反射率 / 法线 / 深度)引导去噪 渲染时另外写入辅助缓冲
+    bool enableDenoise;
+    // 同时与上一关键帧的去噪结果混合(仅enableDenoise时有效)
+    bool enableTemporalDenoise;
+
+    // camera
+    float cameraLookat[3], cameraOrigin[3], cameraUp[3];
+    float cameraFov;
+    float cameraFocalDistance, cameraLensRadius;
+};
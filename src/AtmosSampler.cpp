@@ -0,0 +1,273 @@
+﻿#include "AtmosSampler.h"
+#include <vector>
+#include <cmath>
+
+// 支持的维数: imageX, imageY, lensU, lensV
+#define A3_SOBOL_DIMENSIONS 4
+
+// 蓝噪声遮罩边长 需为2的幂
+#define A3_BLUE_NOISE_SIZE 64
+
+// void-and-cluster的高斯核标准差
+#define A3_BLUE_NOISE_SIGMA 1.5f
+
+// Joe-Kuo方向数(第2维起): 本原多项式次数 / 系数 / 初始值
+static const uint32_t sobolDegree[A3_SOBOL_DIMENSIONS - 1] = {1, 2, 3};
+static const uint32_t sobolPolynomial[A3_SOBOL_DIMENSIONS - 1] = {0, 1, 1};
+static const uint32_t sobolInitial[A3_SOBOL_DIMENSIONS - 1][3] = {{1}, {1, 3}, {1, 3, 1}};
+
+struct sobolMatrixData
+{
+    sobolMatrixData()
+    {
+        // 第1维为van der Corput序列
+        for(int bit = 0; bit < 32; bit++)
+            v[0][bit] = 1u << (31 - bit);
+
+        for(int d = 1; d < A3_SOBOL_DIMENSIONS; d++)
+        {
+            uint32_t s = sobolDegree[d - 1], a = sobolPolynomial[d - 1];
+
+            for(uint32_t bit = 0; bit < s; bit++)
+                v[d][bit] = sobolInitial[d - 1][bit] << (31 - bit);
+
+            for(uint32_t bit = s; bit < 32; bit++)
+            {
+                v[d][bit] = v[d][bit - s] ^ (v[d][bit - s] >> s);
+                for(uint32_t k = 1; k < s; k++)
+                    v[d][bit] ^= ((a >> (s - 1 - k)) & 1) * v[d][bit - k];
+            }
+        }
+    }
+
+    uint32_t v[A3_SOBOL_DIMENSIONS][32];
+};
+
+static uint32_t sobol(uint32_t index, int dimension)
+{
+    static const sobolMatrixData matrix;
+
+    uint32_t result = 0;
+    for(int bit = 0; index; index >>= 1, bit++)
+    {
+        if(index & 1)
+            result ^= matrix.v[dimension][bit];
+    }
+
+    return result;
+}
+
+static inline uint32_t hashBits(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+static inline uint32_t reverseBits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+    x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+    x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+    x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+    return x;
+}
+
+// 基于哈希的Owen扰乱(Laine-Karras置换) 每一位仅受更高位影响
+static inline uint32_t owenScramble(uint32_t x, uint32_t seed)
+{
+    x = reverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverseBits(x);
+}
+
+static inline float toFloat(uint32_t x)
+{
+    // 取高24位 保证结果小于1
+    return (float) (x >> 8) * (1.0f / 16777216.0f);
+}
+
+static inline uint32_t getPixelSeed(int x, int y)
+{
+    return hashBits((uint32_t) x ^ hashBits((uint32_t) y));
+}
+
+// void-and-cluster生成的蓝噪声遮罩 值为[0, 1)上均匀分布的秩
+struct blueNoiseData
+{
+    blueNoiseData()
+    {
+        const int n = A3_BLUE_NOISE_SIZE, size = n * n;
+
+        // 环面距离上的高斯核
+        std::vector<float> kernel(size);
+        for(int y = 0; y < n; y++)
+        {
+            for(int x = 0; x < n; x++)
+            {
+                int dx = std::min(x, n - x), dy = std::min(y, n - y);
+                kernel[x + y * n] = std::exp(-(float) (dx * dx + dy * dy) / (2.0f * A3_BLUE_NOISE_SIGMA * A3_BLUE_NOISE_SIGMA));
+            }
+        }
+
+        std::vector<char> pattern(size, 0);
+        std::vector<float> energy(size, 0.0f);
+
+        auto update = [&](int index, float sign)
+        {
+            int px = index % n, py = index / n;
+            for(int y = 0; y < n; y++)
+            {
+                for(int x = 0; x < n; x++)
+                    energy[x + y * n] += sign * kernel[((x - px) & (n - 1)) + ((y - py) & (n - 1)) * n];
+            }
+        };
+
+        // 能量最高的1(最密的簇) / 能量最低的0(最大的空洞)
+        auto tightestCluster = [&]()
+        {
+            int best = -1;
+            for(int i = 0; i < size; i++)
+            {
+                if(pattern[i] && (best < 0 || energy[i] > energy[best]))
+                    best = i;
+            }
+            return best;
+        };
+
+        auto largestVoid = [&]()
+        {
+            int best = -1;
+            for(int i = 0; i < size; i++)
+            {
+                if(!pattern[i] && (best < 0 || energy[i] < energy[best]))
+                    best = i;
+            }
+            return best;
+        };
+
+        // 初始图案: 固定种子随机放置约1/10的点 反复将最密的点移至最大的空洞
+        int ones = size / 10;
+        uint32_t state = 1;
+        for(int placed = 0; placed < ones; )
+        {
+            state = hashBits(state + 0x9e3779b9u);
+            int index = (int) (state % size);
+            if(!pattern[index])
+            {
+                pattern[index] = 1;
+                update(index, 1.0f);
+                placed++;
+            }
+        }
+
+        // 通常很快收敛 限制次数以防在两个状态间往复
+        for(int iteration = 0; iteration < size; iteration++)
+        {
+            int cluster = tightestCluster();
+            pattern[cluster] = 0;
+            update(cluster, -1.0f);
+
+            int hole = largestVoid();
+            pattern[hole] = 1;
+            update(hole, 1.0f);
+
+            if(hole == cluster)
+                break;
+        }
+
+        std::vector<int> rank(size, 0);
+
+        // 阶段1: 依次移除最密的点 秩递减
+        std::vector<char> initial = pattern;
+        std::vector<float> initialEnergy = energy;
+        for(int r = ones - 1; r >= 0; r--)
+        {
+            int cluster = tightestCluster();
+            pattern[cluster] = 0;
+            update(cluster, -1.0f);
+            rank[cluster] = r;
+        }
+
+        // 阶段2: 由初始图案依次填入最大的空洞 秩递增
+        pattern = initial;
+        energy = initialEnergy;
+        for(int r = ones; r < size; r++)
+        {
+            int hole = largestVoid();
+            pattern[hole] = 1;
+            update(hole, 1.0f);
+            rank[hole] = r;
+        }
+
+        for(int i = 0; i < size; i++)
+            mask[i] = ((float) rank[i] + 0.5f) / (float) size;
+    }
+
+    float mask[A3_BLUE_NOISE_SIZE * A3_BLUE_NOISE_SIZE];
+};
+
+a3Sampler* createSampler(int type)
+{
+    switch(type)
+    {
+    case SOBOL_SAMPLER:
+        return new AtmosSobolSampler();
+    case BLUE_NOISE_SAMPLER:
+        return new AtmosBlueNoiseSampler();
+    default:
+        return new a3RandomSampler();
+    }
+}
+
+AtmosSampler::AtmosSampler() :sampleIndex(0)
+{
+
+}
+
+void AtmosSampler::setSampleIndex(uint32_t index)
+{
+    sampleIndex = index;
+}
+
+bool AtmosSampler::getMoreSamples(int x, int y, a3CameraSample* sample)
+{
+    sample->imageX = x + get(x, y, sampleIndex, 0);
+    sample->imageY = y + get(x, y, sampleIndex, 1);
+    sample->lensU = get(x, y, sampleIndex, 2);
+    sample->lensV = get(x, y, sampleIndex, 3);
+
+    sampleIndex++;
+    return true;
+}
+
+float AtmosSobolSampler::get(int x, int y, uint32_t index, int dimension) const
+{
+    uint32_t seed = getPixelSeed(x, y);
+
+    // 打乱采样顺序时同一像素的全部维使用相同的序号
+    uint32_t shuffled = owenScramble(index, seed);
+
+    return toFloat(owenScramble(sobol(shuffled, dimension % A3_SOBOL_DIMENSIONS), hashBits(seed + (uint32_t) dimension)));
+}
+
+float AtmosBlueNoiseSampler::get(int x, int y, uint32_t index, int dimension) const
+{
+    static const blueNoiseData noise;
+
+    // 每一维使用遮罩的不同平移 避免各维的偏移相关
+    const int n = A3_BLUE_NOISE_SIZE;
+    int mx = (x + dimension * 23) & (n - 1);
+    int my = (y + dimension * 41) & (n - 1);
+
+    float u = toFloat(sobol(index, dimension % A3_SOBOL_DIMENSIONS)) + noise.mask[mx + my * n];
+    return u < 1.0f ? u : u - 1.0f;
+}
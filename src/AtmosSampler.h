@@ -0,0 +1,50 @@
+﻿#pragma once
+
+#include <stdint.h>
+#include <Atmos.h>
+
+// 与renderConfigData::sampler对应
+enum a3SamplerType
+{
+    RANDOM_SAMPLER = 0,
+    SOBOL_SAMPLER = 1,
+    BLUE_NOISE_SAMPLER = 2
+};
+
+// 创建指定类型的采样器 未知类型为a3RandomSampler
+a3Sampler* createSampler(int type);
+
+// 由像素坐标与像素内的采样序号确定的采样器
+// 同一像素的第n个采样总是相同 与网格顺序 / 线程数 / 是否从检查点恢复无关
+// 渲染一个像素前以setSampleIndex指定其已有的采样数 之后每次getMoreSamples递增
+class AtmosSampler : public a3Sampler
+{
+public:
+    AtmosSampler();
+
+    void setSampleIndex(uint32_t index);
+
+    virtual bool getMoreSamples(int x, int y, a3CameraSample* sample);
+
+    // 像素(x, y)第index个采样的第dimension维 [0, 1)
+    virtual float get(int x, int y, uint32_t index, int dimension) const = 0;
+
+protected:
+    uint32_t sampleIndex;
+};
+
+// Owen扰乱的Sobol序列
+// 每个像素以各自的种子扰乱每一维并打乱采样顺序 像素之间互不相关
+class AtmosSobolSampler : public AtmosSampler
+{
+public:
+    virtual float get(int x, int y, uint32_t index, int dimension) const;
+};
+
+// Sobol序列按蓝噪声遮罩逐像素平移(模1)
+// 相邻像素的误差互补 同等采样数下噪点呈高频分布 更不显眼
+class AtmosBlueNoiseSampler : public AtmosSampler
+{
+public:
+    virtual float get(int x, int y, uint32_t index, int dimension) const;
+};
@@ -0,0 +1,916 @@
+﻿#include "AtmosSceneBuilder.h"
+#include "AtmosSceneIO.h"
+#include "AtmosTwoLevelBVH.h"
+#include "AtmosMeshCache.h"
+#include "AtmosStats.h"
+#include "AtmosSampler.h"
+#include "AtmosCheckpoint.h"
+#include <algorithm>
+
+template<typename T, int N>
+static bool equalArray(const T(&a)[N], const T(&b)[N])
+{
+    for(int i = 0; i < N; i++)
+    {
+        if(a[i] != b[i])
+            return false;
+    }
+
+    return true;
+}
+
+AtmosSceneBuilder::AtmosSceneBuilder() :renderer(NULL), scene(NULL), importSeconds(0.0), bvhSeconds(0.0), compactMesh(false)
+{
+
+}
+
+AtmosSceneBuilder::~AtmosSceneBuilder()
+{
+    release();
+}
+
+void AtmosSceneBuilder::release()
+{
+    waitPrefetch();
+    clearPrefetch();
+
+    deleteRenderer(renderer);
+    deleteScene(scene);
+
+    for(auto& l : lightCache)
+    {
+        A3_SAFE_DELETE(l.second.light);
+    }
+    lightCache.clear();
+
+    // delete all shapes
+    for(auto& s : shapeCache)
+        deleteEntry(s.second);
+    shapeCache.clear();
+
+    // 已没有primitive引用
+    materials.clear();
+
+    std::lock_guard<std::mutex> guard(arenaLock);
+    for(auto arena : arenas)
+        delete arena;
+    arenas.clear();
+    freeArenas.clear();
+}
+
+void AtmosSceneBuilder::build(const renderConfigData& config,
+                              const std::vector<shapeData*>& shapeList,
+                              const std::vector<lightData*>& lightList,
+                              int frame)
+{
+    auto begin = std::chrono::high_resolution_clock::now();
+
+    // 预取结果在updateShapes中被替换 其余丢弃
+    waitPrefetch();
+
+    compactMesh = config.enableCompactMesh;
+
+    updateRenderer(config, frame);
+
+    if(!scene)
+    {
+        scene = new a3Scene();
+        scene->primitiveSet = NULL;
+    }
+
+    updateLights(lightList);
+    updateWavefront(renderer, lightList);
+
+    bool staticChanged = false, dynamicChanged = false;
+    updateShapes(shapeList, frame, staticChanged, dynamicChanged, true);
+    importSeconds = elapsedSeconds(begin);
+
+    begin = std::chrono::high_resolution_clock::now();
+    updatePrimitiveSet(config, shapeList, staticChanged, dynamicChanged);
+    bvhSeconds = elapsedSeconds(begin);
+
+    clearPrefetch();
+
+    lastConfig = config;
+}
+
+AtmosSceneBuilder::frameContextData* AtmosSceneBuilder::buildFrame(const renderConfigData& config,
+                                                                   const std::vector<shapeData*>& shapeList,
+                                                                   const std::vector<lightData*>& lightList,
+                                                                   int frame)
+{
+    auto begin = std::chrono::high_resolution_clock::now();
+
+    waitPrefetch();
+    clearPrefetch();
+
+    compactMesh = config.enableCompactMesh;
+
+    if(!scene)
+    {
+        scene = new a3Scene();
+        scene->primitiveSet = NULL;
+    }
+
+    // 共享部分: 光源与静态shape 不含关键帧模型
+    updateLights(lightList);
+
+    bool staticChanged = false, dynamicChanged = false;
+    updateShapes(shapeList, frame, staticChanged, dynamicChanged, false);
+    importSeconds = elapsedSeconds(begin);
+
+    begin = std::chrono::high_resolution_clock::now();
+    updatePrimitiveSet(config, shapeList, staticChanged, dynamicChanged);
+    bvhSeconds = elapsedSeconds(begin);
+
+    frameContextData* context = new frameContextData();
+    context->frame = frame;
+
+    // 本帧独立的renderer: renderer为空时updateRenderer全部重新创建
+    begin = std::chrono::high_resolution_clock::now();
+    context->renderer = NULL;
+    std::swap(context->renderer, renderer);
+    renderConfigData last = lastConfig;
+    updateRenderer(config, frame);
+    std::swap(context->renderer, renderer);
+    lastConfig = last;
+    updateWavefront(context->renderer, lightList);
+    importSeconds += elapsedSeconds(begin);
+
+    // 本帧的关键帧模型
+    context->arena = acquireArena();
+    for(auto s : shapeList)
+    {
+        if(!isAnimated(s))
+            continue;
+
+        begin = std::chrono::high_resolution_clock::now();
+        AtmosIndexedMesh* model = createModel(s, frame, compactMesh, context->arena);
+        importSeconds += elapsedSeconds(begin);
+
+        if(!model)
+            continue;
+
+        begin = std::chrono::high_resolution_clock::now();
+        if(config.enableBVH)
+        {
+            AtmosMeshBVH* bvh = new AtmosMeshBVH(context->arena);
+            bvh->setWide(config.enableWideBVH);
+            bvh->build(model);
+            context->meshes.push_back(bvh);
+        }
+
+        bvhSeconds += elapsedSeconds(begin);
+
+        context->models.push_back(model);
+    }
+
+    begin = std::chrono::high_resolution_clock::now();
+    context->scene = new a3Scene();
+    context->scene->lights = scene->lights;
+
+    const std::vector<a3Shape*>& staticPrimitives = scene->primitiveSet->primitives;
+    if(config.enableBVH)
+    {
+        AtmosTwoLevelBVH* bvh = new AtmosTwoLevelBVH();
+        context->scene->primitiveSet = bvh;
+
+        // 静态层与静态模型的BVH只读 由全部帧共享
+        const AtmosTwoLevelBVH* base = (const AtmosTwoLevelBVH*) scene->primitiveSet;
+        bvh->shareStatic(base);
+        bvh->meshes = base->meshes;
+        for(auto mesh : context->meshes)
+        {
+            if(!mesh->isEmpty())
+                bvh->meshes.push_back(mesh);
+        }
+        bvh->buildTop();
+    }
+    else
+        context->scene->primitiveSet = new a3Exhaustive();
+
+    // 启用BVH时网格中的三角形由各自的BVH求交 不加入primitive列表
+    for(auto p : staticPrimitives)
+        context->scene->addShape(p);
+    if(!config.enableBVH)
+    {
+        for(auto model : context->models)
+        {
+            for(auto p : model->getPrimitives())
+                context->scene->addShape(p);
+        }
+    }
+
+    bvhSeconds += elapsedSeconds(begin);
+
+    return context;
+}
+
+void AtmosSceneBuilder::releaseFrame(frameContextData* context)
+{
+    if(!context)
+        return;
+
+    deleteRenderer(context->renderer);
+    deleteScene(context->scene);
+
+    for(auto mesh : context->meshes)
+        delete mesh;
+    context->meshes.clear();
+
+    // 三角形shape随网格释放
+    for(auto model : context->models)
+        delete model;
+    context->models.clear();
+
+    recycleArena(context->arena);
+
+    delete context;
+}
+
+void AtmosSceneBuilder::prefetch(const renderConfigData& config,
+                                 const std::vector<shapeData*>& shapeList,
+                                 const std::vector<lightData*>& lightList,
+                                 int from, int last)
+{
+    waitPrefetch();
+    clearPrefetch();
+
+    if(from > last)
+        return;
+
+    compactMesh = config.enableCompactMesh;
+
+    // 在主线程拷贝参数 编辑器在渲染期间仍可修改shapeList
+    for(auto s : shapeList)
+    {
+        if(!isAnimated(s))
+            continue;
+
+        prefetchData data;
+        data.shape = s;
+        data.mesh = *(const meshData*) s;
+
+        auto iter = shapeCache.find(s);
+        if(iter != shapeCache.end())
+            data.cachedSignature = iter->second.signature;
+
+        prefetched.push_back(data);
+    }
+
+    if(prefetched.empty())
+        return;
+
+    // 查找下一帧需计算帧指纹(可能读取整个模型文件) 在后台线程中进行
+    // 场景以文本拷贝 后台线程不访问编辑器数据
+    bool lookup = config.enableResume || config.enableFrameCache;
+    std::string sceneText = lookup ? sceneToString(config, shapeList, lightList) : std::string();
+
+    prefetchThread = std::thread([this, config, sceneText, lookup, from, last]()
+    {
+        int frame = from;
+        if(lookup)
+        {
+            renderConfigData sceneConfig;
+            std::vector<shapeData*> shapes;
+            std::vector<lightData*> lights;
+            if(loadSceneFromString(sceneText, sceneConfig, shapes, lights))
+                frame = findPendingFrame(config, shapes, lights, from, last);
+
+            for(auto s : shapes)
+                delete s;
+            for(auto l : lights)
+                delete l;
+        }
+
+        if(frame > last)
+            return;
+
+        for(auto& data : prefetched)
+        {
+            data.signature = getSignature(&data.mesh, frame);
+
+            // 该帧模型已在缓存中
+            if(data.signature == data.cachedSignature)
+                continue;
+
+            data.arena = acquireArena();
+            data.model = createModel(&data.mesh, frame, config.enableCompactMesh, data.arena);
+        }
+    });
+}
+
+void AtmosSceneBuilder::waitPrefetch()
+{
+    if(prefetchThread.joinable())
+        prefetchThread.join();
+}
+
+void AtmosSceneBuilder::clearPrefetch()
+{
+    for(auto& data : prefetched)
+    {
+        deleteModel(data.model, data.arena);
+    }
+    prefetched.clear();
+}
+
+void AtmosSceneBuilder::deleteRenderer(a3GridRenderer*& renderer)
+{
+    if(renderer)
+    {
+        // 同时释放与renderer相关的指针内存
+        A3_SAFE_DELETE(renderer->sampler);
+        A3_SAFE_DELETE(renderer->camera->image);
+        A3_SAFE_DELETE(renderer->camera);
+        A3_SAFE_DELETE(renderer->integrator);
+        A3_SAFE_DELETE_1DARRAY(renderer->colorList);
+        A3_SAFE_DELETE(renderer);
+    }
+}
+
+void AtmosSceneBuilder::deleteScene(a3Scene*& scene)
+{
+    if(scene)
+    {
+        // light / primitive由缓存持有 scene中仅为引用
+        scene->lights.clear();
+        if(scene->primitiveSet)
+            scene->primitiveSet->primitives.clear();
+        A3_SAFE_DELETE(scene->primitiveSet);
+        A3_SAFE_DELETE(scene);
+    }
+}
+
+void AtmosSceneBuilder::updateRenderer(const renderConfigData& config, int frame)
+{
+    const renderConfigData& last = lastConfig;
+
+    bool sameImage = renderer &&
+                     config.imageWidth == last.imageWidth &&
+                     config.imageHeight == last.imageHeight;
+
+    bool sameCamera = sameImage &&
+                      equalArray(config.cameraOrigin, last.cameraOrigin) &&
+                      equalArray(config.cameraLookat, last.cameraLookat) &&
+                      equalArray(config.cameraUp, last.cameraUp) &&
+                      config.cameraFov == last.cameraFov &&
+                      config.cameraFocalDistance == last.cameraFocalDistance &&
+                      config.cameraLensRadius == last.cameraLensRadius;
+
+    bool sameIntegrator = renderer &&
+                          config.enablePath == last.enablePath &&
+                          config.enableWavefront == last.enableWavefront &&
+                          config.russianRouletteDepth == last.russianRouletteDepth &&
+                          config.maxDepth == last.maxDepth;
+
+    bool sameGrid = sameImage &&
+                    config.spp == last.spp &&
+                    equalArray(config.level, last.level) &&
+                    equalArray(config.localStartPos, last.localStartPos) &&
+                    equalArray(config.localRenderSize, last.localRenderSize);
+
+    a3Sensor* camera = renderer ? renderer->camera : NULL;
+    a3Integrator* integrator = renderer ? renderer->integrator : NULL;
+    a3Sampler* sampler = renderer ? renderer->sampler : NULL;
+    if(sampler && config.sampler != last.sampler)
+        A3_SAFE_DELETE(sampler);
+
+    // 每帧图片保存路径不同 film总是重新分配
+    a3Film* image = new a3Film(config.imageWidth, config.imageHeight, config.getSavePath(frame));
+
+    if(sameCamera)
+    {
+        A3_SAFE_DELETE(camera->image);
+        camera->image = image;
+    }
+    else
+    {
+        if(camera)
+        {
+            A3_SAFE_DELETE(camera->image);
+            A3_SAFE_DELETE(camera);
+        }
+
+        camera = new a3PerspectiveSensor(t3Vector3f(config.cameraOrigin[0], config.cameraOrigin[1], config.cameraOrigin[2]),
+                                         t3Vector3f(config.cameraLookat[0], config.cameraLookat[1], config.cameraLookat[2]),
+                                         t3Vector3f(config.cameraUp[0], config.cameraUp[1], config.cameraUp[2]),
+                                         config.cameraFov, config.cameraFocalDistance, config.cameraLensRadius, image);
+    }
+
+    // integrator
+    if(!sameIntegrator)
+    {
+        A3_SAFE_DELETE(integrator);
+
+        if(config.enablePath && config.enableWavefront)
+        {
+            AtmosWavefrontIntegrator* wavefront = new AtmosWavefrontIntegrator();
+            wavefront->russianRouletteDepth = config.russianRouletteDepth;
+            wavefront->maxDepth = -1;
+            integrator = wavefront;
+        }
+        else if(config.enablePath)
+        {
+            a3PathIntegrator* path = new a3PathIntegrator();
+            path->russianRouletteDepth = config.russianRouletteDepth;
+            path->maxDepth = -1;
+            integrator = path;
+        }
+        else
+        {
+            a3DirectLightingIntegrator* direct = new a3DirectLightingIntegrator();
+            direct->maxDepth = config.maxDepth;
+            integrator = direct;
+        }
+    }
+
+    if(!sampler)
+        sampler = createSampler(config.sampler);
+
+    if(sameGrid)
+    {
+        // 复用帧缓存 清除上一帧的结果
+        int size = config.imageWidth * config.imageHeight;
+        for(int i = 0; i < size; i++)
+            renderer->colorList[i] = a3Spectrum(0.0f);
+    }
+    else
+    {
+        if(renderer)
+        {
+            A3_SAFE_DELETE_1DARRAY(renderer->colorList);
+            A3_SAFE_DELETE(renderer);
+        }
+
+        renderer = new a3GridRenderer(config.spp);
+        renderer->setLevel(config.level[0], config.level[1]);
+        renderer->startX = config.localStartPos[0];
+        renderer->startY = config.localStartPos[1];
+        renderer->renderWidth = config.localRenderSize[0];
+        renderer->renderHeight = config.localRenderSize[1];
+    }
+
+    renderer->camera = camera;
+    renderer->sampler = sampler;
+    renderer->integrator = integrator;
+    renderer->enableGammaCorrection = config.enableGammaCorrection;
+    renderer->enableToneMapping = config.enableToneMapping;
+
+    if(!sameGrid)
+        renderer->begin();
+}
+
+std::string AtmosSceneBuilder::getSignature(const shapeData* shape, int frame)
+{
+    std::string signature = shapeToString(shape);
+
+    if(shape->name == "Mesh")
+    {
+        const meshData* data = (const meshData*) shape;
+        if(data->supportKeyFrame)
+            signature += addKeyFrameInPath(frame, data->modelPath);
+
+        if(compactMesh)
+            signature += "#compact";
+    }
+
+    return signature;
+}
+
+bool AtmosSceneBuilder::isAnimated(const shapeData* shape) const
+{
+    return shape->name == "Mesh" && ((const meshData*) shape)->supportKeyFrame;
+}
+
+void AtmosSceneBuilder::updateShapes(const std::vector<shapeData*>& shapeList, int frame,
+                                      bool& staticChanged, bool& dynamicChanged, bool withAnimated)
+{
+    // 已从编辑器中删除的shape / 不再需要的关键帧模型
+    for(auto iter = shapeCache.begin(); iter != shapeCache.end(); )
+    {
+        if(std::find(shapeList.begin(), shapeList.end(), iter->first) == shapeList.end() ||
+           (!withAnimated && isAnimated(iter->first)))
+        {
+            if(iter->second.model)
+                dynamicChanged = true;
+            else
+                staticChanged = true;
+
+            deleteEntry(iter->second);
+            iter = shapeCache.erase(iter);
+        }
+        else
+            iter++;
+    }
+
+    for(auto s : shapeList)
+    {
+        if(!withAnimated && isAnimated(s))
+            continue;
+
+        std::string signature = getSignature(s, frame);
+
+        auto iter = shapeCache.find(s);
+        if(iter != shapeCache.end() && iter->second.signature == signature)
+            continue;
+
+        // 新增 / 参数改变 / 关键帧模型
+        shapeEntry& entry = shapeCache[s];
+
+        // BVH位于堆上 保留至updatePrimitiveSet以新网格refit
+        deletePrimitives(entry.primitives);
+        deleteModel(entry.model, entry.arena);
+        entry.signature = signature;
+        entry.dirty = true;
+
+        // 优先使用预取的结果
+        auto data = std::find_if(prefetched.begin(), prefetched.end(), [&](const prefetchData& d)
+        {
+            return d.shape == s && d.signature == signature;
+        });
+
+        if(data != prefetched.end())
+        {
+            std::swap(entry.model, data->model);
+            std::swap(entry.arena, data->arena);
+        }
+        else
+        {
+            if(isAnimated(s))
+                entry.arena = acquireArena();
+
+            entry.model = createModel(s, frame, compactMesh, entry.arena);
+            if(!entry.model)
+                entry.primitives = createPrimitives(s);
+        }
+
+        if(entry.model)
+            dynamicChanged = true;
+        else
+            staticChanged = true;
+    }
+}
+
+void AtmosSceneBuilder::updateLights(const std::vector<lightData*>& lightList)
+{
+    for(auto iter = lightCache.begin(); iter != lightCache.end(); )
+    {
+        if(std::find(lightList.begin(), lightList.end(), iter->first) == lightList.end())
+        {
+            A3_SAFE_DELETE(iter->second.light);
+            iter = lightCache.erase(iter);
+        }
+        else
+            iter++;
+    }
+
+    scene->lights.clear();
+
+    for(auto l : lightList)
+    {
+        std::string signature = lightToString(l);
+
+        // 环境贴图文件改变时重新创建(路径不变)
+        if(l->name == "Inifinite Area Light")
+        {
+            int64_t time = 0;
+            if(AtmosEnvironmentCache::getModifiedTime(((const infiniteAreaLightData*) l)->imagePath, &time))
+                signature += " " + std::to_string(time);
+        }
+
+        lightEntry& entry = lightCache[l];
+        if(!entry.light || entry.signature != signature)
+        {
+            A3_SAFE_DELETE(entry.light);
+            entry.light = createLight(l);
+            entry.signature = signature;
+        }
+
+        if(entry.light)
+            scene->addLight(entry.light);
+    }
+}
+
+void AtmosSceneBuilder::updateWavefront(a3GridRenderer* target, const std::vector<lightData*>& lightList)
+{
+    AtmosWavefrontIntegrator* wavefront = dynamic_cast<AtmosWavefrontIntegrator*>(target->integrator);
+    if(!wavefront)
+        return;
+
+    wavefront->lights.clear();
+    wavefront->environment = NULL;
+
+    for(auto l : lightList)
+    {
+        wavefrontLightData light;
+
+        if(l->name == "Point Light")
+        {
+            const pointLightData* data = (const pointLightData*) l;
+            light.type = wavefrontLightData::POINT;
+            memcpy(light.position, data->position, sizeof(light.position));
+            memcpy(light.intensity, data->intensity, sizeof(light.intensity));
+        }
+        else if(l->name == "Spot Light")
+        {
+            const spotLightData* data = (const spotLightData*) l;
+            light.type = wavefrontLightData::SPOT;
+            memcpy(light.position, data->position, sizeof(light.position));
+            memcpy(light.intensity, data->intensity, sizeof(light.intensity));
+
+            t3Vector3f direction = t3Vector3f(data->direction[0], data->direction[1], data->direction[2]).getNormalized();
+            light.direction[0] = direction.x;
+            light.direction[1] = direction.y;
+            light.direction[2] = direction.z;
+
+            light.cosTotalWidth = cosf(data->coneAngle);
+            light.cosFalloffStart = cosf(data->falloffStart);
+        }
+        else if(l->name == "Inifinite Area Light")
+        {
+            // 仅使用第一个环境光 贴图由AtmosEnvironmentCache常驻 文件改变时重新读取
+            const infiniteAreaLightData* data = (const infiniteAreaLightData*) l;
+            if(!wavefront->environment)
+                wavefront->environment = AtmosEnvironmentCache::load(data->imagePath);
+            continue;
+        }
+        else
+            continue;
+
+        wavefront->lights.push_back(light);
+    }
+}
+
+void AtmosSceneBuilder::updatePrimitiveSet(const renderConfigData& config, const std::vector<shapeData*>& shapeList, bool staticChanged, bool dynamicChanged)
+{
+    bool twoLevel = dynamic_cast<AtmosTwoLevelBVH*>(scene->primitiveSet) != NULL;
+    bool typeChanged = !scene->primitiveSet || config.enableBVH != twoLevel;
+
+    if(typeChanged && scene->primitiveSet)
+    {
+        // primitive由缓存持有 此处仅释放加速结构
+        scene->primitiveSet->primitives.clear();
+        A3_SAFE_DELETE(scene->primitiveSet);
+    }
+
+    if(!config.enableBVH)
+    {
+        if(!typeChanged && !staticChanged && !dynamicChanged)
+            return;
+
+        if(!scene->primitiveSet)
+            scene->primitiveSet = new a3Exhaustive();
+
+        scene->primitiveSet->primitives.clear();
+
+        // 按编辑器中的顺序加入
+        for(auto s : shapeList)
+        {
+            auto iter = shapeCache.find(s);
+            if(iter == shapeCache.end())
+                continue;
+
+            const shapeEntry& entry = iter->second;
+            for(auto p : entry.model ? entry.model->getPrimitives() : entry.primitives)
+                scene->addShape(p);
+
+            iter->second.dirty = false;
+        }
+
+        return;
+    }
+
+    AtmosTwoLevelBVH* bvh = NULL;
+    if(typeChanged)
+        scene->primitiveSet = bvh = new AtmosTwoLevelBVH();
+    else
+        bvh = (AtmosTwoLevelBVH*) scene->primitiveSet;
+
+    bvh->primitives.clear();
+    bvh->meshes.clear();
+
+    std::vector<a3Shape*> staticPrimitives;
+    for(auto s : shapeList)
+    {
+        // 帧并行渲染时关键帧模型不在缓存中
+        auto iter = shapeCache.find(s);
+        if(iter == shapeCache.end())
+            continue;
+
+        shapeEntry& entry = iter->second;
+
+        if(entry.model)
+        {
+            // 拓扑不变时refit 否则重建 静态模型仅在重新导入后更新
+            // 未启用BVH期间网格可能已被替换
+            if(entry.dirty || !entry.bvh || entry.bvh->getMesh() != entry.model)
+            {
+                if(!entry.bvh)
+                    entry.bvh = new AtmosMeshBVH();
+
+                entry.bvh->update(entry.model);
+            }
+
+            // 网格已是最新 可按当前选项合并
+            entry.bvh->setWide(config.enableWideBVH);
+
+            if(!entry.bvh->isEmpty())
+                bvh->meshes.push_back(entry.bvh);
+        }
+        else
+            staticPrimitives.insert(staticPrimitives.end(), entry.primitives.begin(), entry.primitives.end());
+
+        // 按编辑器中的顺序加入 网格中的三角形仅由其BVH引用
+        for(auto p : entry.primitives)
+            scene->addShape(p);
+
+        entry.dirty = false;
+    }
+
+    if(typeChanged || staticChanged)
+        bvh->buildStatic(staticPrimitives);
+
+    // 模型增减时重建顶层 否则随各模型refit
+    bvh->buildTop();
+}
+
+std::vector<a3Shape*> AtmosSceneBuilder::createPrimitives(const shapeData* s)
+{
+    std::vector<a3Shape*> primitives;
+
+    // Mesh由createModel导入
+    if(s->name == "Mesh")
+        return primitives;
+
+    // 同一shapeData的全部primitive共用一个BSDF
+    a3BSDF* bsdf = materials.get(s->materialType, a3Spectrum(1.0f), NULL);
+    if(!bsdf)
+        return primitives;
+
+    auto addShape = [&primitives, bsdf](a3Shape* s, a3Spectrum emission)
+    {
+        s->emission = emission;
+        s->bsdf = bsdf;
+        if(bsdf->texture)
+            s->bCalTextureCoordinate = true;
+
+        primitives.push_back(s);
+    };
+
+    if(s->name == "InfinitePlane")
+    {
+        const infinitePlaneData* data = (const infinitePlaneData*) s;
+        addShape(new a3InfinitePlane(t3Vector3f(data->position[0], data->position[1], data->position[2]),
+                                     t3Vector3f(data->normal[0], data->normal[1], data->normal[2])),
+                 a3Spectrum(0.0f));
+    }
+    else if(s->name == "Sphere")
+    {
+        const sphereData* data = (const sphereData*) s;
+        addShape(new a3Sphere(t3Vector3f(data->center[0], data->center[1], data->center[2]), data->radius),
+                 a3Spectrum(0.0f));
+    }
+    else if(s->name == "Disk")
+    {
+        const diskData* data = (const diskData*) s;
+        addShape(new a3Disk(t3Vector3f(data->center[0], data->center[1], data->center[2]),
+                            data->radius,
+                            t3Vector3f(data->normal[0], data->normal[1], data->normal[2])),
+                 a3Spectrum(0.0f));
+    }
+    else if(s->name == "Triangle")
+    {
+        // 懒得写
+    }
+    else if(s->name == "Plane")
+    {
+        // do nothing
+        // still have bug
+    }
+
+    return primitives;
+}
+
+AtmosIndexedMesh* AtmosSceneBuilder::createModel(const shapeData* s, int frame, bool compact, AtmosArena* arena)
+{
+    if(s->name != "Mesh")
+        return NULL;
+
+    // 网格中的全部三角形共用一个BSDF
+    a3BSDF* bsdf = materials.get(s->materialType, a3Spectrum(1.0f), NULL);
+    if(!bsdf)
+        return NULL;
+
+    const meshData* data = (const meshData*) s;
+    AtmosIndexedMesh* model = NULL;
+    if(data->supportKeyFrame)
+    {
+        // 路径中添加关键帧信息
+        string path = addKeyFrameInPath(frame, data->modelPath);
+
+        model = AtmosMeshCache::load(path.c_str(), arena, compact);
+    }
+    else
+        model = AtmosMeshCache::load(data->modelPath, arena, compact);
+
+    if(!model)
+        return NULL;
+
+    model->setMaterial(bsdf, a3Spectrum(0.0f));
+    return model;
+}
+
+a3Light* AtmosSceneBuilder::createLight(const lightData* l)
+{
+    if(l->name == "Area Light")
+    {
+        // do nothing
+        // still have bug
+    }
+    else if(l->name == "Spot Light")
+    {
+        const spotLightData* data = (const spotLightData*) l;
+        return new a3SpotLight(t3Vector3f(data->position[0], data->position[1], data->position[2]),
+                               t3Vector3f(data->direction[0], data->direction[1], data->direction[2]),
+                               a3Spectrum(data->intensity[0], data->intensity[1], data->intensity[2]),
+                               data->coneAngle, data->falloffStart);
+    }
+    else if(l->name == "Point Light")
+    {
+        const pointLightData* data = (const pointLightData*) l;
+        return new a3PointLight(t3Vector3f(data->position[0], data->position[1], data->position[2]),
+                                t3Vector3f(data->intensity[0], data->intensity[1], data->intensity[2]));
+    }
+    else if(l->name == "Inifinite Area Light")
+    {
+        const infiniteAreaLightData* data = (const infiniteAreaLightData*) l;
+        return new a3InfiniteAreaLight(data->imagePath);
+    }
+
+    return NULL;
+}
+
+void AtmosSceneBuilder::deleteEntry(shapeEntry& entry)
+{
+    A3_SAFE_DELETE(entry.bvh);
+    deletePrimitives(entry.primitives);
+    deleteModel(entry.model, entry.arena);
+}
+
+void AtmosSceneBuilder::deleteModel(AtmosIndexedMesh*& model, AtmosArena*& arena)
+{
+    A3_SAFE_DELETE(model);
+    recycleArena(arena);
+}
+
+AtmosArena* AtmosSceneBuilder::acquireArena()
+{
+    std::lock_guard<std::mutex> guard(arenaLock);
+
+    if(!freeArenas.empty())
+    {
+        AtmosArena* arena = freeArenas.back();
+        freeArenas.pop_back();
+        return arena;
+    }
+
+    AtmosArena* arena = new AtmosArena();
+    arenas.push_back(arena);
+    return arena;
+}
+
+void AtmosSceneBuilder::recycleArena(AtmosArena*& arena)
+{
+    if(!arena)
+        return;
+
+    // 其中的对象均已析构 一次回收全部分配
+    arena->reset();
+
+    std::lock_guard<std::mutex> guard(arenaLock);
+    freeArenas.push_back(arena);
+    arena = NULL;
+}
+
+arenaStatsData AtmosSceneBuilder::getArenaStats()
+{
+    std::lock_guard<std::mutex> guard(arenaLock);
+
+    arenaStatsData stats;
+    for(auto arena : arenas)
+        stats.add(arena->getStats());
+
+    return stats;
+}
+
+void AtmosSceneBuilder::deletePrimitives(std::vector<a3Shape*>& primitives)
+{
+    // bsdf由材质表持有
+    for(auto p : primitives)
+    {
+        A3_SAFE_DELETE(p->areaLight);
+        A3_SAFE_DELETE(p);
+    }
+    primitives.clear();
+}
@@ -0,0 +1,196 @@
+﻿#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <Atmos.h>
+#include "AtmosShapeData.h"
+#include "AtmosLightData.h"
+#include "AtmosRenderConfig.h"
+#include "AtmosMeshBVH.h"
+#include "AtmosMaterialTable.h"
+#include "AtmosArena.h"
+#include "AtmosWavefront.h"
+
+// 由编辑器数据构建Atmos渲染所需的renderer与scene
+// 编辑器与命令行渲染共用同一套构建流程
+// 关键帧之间保留未改变的部分: 仅重新导入关键帧模型与参数发生变化的shape / light
+// Mesh导入为共享顶点的网格 启用BVH时每个Mesh一棵AtmosMeshBVH 其余静态shape组成另一层
+// 关键帧模型每帧仅refit
+// 关键帧模型的网格从帧内存池分配 释放时整块回收并留给之后的关键帧 其BVH位于堆上跨帧refit
+// 渲染当前帧的同时可在后台预取下一关键帧的模型(仅读取 不建立BVH)
+class AtmosSceneBuilder
+{
+public:
+    AtmosSceneBuilder();
+    ~AtmosSceneBuilder();
+
+    // 代渲染数据已设定完毕开始渲染前分配工作 frame为当前关键帧
+    // 与上一次构建比较 仅重建发生变化的部分
+    void build(const renderConfigData& config,
+               const std::vector<shapeData*>& shapeList,
+               const std::vector<lightData*>& lightList,
+               int frame);
+
+    // 帧并行渲染中的一帧
+    // 独立的renderer(film / camera / sampler / colorList)与关键帧模型
+    // 静态几何与光源由全部帧共享 只读
+    struct frameContextData
+    {
+        frameContextData() :frame(0), renderer(NULL), scene(NULL), arena(NULL) {}
+
+        int frame;
+        a3GridRenderer* renderer;
+        a3Scene* scene;
+
+        // 本帧的关键帧模型及其BVH 三角形shape由网格持有
+        std::vector<AtmosIndexedMesh*> models;
+        std::vector<AtmosMeshBVH*> meshes;
+
+        // models与meshes所在的内存池
+        AtmosArena* arena;
+    };
+
+    // 将共享部分(光源与静态shape)更新至与编辑器一致 再为frame帧创建独立的上下文
+    // 共享部分发生变化前需先releaseFrame全部上下文
+    frameContextData* buildFrame(const renderConfigData& config,
+                                 const std::vector<shapeData*>& shapeList,
+                                 const std::vector<lightData*>& lightList,
+                                 int frame);
+
+    void releaseFrame(frameContextData* context);
+
+    // 后台线程在from至last中找出下一个需要渲染的帧(findPendingFrame) 并导入其关键帧模型
+    // 查找不取出帧缓存 跳过的帧仍由调用者在真正跳过时处理
+    // 下一次build该帧时直接替换网格 无需等待导入 BVH仍在build中refit
+    void prefetch(const renderConfigData& config,
+                  const std::vector<shapeData*>& shapeList,
+                  const std::vector<lightData*>& lightList,
+                  int from, int last);
+
+    // 同时释放与renderer, scene相关的指针内存
+    void release();
+
+    a3GridRenderer* renderer;
+    a3Scene* scene;
+
+    // 上一次build / buildFrame的耗时
+    // 导入: 等待预取 / 导入模型 / 更新renderer与光源 加速结构: 建立或refit BVH
+    double importSeconds, bvhSeconds;
+
+    // 全部帧内存池的统计
+    arenaStatsData getArenaStats();
+
+private:
+    // 一个shapeData对应的全部primitive(Mesh为导入的所有三角形)
+    struct shapeEntry
+    {
+        shapeEntry() :model(NULL), arena(NULL), bvh(NULL), dirty(true) {}
+
+        std::string signature;
+
+        // Mesh以外shape的primitive Mesh为空(三角形shape由网格持有 按需getPrimitives)
+        std::vector<a3Shape*> primitives;
+
+        // Mesh的网格 其余shape为NULL
+        AtmosIndexedMesh* model;
+
+        // 关键帧模型所在的内存池 静态模型使用堆
+        AtmosArena* arena;
+
+        // Mesh的BVH 未启用BVH或其余shape为NULL
+        AtmosMeshBVH* bvh;
+
+        // 本帧primitive是否重新生成
+        bool dirty;
+    };
+
+    // 预取的单个关键帧模型 后台线程仅访问此结构
+    struct prefetchData
+    {
+        prefetchData() :shape(NULL), model(NULL), arena(NULL) {}
+
+        // 仅作为查找的键 后台线程不访问
+        const shapeData* shape;
+
+        // 后台线程选定帧后的签名 / 预取开始时缓存中的签名(相同时无需导入)
+        std::string signature, cachedSignature;
+
+        // 预取开始时的参数拷贝
+        meshData mesh;
+
+        AtmosIndexedMesh* model;
+        AtmosArena* arena;
+    };
+
+    struct lightEntry
+    {
+        lightEntry() :light(NULL) {}
+
+        std::string signature;
+        a3Light* light;
+    };
+
+    // renderer / camera / film / integrator
+    void updateRenderer(const renderConfigData& config, int frame);
+
+    // 分别记录静态shape与关键帧模型是否发生变化
+    // withAnimated为false时缓存中不保留关键帧模型(帧并行渲染由各帧自行持有)
+    void updateShapes(const std::vector<shapeData*>& shapeList, int frame,
+                      bool& staticChanged, bool& dynamicChanged, bool withAnimated);
+    void updateLights(const std::vector<lightData*>& lightList);
+    // target的integrator为波前式时设定其光源与环境贴图
+    void updateWavefront(a3GridRenderer* target, const std::vector<lightData*>& lightList);
+    void updatePrimitiveSet(const renderConfigData& config, const std::vector<shapeData*>& shapeList, bool staticChanged, bool dynamicChanged);
+
+    void deleteRenderer(a3GridRenderer*& renderer);
+    void deleteScene(a3Scene*& scene);
+
+    // Mesh以外的shape
+    std::vector<a3Shape*> createPrimitives(const shapeData* shape);
+    // Mesh导入为网格 compact时压缩法线与纹理坐标 其余shape或导入失败返回NULL
+    AtmosIndexedMesh* createModel(const shapeData* shape, int frame, bool compact, AtmosArena* arena);
+    a3Light* createLight(const lightData* light);
+    void deletePrimitives(std::vector<a3Shape*>& primitives);
+    // 网格中的三角形shape随网格释放 之后回收arena
+    // 节点位于该arena的BVH需先释放
+    void deleteModel(AtmosIndexedMesh*& model, AtmosArena*& arena);
+
+    // 取出空闲的内存池 / 整块回收
+    AtmosArena* acquireArena();
+    void recycleArena(AtmosArena*& arena);
+    void deleteEntry(shapeEntry& entry);
+
+    // 等待预取线程结束
+    void waitPrefetch();
+
+    // 释放未被使用的预取结果
+    void clearPrefetch();
+
+    // 随关键帧变化的模型
+    bool isAnimated(const shapeData* shape) const;
+
+    // shape在当前帧的签名 关键帧模型附带当前帧路径
+    std::string getSignature(const shapeData* shape, int frame);
+
+    std::map<const shapeData*, shapeEntry> shapeCache;
+
+    // 全部primitive共享的BSDF 随release()释放
+    AtmosMaterialTable materials;
+
+    // 全部帧内存池 / 其中空闲的部分
+    std::mutex arenaLock;
+    std::vector<AtmosArena*> arenas, freeArenas;
+    std::map<const lightData*, lightEntry> lightCache;
+
+    std::vector<prefetchData> prefetched;
+    std::thread prefetchThread;
+
+    // 上一次构建使用的配置
+    renderConfigData lastConfig;
+
+    // 当前构建是否压缩网格 计入Mesh的签名
+    bool compactMesh;
+};
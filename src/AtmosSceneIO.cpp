@@ -0,0 +1,424 @@
+﻿#include "AtmosSceneIO.h"
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <Atmos.h>
+
+// 同一份字段描述同时用于读与写 避免两处字段列表不一致
+struct sceneSection
+{
+    sceneSection(std::ostream* out) :out(out) {}
+    sceneSection(const std::map<std::string, std::string>& values) :out(NULL), values(values) {}
+
+    void field(const char* key, int* v, int n = 1)
+    {
+        if(out)
+        {
+            *out << key << " =";
+            for(int i = 0; i < n; i++)
+                *out << " " << v[i];
+            *out << "\n";
+        }
+        else
+        {
+            std::istringstream in;
+            if(find(key, in))
+                for(int i = 0; i < n; i++)
+                    in >> v[i];
+        }
+    }
+
+    void field(const char* key, float* v, int n = 1)
+    {
+        if(out)
+        {
+            *out << key << " =";
+            for(int i = 0; i < n; i++)
+                *out << " " << v[i];
+            *out << "\n";
+        }
+        else
+        {
+            std::istringstream in;
+            if(find(key, in))
+                for(int i = 0; i < n; i++)
+                    in >> v[i];
+        }
+    }
+
+    void field(const char* key, bool* v)
+    {
+        int i = *v ? 1 : 0;
+        field(key, &i);
+        *v = i != 0;
+    }
+
+    // 字符串取等号后整行 允许路径中带空格
+    void field(const char* key, char* v, int size)
+    {
+        if(out)
+            *out << key << " = " << v << "\n";
+        else
+        {
+            std::map<std::string, std::string>::const_iterator iter = values.find(key);
+            if(iter != values.end())
+            {
+                strncpy(v, iter->second.c_str(), size - 1);
+                v[size - 1] = '\0';
+            }
+        }
+    }
+
+    bool find(const char* key, std::istringstream& in)
+    {
+        std::map<std::string, std::string>::const_iterator iter = values.find(key);
+        if(iter == values.end())
+            return false;
+
+        in.str(iter->second);
+        return true;
+    }
+
+    std::ostream* out;
+    std::map<std::string, std::string> values;
+};
+
+static void bindConfig(sceneSection& s, renderConfigData& c)
+{
+    // config
+    s.field("startFrame", &c.startFrame);
+    s.field("endFrame", &c.endFrame);
+    s.field("spp", &c.spp);
+    s.field("hasKeyFrame", &c.hasKeyFrame);
+    s.field("enableProgressive", &c.enableProgressive);
+    s.field("framesInFlight", &c.framesInFlight);
+    s.field("enableAdaptive", &c.enableAdaptive);
+    s.field("adaptiveThreshold", &c.adaptiveThreshold);
+    s.field("adaptiveMinSpp", &c.adaptiveMinSpp);
+    s.field("saveHeatmap", &c.saveHeatmap);
+    s.field("enableResume", &c.enableResume);
+    s.field("checkpointInterval", &c.checkpointInterval);
+    s.field("enableFrameCache", &c.enableFrameCache);
+    s.field("level", c.level, 2);
+
+    // image
+    s.field("imageWidth", &c.imageWidth);
+    s.field("imageHeight", &c.imageHeight);
+    s.field("localStartPos", c.localStartPos, 2);
+    s.field("localRenderSize", c.localRenderSize, 2);
+    s.field("saveToPath", c.saveToPath, sizeof(c.saveToPath));
+
+    // integrator / primitive set
+    s.field("enablePath", &c.enablePath);
+    s.field("enableWavefront", &c.enableWavefront);
+    s.field("enableBVH", &c.enableBVH);
+    s.field("enableWideBVH", &c.enableWideBVH);
+    s.field("enableCompactMesh", &c.enableCompactMesh);
+    s.field("maxDepth", &c.maxDepth);
+    s.field("russianRouletteDepth", &c.russianRouletteDepth);
+    s.field("sampler", &c.sampler);
+
+    // post effect
+    s.field("enableGammaCorrection", &c.enableGammaCorrection);
+    s.field("enableToneMapping", &c.enableToneMapping);
+    s.field("enableDenoise", &c.enableDenoise);
+    s.field("enableTemporalDenoise", &c.enableTemporalDenoise);
+
+    // camera
+    s.field("cameraLookat", c.cameraLookat, 3);
+    s.field("cameraOrigin", c.cameraOrigin, 3);
+    s.field("cameraUp", c.cameraUp, 3);
+    s.field("cameraFov", &c.cameraFov);
+    s.field("cameraFocalDistance", &c.cameraFocalDistance);
+    s.field("cameraLensRadius", &c.cameraLensRadius);
+}
+
+static void bindShape(sceneSection& s, shapeData* shape)
+{
+    s.field("materialType", &shape->materialType);
+
+    if(shape->name == "Mesh")
+    {
+        meshData* data = (meshData*) shape;
+        s.field("modelPath", data->modelPath, sizeof(data->modelPath));
+        s.field("supportKeyFrame", &data->supportKeyFrame);
+    }
+    else if(shape->name == "InfinitePlane")
+    {
+        infinitePlaneData* data = (infinitePlaneData*) shape;
+        s.field("position", data->position, 3);
+        s.field("normal", data->normal, 3);
+    }
+    else if(shape->name == "Sphere")
+    {
+        sphereData* data = (sphereData*) shape;
+        s.field("radius", &data->radius);
+        s.field("center", data->center, 3);
+    }
+    else if(shape->name == "Disk")
+    {
+        diskData* data = (diskData*) shape;
+        s.field("radius", &data->radius);
+        s.field("center", data->center, 3);
+        s.field("normal", data->normal, 3);
+    }
+    else if(shape->name == "Triangle")
+    {
+        triangleData* data = (triangleData*) shape;
+        s.field("v0", data->v0, 3);
+        s.field("v1", data->v1, 3);
+        s.field("v2", data->v2, 3);
+        s.field("vt0", data->vt0, 3);
+        s.field("vt1", data->vt1, 3);
+        s.field("vt2", data->vt2, 3);
+        s.field("n0", data->n0, 3);
+        s.field("n1", data->n1, 3);
+        s.field("n2", data->n2, 3);
+    }
+    else if(shape->name == "Plane")
+    {
+        planeData* data = (planeData*) shape;
+        s.field("position", data->position, 3);
+        s.field("normal", data->normal, 3);
+        s.field("width", &data->width);
+        s.field("height", &data->height);
+    }
+}
+
+static void bindLight(sceneSection& s, lightData* light)
+{
+    if(light->name == "Area Light")
+    {
+        areaLightData* data = (areaLightData*) light;
+        s.field("emission", data->emission, 3);
+        s.field("shapesType", &data->shapesType);
+    }
+    else if(light->name == "Spot Light")
+    {
+        spotLightData* data = (spotLightData*) light;
+        s.field("position", data->position, 3);
+        s.field("direction", data->direction, 3);
+        s.field("intensity", data->intensity, 3);
+        s.field("coneAngle", &data->coneAngle);
+        s.field("falloffStart", &data->falloffStart);
+    }
+    else if(light->name == "Point Light")
+    {
+        pointLightData* data = (pointLightData*) light;
+        s.field("position", data->position, 3);
+        s.field("intensity", data->intensity, 3);
+    }
+    else if(light->name == "Inifinite Area Light")
+    {
+        infiniteAreaLightData* data = (infiniteAreaLightData*) light;
+        s.field("imagePath", data->imagePath, sizeof(data->imagePath));
+    }
+}
+
+static shapeData* createShape(const std::string& name)
+{
+    if(name == "Mesh")
+        return new meshData();
+    else if(name == "InfinitePlane")
+        return new infinitePlaneData();
+    else if(name == "Sphere")
+        return new sphereData();
+    else if(name == "Disk")
+        return new diskData();
+    else if(name == "Triangle")
+        return new triangleData();
+    else if(name == "Plane")
+        return new planeData();
+
+    return NULL;
+}
+
+static lightData* createLight(const std::string& name)
+{
+    if(name == "Area Light")
+        return new areaLightData();
+    else if(name == "Spot Light")
+        return new spotLightData();
+    else if(name == "Point Light")
+        return new pointLightData();
+    else if(name == "Inifinite Area Light")
+        return new infiniteAreaLightData();
+
+    return NULL;
+}
+
+static bool writeScene(std::ostream& out,
+                       const renderConfigData& config,
+                       const std::vector<shapeData*>& shapeList,
+                       const std::vector<lightData*>& lightList)
+{
+    // 保证浮点数读回时不丢精度
+    out.precision(9);
+
+    sceneSection s(&out);
+
+    out << "[Render]\n";
+    bindConfig(s, const_cast<renderConfigData&>(config));
+
+    for(auto shape : shapeList)
+    {
+        out << "\n[Shape " << shape->name << "]\n";
+        bindShape(s, shape);
+    }
+
+    for(auto light : lightList)
+    {
+        out << "\n[Light " << light->name << "]\n";
+        bindLight(s, light);
+    }
+
+    return out.good();
+}
+
+static bool readScene(std::istream& in,
+                      renderConfigData& config,
+                      std::vector<shapeData*>& shapeList,
+                      std::vector<lightData*>& lightList)
+{
+    // 先收集各段落键值 段落结束时再统一写入对应数据
+    std::string header;
+    std::map<std::string, std::string> values;
+
+    auto flush = [&]()->bool
+    {
+        if(header.empty())
+            return true;
+
+        sceneSection s(values);
+        if(header == "Render")
+            bindConfig(s, config);
+        else if(header.compare(0, 6, "Shape ") == 0)
+        {
+            shapeData* shape = createShape(header.substr(6));
+            if(!shape)
+            {
+                a3Log::error("未知的Shape类型: %s\n", header.c_str());
+                return false;
+            }
+            bindShape(s, shape);
+            shapeList.push_back(shape);
+        }
+        else if(header.compare(0, 6, "Light ") == 0)
+        {
+            lightData* light = createLight(header.substr(6));
+            if(!light)
+            {
+                a3Log::error("未知的Light类型: %s\n", header.c_str());
+                return false;
+            }
+            bindLight(s, light);
+            lightList.push_back(light);
+        }
+        else
+            a3Log::warning("忽略未知段落: %s\n", header.c_str());
+
+        values.clear();
+        return true;
+    };
+
+    std::string line;
+    while(std::getline(in, line))
+    {
+        // 兼容Windows换行
+        if(!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+
+        if(line.empty() || line[0] == '#')
+            continue;
+
+        if(line[0] == '[')
+        {
+            if(!flush())
+                return false;
+
+            header = line.substr(1, line.find(']') - 1);
+            continue;
+        }
+
+        std::string::size_type pos = line.find(" = ");
+        if(pos == std::string::npos)
+            continue;
+
+        values[line.substr(0, pos)] = line.substr(pos + 3);
+    }
+
+    return flush();
+}
+
+bool saveScene(const std::string& path,
+               const renderConfigData& config,
+               const std::vector<shapeData*>& shapeList,
+               const std::vector<lightData*>& lightList)
+{
+    std::ofstream out(path.c_str());
+    if(!out.is_open())
+    {
+        a3Log::error("场景文件无法写入: %s\n", path.c_str());
+        return false;
+    }
+
+    return writeScene(out, config, shapeList, lightList);
+}
+
+bool loadScene(const std::string& path,
+               renderConfigData& config,
+               std::vector<shapeData*>& shapeList,
+               std::vector<lightData*>& lightList)
+{
+    std::ifstream in(path.c_str());
+    if(!in.is_open())
+    {
+        a3Log::error("场景文件无法读取: %s\n", path.c_str());
+        return false;
+    }
+
+    return readScene(in, config, shapeList, lightList);
+}
+
+std::string sceneToString(const renderConfigData& config,
+                          const std::vector<shapeData*>& shapeList,
+                          const std::vector<lightData*>& lightList)
+{
+    std::ostringstream out;
+    writeScene(out, config, shapeList, lightList);
+
+    return out.str();
+}
+
+bool loadSceneFromString(const std::string& text,
+                         renderConfigData& config,
+                         std::vector<shapeData*>& shapeList,
+                         std::vector<lightData*>& lightList)
+{
+    std::istringstream in(text);
+    return readScene(in, config, shapeList, lightList);
+}
+
+std::string shapeToString(const shapeData* shape)
+{
+    std::ostringstream out;
+    out.precision(9);
+
+    sceneSection s(&out);
+    out << "[Shape " << shape->name << "]\n";
+    bindShape(s, const_cast<shapeData*>(shape));
+
+    return out.str();
+}
+
+std::string lightToString(const lightData* light)
+{
+    std::ostringstream out;
+    out.precision(9);
+
+    sceneSection s(&out);
+    out << "[Light " << light->name << "]\n";
+    bindLight(s, const_cast<lightData*>(light));
+
+    return out.str();
+}
@@ -0,0 +1,34 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+#include "AtmosShapeData.h"
+#include "AtmosLightData.h"
+#include "AtmosRenderConfig.h"
+
+// 场景文件读写 供编辑器导入导出与命令行渲染使用
+// 文本格式: [Render] / [Shape 名称] / [Light 名称] 段落下逐行 key = value
+bool saveScene(const std::string& path,
+               const renderConfigData& config,
+               const std::vector<shapeData*>& shapeList,
+               const std::vector<lightData*>& lightList);
+
+// 读取成功后新分配的shape / light追加至列表末尾 内存由调用者释放
+bool loadScene(const std::string& path,
+               renderConfigData& config,
+               std::vector<shapeData*>& shapeList,
+               std::vector<lightData*>& lightList);
+
+// 与场景文件内容相同的字符串 用于网络传输
+std::string sceneToString(const renderConfigData& config,
+                          const std::vector<shapeData*>& shapeList,
+                          const std::vector<lightData*>& lightList);
+
+bool loadSceneFromString(const std::string& text,
+                         renderConfigData& config,
+                         std::vector<shapeData*>& shapeList,
+                         std::vector<lightData*>& lightList);
+
+// 单个shape / light的文本描述(与场景文件中的段落一致) 用于判断编辑数据是否改变
+std::string shapeToString(const shapeData* shape);
+std::string lightToString(const lightData* light);
@@ -6,6 +6,14 @@
 #ifndef FLOAT3
 #define SIZE_FLOAT_3 3 * sizeof(float)
 
+enum a3MaterialType
+{
+    NONE = -1,
+    GLASS = 0,
+    MIRROR = 1,
+    DIFFUSE = 2
+};
+
 struct shapeData
 {
     shapeData(std::string name):name(name), materialType(0){}
@@ -0,0 +1,278 @@
+﻿#include "AtmosSocket.h"
+#include <string.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef int socklen_t;
+#define A3_INVALID_SOCKET ((intptr_t) INVALID_SOCKET)
+#define closeSocket closesocket
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#define A3_INVALID_SOCKET ((intptr_t) -1)
+#define closeSocket ::close
+#endif
+
+#define A3_SOCKET_BUFFER_SIZE (64 * 1024)
+
+// 对端断开时send返回错误而不是触发SIGPIPE
+#ifdef MSG_NOSIGNAL
+#define A3_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define A3_SEND_FLAGS 0
+#endif
+
+// Winsock需在首次使用前初始化
+static bool initSocket()
+{
+#ifdef _WIN32
+    static bool initialized = []()
+    {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+
+    return initialized;
+#else
+    return true;
+#endif
+}
+
+AtmosSocket::AtmosSocket() :handle(A3_INVALID_SOCKET), timeoutMs(0), timedOut(false)
+{
+
+}
+
+AtmosSocket::~AtmosSocket()
+{
+    close();
+}
+
+bool AtmosSocket::listen(int port)
+{
+    if(!initSocket())
+        return false;
+
+    close();
+
+    handle = (intptr_t) socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if(handle == A3_INVALID_SOCKET)
+        return false;
+
+    // 重启后可立即重新绑定同一端口
+    int reuse = 1;
+    setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char*) &reuse, sizeof(reuse));
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((unsigned short) port);
+
+    if(bind(handle, (sockaddr*) &address, sizeof(address)) != 0 || ::listen(handle, 16) != 0)
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+AtmosSocket* AtmosSocket::accept(int timeoutMs)
+{
+    if(!isOpen())
+        return NULL;
+
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(handle, &readSet);
+
+    timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+
+    if(select((int) handle + 1, &readSet, NULL, NULL, &timeout) <= 0)
+        return NULL;
+
+    intptr_t client = (intptr_t) ::accept(handle, NULL, NULL);
+    if(client == A3_INVALID_SOCKET)
+        return NULL;
+
+    int noDelay = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char*) &noDelay, sizeof(noDelay));
+
+    AtmosSocket* connection = new AtmosSocket();
+    connection->handle = client;
+    return connection;
+}
+
+bool AtmosSocket::connect(const std::string& host, int port)
+{
+    if(!initSocket())
+        return false;
+
+    close();
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    char service[16];
+    sprintf(service, "%d", port);
+
+    addrinfo* result = NULL;
+    if(getaddrinfo(host.c_str(), service, &hints, &result) != 0)
+        return false;
+
+    for(addrinfo* info = result; info; info = info->ai_next)
+    {
+        handle = (intptr_t) socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        if(handle == A3_INVALID_SOCKET)
+            continue;
+
+        if(::connect(handle, info->ai_addr, (socklen_t) info->ai_addrlen) == 0)
+            break;
+
+        close();
+    }
+    freeaddrinfo(result);
+
+    if(!isOpen())
+        return false;
+
+    int noDelay = 1;
+    setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char*) &noDelay, sizeof(noDelay));
+
+    return true;
+}
+
+bool AtmosSocket::sendAll(const void* data, size_t size)
+{
+    const char* bytes = (const char*) data;
+    while(size > 0 && isOpen())
+    {
+        int chunk = (int) (size < A3_SOCKET_BUFFER_SIZE ? size : A3_SOCKET_BUFFER_SIZE);
+        int sent = (int) send(handle, bytes, chunk, A3_SEND_FLAGS);
+        if(sent <= 0)
+            return false;
+
+        bytes += sent;
+        size -= sent;
+    }
+
+    return size == 0;
+}
+
+void AtmosSocket::setTimeout(int timeoutMs)
+{
+    this->timeoutMs = timeoutMs;
+}
+
+bool AtmosSocket::hasTimedOut() const
+{
+    return timedOut;
+}
+
+bool AtmosSocket::waitReadable()
+{
+    timedOut = false;
+    if(timeoutMs <= 0)
+        return true;
+
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(handle, &readSet);
+
+    timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+
+    // 对端无响应(挂起 / 网络中断)时不会收到RST
+    int result = select((int) handle + 1, &readSet, NULL, NULL, &timeout);
+    timedOut = result == 0;
+    return result > 0;
+}
+
+bool AtmosSocket::fill()
+{
+    if(!isOpen() || !waitReadable())
+        return false;
+
+    char buffer[A3_SOCKET_BUFFER_SIZE];
+    int received = (int) recv(handle, buffer, sizeof(buffer), 0);
+    if(received <= 0)
+        return false;
+
+    pending.append(buffer, received);
+    return true;
+}
+
+bool AtmosSocket::recvAll(void* data, size_t size)
+{
+    char* bytes = (char*) data;
+
+    // 先取出已缓存的部分 其余直接读入data 避免大块数据多拷贝一次
+    size_t cached = pending.size() < size ? pending.size() : size;
+    memcpy(bytes, pending.data(), cached);
+    pending.erase(0, cached);
+    bytes += cached;
+    size -= cached;
+
+    while(size > 0 && isOpen())
+    {
+        if(!waitReadable())
+            return false;
+
+        int chunk = (int) (size < A3_SOCKET_BUFFER_SIZE ? size : A3_SOCKET_BUFFER_SIZE);
+        int received = (int) recv(handle, bytes, chunk, 0);
+        if(received <= 0)
+            return false;
+
+        bytes += received;
+        size -= received;
+    }
+
+    return size == 0;
+}
+
+bool AtmosSocket::sendLine(const std::string& line)
+{
+    std::string data = line + "\n";
+    return sendAll(data.data(), data.size());
+}
+
+bool AtmosSocket::recvLine(std::string& line)
+{
+    std::string::size_type end = 0;
+    while((end = pending.find('\n')) == std::string::npos)
+    {
+        if(!fill())
+            return false;
+    }
+
+    line = pending.substr(0, end);
+    pending.erase(0, end + 1);
+    return true;
+}
+
+void AtmosSocket::close()
+{
+    if(handle != A3_INVALID_SOCKET)
+        closeSocket(handle);
+
+    handle = A3_INVALID_SOCKET;
+    pending.clear();
+}
+
+bool AtmosSocket::isOpen() const
+{
+    return handle != A3_INVALID_SOCKET;
+}
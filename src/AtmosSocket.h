@@ -0,0 +1,58 @@
+﻿#pragma once
+
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+// 阻塞式TCP连接 Windows(Winsock) / POSIX共用
+// 按行的文本命令与定长的二进制数据可混合读取
+// 设定超时后 超过该时间未收到任何数据的读取与断开一样返回false
+class AtmosSocket
+{
+public:
+    AtmosSocket();
+    ~AtmosSocket();
+
+    // 监听本机所有地址的port端口
+    bool listen(int port);
+
+    // 等待新连接 超时返回NULL 返回的连接由调用者释放
+    AtmosSocket* accept(int timeoutMs);
+
+    bool connect(const std::string& host, int port);
+
+    bool sendAll(const void* data, size_t size);
+    bool recvAll(void* data, size_t size);
+
+    // 以\n结尾的一行 不含\n
+    bool sendLine(const std::string& line);
+    bool recvLine(std::string& line);
+
+    // 每次等待数据的上限 0为一直等待
+    void setTimeout(int timeoutMs);
+
+    // 上一次读取失败是否因为超时
+    bool hasTimedOut() const;
+
+    void close();
+
+    bool isOpen() const;
+
+private:
+    AtmosSocket(const AtmosSocket&);
+    AtmosSocket& operator=(const AtmosSocket&);
+
+    // 从内核读取更多数据至pending
+    bool fill();
+
+    // 等待可读 超时返回false
+    bool waitReadable();
+
+    intptr_t handle;
+
+    int timeoutMs;
+    bool timedOut;
+
+    // 已读取未消费的数据
+    std::string pending;
+};
@@ -0,0 +1,174 @@
+﻿#include "AtmosStats.h"
+#include <sstream>
+#include <algorithm>
+#include <stdio.h>
+#include <Atmos.h>
+
+tileStatsData::tileStatsData() :tiles(0), minSeconds(0.0f), maxSeconds(0.0f), totalSeconds(0.0f), samples(0), rays(0)
+{
+
+}
+
+void tileStatsData::addTile(float seconds, long long samples, long long rays)
+{
+    minSeconds = tiles == 0 ? seconds : std::min(minSeconds, seconds);
+    maxSeconds = std::max(maxSeconds, seconds);
+    totalSeconds += seconds;
+    tiles++;
+
+    this->samples += samples;
+    this->rays += rays;
+}
+
+void tileStatsData::add(const tileStatsData& other)
+{
+    if(other.tiles == 0)
+        return;
+
+    minSeconds = tiles == 0 ? other.minSeconds : std::min(minSeconds, other.minSeconds);
+    maxSeconds = std::max(maxSeconds, other.maxSeconds);
+    totalSeconds += other.totalSeconds;
+    tiles += other.tiles;
+
+    samples += other.samples;
+    rays += other.rays;
+}
+
+float tileStatsData::getAverageSeconds() const
+{
+    return tiles > 0 ? totalSeconds / tiles : 0.0f;
+}
+
+frameStatsData::frameStatsData() :frame(0), saved(false)
+{
+    for(int i = 0; i < A3_PHASE_COUNT; i++)
+        seconds[i] = 0.0;
+}
+
+double frameStatsData::getFrameSeconds() const
+{
+    double total = 0.0;
+    for(int i = 0; i < A3_PHASE_COUNT; i++)
+    {
+        if(i != A3_PHASE_SAVE)
+            total += seconds[i];
+    }
+
+    return total;
+}
+
+std::string frameStatsData::toJson() const
+{
+    double render = std::max(seconds[A3_PHASE_RENDER], 1e-6);
+
+    std::ostringstream out;
+    out << "{\"frame\":" << frame;
+    for(int i = 0; i < A3_PHASE_COUNT; i++)
+        out << ",\"" << AtmosStats::getPhaseName(i) << "\":" << seconds[i];
+    out << ",\"tiles\":" << tiles.tiles
+        << ",\"tile_min\":" << tiles.minSeconds
+        << ",\"tile_avg\":" << tiles.getAverageSeconds()
+        << ",\"tile_max\":" << tiles.maxSeconds
+        << ",\"samples\":" << tiles.samples
+        << ",\"rays\":" << tiles.rays
+        << ",\"samples_per_sec\":" << (long long) (tiles.samples / render)
+        << ",\"rays_per_sec\":" << (long long) (tiles.rays / render)
+        << ",\"arena_used\":" << arena.usedBytes
+        << ",\"arena_reserved\":" << arena.reservedBytes
+        << ",\"arena_blocks\":" << arena.blocks
+        << ",\"saved\":" << (saved ? "true" : "false")
+        << "}";
+
+    return out.str();
+}
+
+AtmosStats::AtmosStats() :finishedFrames(0), totalSeconds(0.0)
+{
+
+}
+
+void AtmosStats::begin(const std::string& logPath)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    finishedFrames = 0;
+    totalSeconds = 0.0;
+    last = frameStatsData();
+
+    if(log.is_open())
+        log.close();
+
+    if(!logPath.empty())
+    {
+        log.open(logPath.c_str(), std::ios::out | std::ios::trunc);
+        if(!log.is_open())
+            a3Log::warning("无法写入统计日志: %s\n", logPath.c_str());
+    }
+}
+
+void AtmosStats::finishFrame(const frameStatsData& stats)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    finishedFrames++;
+    totalSeconds += stats.getFrameSeconds();
+    last = stats;
+
+    if(log.is_open())
+    {
+        log << stats.toJson() << "\n";
+        log.flush();
+    }
+}
+
+double AtmosStats::getSequenceRemaining(double currentElapsed, double currentRemaining,
+                                        int framesLeft, int framesInFlight)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    double average = finishedFrames > 0 ? totalSeconds / finishedFrames : currentElapsed + currentRemaining;
+
+    return currentRemaining + average * std::max(0, framesLeft) / std::max(1, framesInFlight);
+}
+
+bool AtmosStats::getLastFrame(frameStatsData& stats)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    stats = last;
+    return finishedFrames > 0;
+}
+
+int AtmosStats::getFinishedFrames()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return finishedFrames;
+}
+
+const char* AtmosStats::getPhaseName(int phase)
+{
+    static const char* names[A3_PHASE_COUNT] = {"import", "bvh", "render", "preview", "denoise", "save"};
+
+    return phase >= 0 && phase < A3_PHASE_COUNT ? names[phase] : "";
+}
+
+std::string formatSeconds(double seconds)
+{
+    char text[64];
+
+    if(seconds < 0.0)
+        return "-";
+
+    if(seconds < 60.0)
+        sprintf(text, "%.1fs", seconds);
+    else
+    {
+        long long total = (long long) (seconds + 0.5);
+        if(total < 3600)
+            sprintf(text, "%dm %02ds", (int) (total / 60), (int) (total % 60));
+        else
+            sprintf(text, "%dh %02dm %02ds", (int) (total / 3600), (int) (total / 60 % 60), (int) (total % 60));
+    }
+
+    return text;
+}
@@ -0,0 +1,105 @@
+﻿#pragma once
+
+#include <string>
+#include <mutex>
+#include <fstream>
+#include <chrono>
+#include "AtmosArena.h"
+
+// 一帧的各个阶段
+enum statsPhase
+{
+    // 导入模型(含等待预取) / 更新renderer与光源
+    A3_PHASE_IMPORT = 0,
+    // 建立加速结构
+    A3_PHASE_BVH,
+    A3_PHASE_RENDER,
+    // 转换并上传预览纹理(仅编辑器)
+    A3_PHASE_PREVIEW,
+    // 渲染完成后的去噪
+    A3_PHASE_DENOISE,
+    // 写入线程编码保存 与下一帧的渲染重叠
+    A3_PHASE_SAVE,
+    A3_PHASE_COUNT
+};
+
+// 网格渲染统计 由调度器的工作线程累计
+struct tileStatsData
+{
+    tileStatsData();
+
+    void addTile(float seconds, long long samples, long long rays);
+    void add(const tileStatsData& other);
+
+    float getAverageSeconds() const;
+
+    int tiles;
+    float minSeconds, maxSeconds, totalSeconds;
+
+    // 像素采样数(即相机光线数)
+    // 与场景求交的光线数 含次级与阴影光线 仅BVH模式统计
+    long long samples, rays;
+};
+
+struct frameStatsData
+{
+    frameStatsData();
+
+    // 除保存外的耗时
+    double getFrameSeconds() const;
+
+    // 一行JSON
+    std::string toJson() const;
+
+    int frame;
+    double seconds[A3_PHASE_COUNT];
+    tileStatsData tiles;
+    bool saved;
+
+    // 本帧构建完成后的帧内存池
+    arenaStatsData arena;
+};
+
+// 渲染统计
+// 记录每帧各阶段耗时 按已完成帧估计序列的剩余时间
+// 每帧一行JSON追加至日志 便于统计时间花在何处
+class AtmosStats
+{
+public:
+    AtmosStats();
+
+    // 开始新的序列 logPath为空时不写日志
+    void begin(const std::string& logPath);
+
+    // 一帧全部阶段完成(保存之后) 可由写入线程调用
+    void finishFrame(const frameStatsData& stats);
+
+    // 序列剩余时间: 当前帧剩余 + 未开始的帧按已完成帧的平均耗时
+    // 尚无完成的帧时以当前帧的估计为准 framesInFlight帧同时渲染
+    double getSequenceRemaining(double currentElapsed, double currentRemaining,
+                                int framesLeft, int framesInFlight = 1);
+
+    // 最近完成的一帧 尚无时返回false
+    bool getLastFrame(frameStatsData& stats);
+
+    int getFinishedFrames();
+
+    static const char* getPhaseName(int phase);
+
+private:
+    std::mutex lock;
+    std::ofstream log;
+
+    int finishedFrames;
+    double totalSeconds;
+    frameStatsData last;
+};
+
+// 自begin起经过的秒数
+inline double elapsedSeconds(const std::chrono::high_resolution_clock::time_point& begin)
+{
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+}
+
+// 秒数格式化为 1h 02m 03s / 2m 03s / 3.2s
+std::string formatSeconds(double seconds);
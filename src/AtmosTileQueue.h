@@ -0,0 +1,64 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// 已渲染完毕的网格区域(像素坐标)
+struct tileData
+{
+    tileData() :x(0), y(0), width(0), height(0) {}
+    tileData(int x, int y, int width, int height) :x(x), y(y), width(width), height(height) {}
+
+    int x, y;
+    int width, height;
+};
+
+// 单生产者单消费者无锁环形队列
+// 渲染线程push UI线程pop 容量N需为2的幂
+template<typename T, size_t N>
+class AtmosTileQueue
+{
+    static_assert((N & (N - 1)) == 0, "AtmosTileQueue capacity must be power of 2");
+
+public:
+    AtmosTileQueue() :head(0), tail(0) {}
+
+    // 仅生产者调用 队列满时返回false
+    bool push(const T& item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(t - head.load(std::memory_order_acquire) == N)
+            return false;
+
+        buffer[t & (N - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 仅消费者调用 队列空时返回false
+    bool pop(T& item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h == tail.load(std::memory_order_acquire))
+            return false;
+
+        item = buffer[h & (N - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 生产者与消费者均未工作时方可调用
+    void clear()
+    {
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    T buffer[N];
+
+    // 读写指针分属不同缓存行 避免伪共享
+    std::atomic<size_t> head;
+    char padding[64];
+    std::atomic<size_t> tail;
+};
@@ -0,0 +1,59 @@
+﻿#include "AtmosTileRenderer.h"
+#include "AtmosWavefront.h"
+#include "AtmosSampler.h"
+
+long long renderTile(const a3GridRenderer* renderer,
+                const a3Scene* scene,
+                a3Sampler* sampler,
+                const tileData& tile,
+                int samples,
+                const adaptiveSamplingData& adaptive,
+                AtmosFrameBuffer* buffer)
+{
+    const AtmosWavefrontIntegrator* wavefront = dynamic_cast<const AtmosWavefrontIntegrator*>(renderer->integrator);
+    if(wavefront)
+        return wavefront->renderTile(renderer, scene, sampler, tile, samples, adaptive, buffer);
+
+    // 确定性采样器按像素已有的采样数继续
+    AtmosSampler* deterministic = dynamic_cast<AtmosSampler*>(sampler);
+
+    long long taken = 0;
+
+    // 逐行访问colorList 保证内存连续
+    for(int y = tile.y; y < tile.y + tile.height; y++)
+    {
+        for(int x = tile.x; x < tile.x + tile.width; x++)
+        {
+            int index = x + y * buffer->width;
+
+            if(deterministic)
+                deterministic->setSampleIndex((uint32_t) buffer->count[index]);
+
+            for(int s = 0; s < samples; s++)
+            {
+                if(adaptive.enable && buffer->isConverged(index, adaptive))
+                    break;
+
+                a3CameraSample sample;
+                sampler->getMoreSamples(x, y, &sample);
+
+                a3Ray ray;
+                renderer->camera->castRay(&sample, &ray);
+
+                // 积分器不返回交点 辅助缓冲另行求交主光线
+                if(buffer->hasAOV())
+                {
+                    a3IntersectRecord record;
+                    buffer->addAOV(index, ray, scene->intersect(ray, &record) ? &record : NULL);
+                }
+
+                buffer->add(index, renderer->integrator->li(ray, *scene));
+                taken++;
+            }
+
+            renderer->colorList[index] = buffer->getColor(index);
+        }
+    }
+
+    return taken;
+}
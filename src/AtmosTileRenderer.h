@@ -0,0 +1,19 @@
+﻿#pragma once
+
+#include <Atmos.h>
+#include "AtmosTileQueue.h"
+#include "AtmosFrameBuffer.h"
+
+// 对网格内的全部像素各追加最多samples个采样 累积至buffer 均值写入renderer->colorList
+// 启用自适应采样时已收敛的像素提前停止 buffer带有辅助缓冲时同时写入主光线的交点
+// 可被多个工作线程同时调用: camera / integrator / scene只读
+// sampler带有状态 每个线程需持有独立的sampler AtmosSampler按像素已有的采样数确定采样
+// 返回实际追加的采样数
+// integrator为AtmosWavefrontIntegrator时整个网格成批追踪
+long long renderTile(const a3GridRenderer* renderer,
+                const a3Scene* scene,
+                a3Sampler* sampler,
+                const tileData& tile,
+                int samples,
+                const adaptiveSamplingData& adaptive,
+                AtmosFrameBuffer* buffer);
@@ -0,0 +1,508 @@
+﻿#include "AtmosTileScheduler.h"
+#include "AtmosTileRenderer.h"
+#include "AtmosTwoLevelBVH.h"
+#include <algorithm>
+#include <chrono>
+
+AtmosTileScheduler::AtmosTileScheduler(int numWorkers) :stopRequested(false), finishedWork(0), runningWorkers(0), totalWork(0), currentPass(0), arrivedWorkers(0), plannedSamples(0), nextFingerprint(0), renderer(NULL), scene(NULL), imageWidth(0), streamTiles(true), output(NULL)
+{
+    startTime = finishTime = std::chrono::high_resolution_clock::now();
+
+    int count = numWorkers > 0 ? numWorkers : std::max(1, (int) std::thread::hardware_concurrency());
+
+    for(int i = 0; i < count; i++)
+        workers.push_back(new worker());
+}
+
+AtmosTileScheduler::~AtmosTileScheduler()
+{
+    stop();
+
+    for(auto w : workers)
+    {
+        A3_SAFE_DELETE(w->sampler);
+        delete w;
+    }
+    workers.clear();
+}
+
+void AtmosTileScheduler::split()
+{
+    int levelX = std::max(1, renderer->levelX);
+    int levelY = std::max(1, renderer->levelY);
+
+    int gridWidth = renderer->renderWidth / levelX;
+    int gridHeight = renderer->renderHeight / levelY;
+
+    std::vector<tileData> grids;
+    for(int j = 0; j < levelY; j++)
+    {
+        for(int i = 0; i < levelX; i++)
+        {
+            // 最后一行 / 列包含除不尽的余数像素
+            int x = renderer->startX + i * gridWidth;
+            int y = renderer->startY + j * gridHeight;
+            int w = i == levelX - 1 ? renderer->startX + renderer->renderWidth - x : gridWidth;
+            int h = j == levelY - 1 ? renderer->startY + renderer->renderHeight - y : gridHeight;
+
+            grids.push_back(tileData(x, y, w, h));
+        }
+    }
+
+    bool sameLayout = grids.size() == tiles.size();
+    for(size_t i = 0; sameLayout && i < grids.size(); i++)
+        sameLayout = grids[i].x == tiles[i].x && grids[i].y == tiles[i].y &&
+                     grids[i].width == tiles[i].width && grids[i].height == tiles[i].height;
+
+    if(!sameLayout)
+    {
+        // 尚无测量数据 以面积作为初始代价
+        tiles = grids;
+        tileCost.resize(tiles.size());
+        for(size_t i = 0; i < tiles.size(); i++)
+            tileCost[i] = (float) tiles[i].width * tiles[i].height;
+    }
+}
+
+void AtmosTileScheduler::start(a3GridRenderer* renderer, const a3Scene* scene, const renderConfigData& config,
+                               bool streamTiles, AtmosFrameWriter::frameData* output)
+{
+    stop();
+
+    this->renderer = renderer;
+    this->scene = scene;
+    this->imageWidth = config.imageWidth;
+    this->streamTiles = streamTiles;
+    this->output = output;
+
+    split();
+
+    // 渐进式: 累计采样数依次为1, 2, 4...直至spp
+    passSamples.clear();
+    int spp = std::max(1, renderer->spp);
+    if(config.enableProgressive)
+    {
+        int total = 0;
+        for(int target = 1; total < spp; target *= 2)
+        {
+            target = std::min(target, spp);
+            passSamples.push_back(target - total);
+            total = target;
+        }
+    }
+    else
+        passSamples.push_back(spp);
+
+    buffer.resize(config.imageWidth, config.imageHeight, config.enableDenoise);
+    tileSamples.assign(tiles.size(), 0);
+
+    // 检查点仅对本帧有效
+    checkpointPath = nextCheckpointPath;
+    snapshot.fingerprint = nextFingerprint;
+    nextCheckpointPath.clear();
+
+    if(!checkpointPath.empty() && resume())
+        a3Log::debug("从检查点恢复: %s\n", checkpointPath.c_str());
+
+    // spp作为自适应采样的上限
+    adaptive.enable = config.enableAdaptive;
+    adaptive.threshold = config.adaptiveThreshold;
+    adaptive.minSamples = config.adaptiveMinSpp;
+
+    for(auto w : workers)
+    {
+        w->finished.clear();
+        w->stats = tileStatsData();
+
+        if(!w->sampler || w->samplerType != config.sampler)
+        {
+            A3_SAFE_DELETE(w->sampler);
+            w->sampler = createSampler(config.sampler);
+            w->samplerType = config.sampler;
+        }
+    }
+
+    distribute();
+
+    stopRequested = false;
+    finishedWork = 0;
+    for(auto samples : tileSamples)
+        finishedWork += std::min(samples, spp);
+    totalWork = (int) tiles.size() * spp;
+    currentPass = 0;
+    arrivedWorkers = 0;
+    runningWorkers = (int) workers.size();
+
+    // 从检查点恢复的部分不计入剩余时间的估计
+    double remainingWork = (double) (totalWork - finishedWork) / std::max(1, totalWork);
+    plannedSamples = (long long) ((double) renderer->renderWidth * renderer->renderHeight * spp * remainingWork);
+    startTime = std::chrono::high_resolution_clock::now();
+
+    if(!checkpointPath.empty())
+    {
+        snapshot.levelX = renderer->levelX;
+        snapshot.levelY = renderer->levelY;
+        snapshot.tileSamples = tileSamples;
+
+        // 检查点不含辅助缓冲
+        snapshot.buffer.resize(buffer.width, buffer.height);
+        snapshot.buffer.sum = buffer.sum;
+        snapshot.buffer.count = buffer.count;
+        snapshot.buffer.mean = buffer.mean;
+        snapshot.buffer.m2 = buffer.m2;
+    }
+
+    for(size_t i = 0; i < workers.size(); i++)
+        workers[i]->thread = std::thread(&AtmosTileScheduler::run, this, (int) i);
+
+    if(!checkpointPath.empty() && config.checkpointInterval > 0)
+        checkpointThread = std::thread(&AtmosTileScheduler::runCheckpoint, this, config.checkpointInterval);
+}
+
+void AtmosTileScheduler::setCheckpoint(const std::string& path, uint64_t fingerprint)
+{
+    nextCheckpointPath = path;
+    nextFingerprint = fingerprint;
+}
+
+bool AtmosTileScheduler::resume()
+{
+    checkpointData checkpoint;
+    if(!loadCheckpoint(checkpointPath, checkpoint))
+        return false;
+
+    // 场景改变或网格划分不同时从头渲染
+    if(checkpoint.fingerprint != snapshot.fingerprint ||
+       checkpoint.levelX != renderer->levelX || checkpoint.levelY != renderer->levelY ||
+       checkpoint.tileSamples.size() != tiles.size() ||
+       checkpoint.buffer.width != buffer.width || checkpoint.buffer.height != buffer.height)
+        return false;
+
+    tileSamples.swap(checkpoint.tileSamples);
+    std::swap(buffer.sum, checkpoint.buffer.sum);
+    std::swap(buffer.count, checkpoint.buffer.count);
+    std::swap(buffer.mean, checkpoint.buffer.mean);
+    std::swap(buffer.m2, checkpoint.buffer.m2);
+
+    return true;
+}
+
+void AtmosTileScheduler::runCheckpoint(int interval)
+{
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> guard(passLock);
+            if(passChanged.wait_for(guard, std::chrono::seconds(interval), [this]() { return stopRequested || runningWorkers == 0; }))
+                return;
+        }
+
+        writeCheckpoint();
+    }
+}
+
+void AtmosTileScheduler::writeCheckpoint()
+{
+    // 复制后再写入 不阻塞工作线程
+    checkpointData checkpoint;
+    {
+        std::lock_guard<std::mutex> guard(checkpointLock);
+        checkpoint = snapshot;
+    }
+
+    if(!saveCheckpoint(checkpointPath, checkpoint))
+        a3Log::warning("检查点写入失败: %s\n", checkpointPath.c_str());
+}
+
+void AtmosTileScheduler::distribute()
+{
+    // 代价降序轮流分配 近似最长处理时间优先(LPT)
+    std::vector<int> order(tiles.size());
+    for(size_t i = 0; i < order.size(); i++)
+        order[i] = (int) i;
+
+    std::stable_sort(order.begin(), order.end(), [this](int a, int b)
+    {
+        return tileCost[a] > tileCost[b];
+    });
+
+    for(auto w : workers)
+    {
+        std::lock_guard<std::mutex> guard(w->lock);
+        w->tiles.clear();
+    }
+
+    for(size_t i = 0; i < order.size(); i++)
+        workers[i % workers.size()]->tiles.push_back(order[i]);
+}
+
+void AtmosTileScheduler::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(passLock);
+        stopRequested = true;
+    }
+    passChanged.notify_all();
+
+    wait();
+
+    // 中途停止的帧保留进度 完成的帧由保存后写入的指纹取代
+    if(!checkpointPath.empty() && finishedWork < totalWork)
+        writeCheckpoint();
+    checkpointPath.clear();
+}
+
+void AtmosTileScheduler::wait()
+{
+    for(auto w : workers)
+    {
+        if(w->thread.joinable())
+            w->thread.join();
+    }
+
+    if(checkpointThread.joinable())
+        checkpointThread.join();
+}
+
+bool AtmosTileScheduler::isFinished() const
+{
+    return runningWorkers == 0;
+}
+
+bool AtmosTileScheduler::popTile(tileData& tile)
+{
+    for(auto w : workers)
+    {
+        if(w->finished.pop(tile))
+            return true;
+    }
+
+    return false;
+}
+
+float AtmosTileScheduler::getProgress() const
+{
+    if(totalWork == 0)
+        return 0.0f;
+
+    return (float) finishedWork / totalWork;
+}
+
+int AtmosTileScheduler::getCurrentPass()
+{
+    std::lock_guard<std::mutex> guard(passLock);
+    return std::min(currentPass, (int) passSamples.size() - 1);
+}
+
+int AtmosTileScheduler::getNumPasses() const
+{
+    return (int) passSamples.size();
+}
+
+int AtmosTileScheduler::getCompletedSamples()
+{
+    std::lock_guard<std::mutex> guard(passLock);
+
+    int samples = 0;
+    for(int i = 0; i < currentPass && i < (int) passSamples.size(); i++)
+        samples += passSamples[i];
+
+    return samples;
+}
+
+const AtmosFrameBuffer& AtmosTileScheduler::getFrameBuffer() const
+{
+    return buffer;
+}
+
+bool AtmosTileScheduler::finishPass(int pass)
+{
+    std::unique_lock<std::mutex> guard(passLock);
+
+    if(++arrivedWorkers == (int) workers.size())
+    {
+        // 最后到达的线程开始下一遍 其余线程均在等待 可直接重新分配
+        arrivedWorkers = 0;
+        currentPass++;
+
+        if(currentPass < (int) passSamples.size() && !stopRequested)
+            distribute();
+
+        guard.unlock();
+        passChanged.notify_all();
+    }
+    else
+        passChanged.wait(guard, [this, pass]() { return currentPass > pass || stopRequested; });
+
+    return !stopRequested;
+}
+
+int AtmosTileScheduler::getNumWorkers() const
+{
+    return (int) workers.size();
+}
+
+tileStatsData AtmosTileScheduler::getTileStats()
+{
+    tileStatsData stats;
+    for(auto w : workers)
+    {
+        std::lock_guard<std::mutex> guard(w->lock);
+        stats.add(w->stats);
+    }
+
+    return stats;
+}
+
+double AtmosTileScheduler::getElapsedSeconds()
+{
+    bool finished = isFinished();
+
+    std::lock_guard<std::mutex> guard(passLock);
+    auto end = finished ? finishTime : std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(end - startTime).count();
+}
+
+double AtmosTileScheduler::getRemainingSeconds()
+{
+    if(isFinished())
+        return 0.0;
+
+    long long samples = getTileStats().samples;
+    if(samples == 0)
+        return -1.0;
+
+    double elapsed = getElapsedSeconds();
+    return std::max(0LL, plannedSamples - samples) * elapsed / samples;
+}
+
+bool AtmosTileScheduler::next(int index, int& tile)
+{
+    worker* self = workers[index];
+    {
+        std::lock_guard<std::mutex> guard(self->lock);
+        if(!self->tiles.empty())
+        {
+            tile = self->tiles.front();
+            self->tiles.pop_front();
+            return true;
+        }
+    }
+
+    // 窃取剩余网格最多的线程 取其代价最高的网格
+    while(!stopRequested)
+    {
+        worker* victim = NULL;
+        size_t most = 0;
+        for(auto w : workers)
+        {
+            if(w == self)
+                continue;
+
+            std::lock_guard<std::mutex> guard(w->lock);
+            if(w->tiles.size() > most)
+            {
+                most = w->tiles.size();
+                victim = w;
+            }
+        }
+
+        if(!victim)
+            return false;
+
+        std::lock_guard<std::mutex> guard(victim->lock);
+        if(!victim->tiles.empty())
+        {
+            tile = victim->tiles.front();
+            victim->tiles.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void AtmosTileScheduler::updateSnapshot(int tile)
+{
+    const tileData& t = tiles[tile];
+
+    std::lock_guard<std::mutex> guard(checkpointLock);
+    for(int y = t.y; y < t.y + t.height; y++)
+    {
+        size_t begin = (size_t) y * buffer.width + t.x;
+        std::copy(buffer.sum.begin() + begin, buffer.sum.begin() + begin + t.width, snapshot.buffer.sum.begin() + begin);
+        std::copy(buffer.count.begin() + begin, buffer.count.begin() + begin + t.width, snapshot.buffer.count.begin() + begin);
+        std::copy(buffer.mean.begin() + begin, buffer.mean.begin() + begin + t.width, snapshot.buffer.mean.begin() + begin);
+        std::copy(buffer.m2.begin() + begin, buffer.m2.begin() + begin + t.width, snapshot.buffer.m2.begin() + begin);
+    }
+
+    snapshot.tileSamples[tile] = tileSamples[tile];
+}
+
+void AtmosTileScheduler::run(int index)
+{
+    worker* self = workers[index];
+
+    // 本遍结束时每个像素的累计采样数
+    int target = 0;
+
+    for(int pass = 0; pass < (int) passSamples.size(); pass++)
+    {
+        target += passSamples[pass];
+
+        int tile = 0;
+        while(!stopRequested && next(index, tile))
+        {
+            // 从检查点恢复的网格仅补足剩余采样 已完成时仅刷新colorList与输出
+            int samples = std::max(0, target - tileSamples[tile]);
+
+            auto begin = std::chrono::high_resolution_clock::now();
+
+            long long rays = AtmosTwoLevelBVH::getRayCount();
+            long long taken = renderTile(renderer, scene, self->sampler, tiles[tile], samples, adaptive, &buffer);
+            rays = AtmosTwoLevelBVH::getRayCount() - rays;
+
+            if(output)
+                AtmosFrameWriter::writeTile(output, renderer->colorList, imageWidth, tiles[tile]);
+
+            std::chrono::duration<float> seconds = std::chrono::high_resolution_clock::now() - begin;
+
+            if(samples > 0)
+            {
+                // 每个网格仅由一个线程渲染 代价写入无需加锁
+                // 按单个采样计 不同遍之间可比较
+                tileCost[tile] = seconds.count() / samples;
+
+                std::lock_guard<std::mutex> guard(self->lock);
+                self->stats.addTile(seconds.count(), taken, rays);
+            }
+
+            tileSamples[tile] = std::max(tileSamples[tile], target);
+
+            if(!checkpointPath.empty() && samples > 0)
+                updateSnapshot(tile);
+
+            finishedWork += samples;
+
+            if(streamTiles)
+            {
+                // 队列满时等待UI线程消费
+                while(!self->finished.push(tiles[tile]) && !stopRequested)
+                    std::this_thread::yield();
+            }
+        }
+
+        if(!finishPass(pass))
+            break;
+    }
+
+    // 每个线程退出时均记录 最后一次即为结束时间
+    {
+        std::lock_guard<std::mutex> guard(passLock);
+        finishTime = std::chrono::high_resolution_clock::now();
+        runningWorkers--;
+    }
+
+    // 唤醒检查点线程
+    passChanged.notify_all();
+}
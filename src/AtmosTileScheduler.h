@@ -0,0 +1,162 @@
+﻿#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <Atmos.h>
+#include "AtmosTileQueue.h"
+#include "AtmosFrameWriter.h"
+#include "AtmosFrameBuffer.h"
+#include "AtmosRenderConfig.h"
+#include "AtmosStats.h"
+#include "AtmosCheckpoint.h"
+#include "AtmosSampler.h"
+
+// 多线程网格调度器
+// 每个工作线程持有自己的网格双端队列 空闲时从剩余最多的线程窃取
+// 网格按上一帧测得的耗时降序分配 高代价网格(玻璃 / 焦散)优先开始 避免帧末单线程拖尾
+// 渐进式渲染时整帧按1, 2, 4...spp分遍 全部网格完成一遍后才开始下一遍
+// 启用检查点时定期保存累积结果与每个网格已完成的采样数 中断的帧可从中恢复
+class AtmosTileScheduler
+{
+public:
+    // numWorkers为0时每个核心一个工作线程
+    AtmosTileScheduler(int numWorkers = 0);
+    ~AtmosTileScheduler();
+
+    // 按renderer的level与局部渲染区域划分网格并启动全部工作线程
+    // renderer需已begin() streamTiles为false时不记录已完成网格(命令行渲染无需预览)
+    // output不为空时已完成的网格同时写入输出帧
+    void start(a3GridRenderer* renderer, const a3Scene* scene, const renderConfigData& config,
+               bool streamTiles = true, AtmosFrameWriter::frameData* output = NULL);
+
+    // 下一次start的帧启用检查点 仅对该帧有效
+    // 已有指纹一致的检查点时从中恢复 中途停止时写入最后一次检查点
+    void setCheckpoint(const std::string& path, uint64_t fingerprint);
+
+    // 请求停止并等待全部线程退出
+    void stop();
+
+    // 阻塞至当前帧全部网格渲染完毕
+    void wait();
+
+    // 当前帧全部网格渲染完毕
+    bool isFinished() const;
+
+    // UI线程调用 取出一个已完成的网格
+    bool popTile(tileData& tile);
+
+    // 当前帧渲染进度[0, 1] 按采样数计
+    float getProgress() const;
+
+    // 渐进式渲染的当前遍(从0开始) / 总遍数
+    int getCurrentPass();
+    int getNumPasses() const;
+
+    // 已完成的遍中每个像素的采样数(自适应采样时为上限)
+    int getCompletedSamples();
+
+    // 当前帧的逐像素采样结果 用于输出采样数热力图
+    const AtmosFrameBuffer& getFrameBuffer() const;
+
+    int getNumWorkers() const;
+
+    // 当前帧已完成网格的耗时与采样统计
+    tileStatsData getTileStats();
+
+    // 当前帧自start起的渲染耗时 完成后不再增长
+    double getElapsedSeconds();
+
+    // 按已测得的采样吞吐量估计当前帧剩余时间 尚无数据时返回-1
+    // 自适应采样时为上限
+    double getRemainingSeconds();
+
+private:
+    struct worker
+    {
+        worker() :sampler(NULL), samplerType(RANDOM_SAMPLER) {}
+
+        std::thread thread;
+
+        // 待渲染网格索引 按代价降序
+        std::mutex lock;
+        std::deque<int> tiles;
+
+        // 每个线程独立的sampler
+        a3Sampler* sampler;
+        int samplerType;
+
+        // 单生产者(本线程)单消费者(UI线程)
+        AtmosTileQueue<tileData, 1024> finished;
+
+        // 由lock保护
+        tileStatsData stats;
+    };
+
+    void run(int index);
+
+    // 按间隔写入检查点 帧完成或停止时退出
+    void runCheckpoint(int interval);
+
+    // 复制快照并写入文件
+    void writeCheckpoint();
+
+    // 将已完成网格的结果复制至快照
+    void updateSnapshot(int tile);
+
+    // 从检查点恢复累积结果与网格进度
+    bool resume();
+
+    // 按代价降序将全部网格分配至各线程
+    void distribute();
+
+    // 等待全部线程完成pass 最后到达的线程开始下一遍 停止时返回false
+    bool finishPass(int pass);
+
+    // 取本线程下一个网格 没有则窃取
+    bool next(int index, int& tile);
+
+    // 划分网格 布局不变时保留上一帧的代价估计
+    void split();
+
+    std::vector<worker*> workers;
+
+    std::vector<tileData> tiles;
+    std::vector<float> tileCost;
+
+    // 每个网格已完成的累计采样数 同一时刻仅由渲染该网格的线程访问
+    std::vector<int> tileSamples;
+
+    std::atomic<bool> stopRequested;
+    std::atomic<int> finishedWork, runningWorkers;
+    int totalWork;
+
+    // 每一遍追加的采样数
+    std::vector<int> passSamples;
+    std::mutex passLock;
+    std::condition_variable passChanged;
+    int currentPass, arrivedWorkers;
+
+    // finishTime由passLock保护
+    std::chrono::high_resolution_clock::time_point startTime, finishTime;
+    long long plannedSamples;
+
+    AtmosFrameBuffer buffer;
+    adaptiveSamplingData adaptive;
+
+    // 检查点 snapshot仅包含已完成网格的结果 由checkpointLock保护
+    std::string nextCheckpointPath, checkpointPath;
+    uint64_t nextFingerprint;
+    std::mutex checkpointLock;
+    checkpointData snapshot;
+    std::thread checkpointThread;
+
+    a3GridRenderer* renderer;
+    const a3Scene* scene;
+    int imageWidth;
+    bool streamTiles;
+    AtmosFrameWriter::frameData* output;
+};
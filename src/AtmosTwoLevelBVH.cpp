@@ -0,0 +1,277 @@
+﻿#include "AtmosTwoLevelBVH.h"
+#include <algorithm>
+#include <float.h>
+
+// 每个工作线程独立计数 无需同步
+static thread_local long long rayCount = 0;
+
+AtmosTwoLevelBVH::AtmosTwoLevelBVH() :staticBVH(NULL), ownsStatic(true)
+{
+
+}
+
+AtmosTwoLevelBVH::~AtmosTwoLevelBVH()
+{
+    if(staticBVH && ownsStatic)
+    {
+        staticBVH->primitives.clear();
+        A3_SAFE_DELETE(staticBVH);
+    }
+}
+
+void AtmosTwoLevelBVH::shareStatic(const AtmosTwoLevelBVH* base)
+{
+    if(staticBVH && ownsStatic)
+    {
+        staticBVH->primitives.clear();
+        A3_SAFE_DELETE(staticBVH);
+    }
+
+    staticBVH = base->staticBVH;
+    ownsStatic = false;
+}
+
+void AtmosTwoLevelBVH::buildStatic(const std::vector<a3Shape*>& staticPrimitives)
+{
+    if(staticBVH && ownsStatic)
+    {
+        staticBVH->primitives.clear();
+        A3_SAFE_DELETE(staticBVH);
+    }
+    staticBVH = NULL;
+    ownsStatic = true;
+
+    if(staticPrimitives.empty())
+        return;
+
+    staticBVH = new a3BVH();
+    staticBVH->primitives = staticPrimitives;
+    staticBVH->init();
+}
+
+void AtmosTwoLevelBVH::buildTop()
+{
+    if(meshes == topMeshes && !topNodes.empty())
+    {
+        refitTop();
+        return;
+    }
+
+    topMeshes = meshes;
+    topNodes.clear();
+    topIndices.clear();
+
+    if(meshes.empty())
+        return;
+
+    std::vector<float> centroids(meshes.size() * 3);
+    for(int i = 0; i < (int) meshes.size(); i++)
+    {
+        float bmin[3], bmax[3];
+        meshes[i]->getBounds(bmin, bmax);
+        for(int k = 0; k < 3; k++)
+            centroids[i * 3 + k] = (bmin[k] + bmax[k]) * 0.5f;
+
+        topIndices.push_back(i);
+    }
+
+    topNodes.reserve(meshes.size() * 2);
+    topNodes.push_back(topNode());
+    buildTopNode(0, 0, (int) meshes.size(), centroids);
+    refitTop();
+}
+
+void AtmosTwoLevelBVH::buildTopNode(int nodeIndex, int first, int count, const std::vector<float>& centroids)
+{
+    topNodes[nodeIndex].first = first;
+    topNodes[nodeIndex].count = count;
+
+    // 模型数通常很少 叶节点最多2个模型
+    if(count <= 2)
+        return;
+
+    // 按质心跨度最大的轴在中位数处划分
+    float cmin[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, cmax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for(int i = first; i < first + count; i++)
+    {
+        for(int k = 0; k < 3; k++)
+        {
+            cmin[k] = std::min(cmin[k], centroids[topIndices[i] * 3 + k]);
+            cmax[k] = std::max(cmax[k], centroids[topIndices[i] * 3 + k]);
+        }
+    }
+
+    int axis = 0;
+    for(int k = 1; k < 3; k++)
+    {
+        if(cmax[k] - cmin[k] > cmax[axis] - cmin[axis])
+            axis = k;
+    }
+
+    int half = count / 2;
+    std::nth_element(topIndices.begin() + first, topIndices.begin() + first + half, topIndices.begin() + first + count,
+                     [&centroids, axis](int a, int b) { return centroids[a * 3 + axis] < centroids[b * 3 + axis]; });
+
+    int left = (int) topNodes.size();
+    topNodes.push_back(topNode());
+    topNodes.push_back(topNode());
+
+    topNodes[nodeIndex].first = left;
+    topNodes[nodeIndex].count = 0;
+
+    buildTopNode(left, first, half, centroids);
+    buildTopNode(left + 1, first + half, count - half, centroids);
+}
+
+void AtmosTwoLevelBVH::refitTop()
+{
+    for(int i = (int) topNodes.size() - 1; i >= 0; i--)
+    {
+        topNode& n = topNodes[i];
+        for(int k = 0; k < 3; k++)
+        {
+            n.bmin[k] = FLT_MAX;
+            n.bmax[k] = -FLT_MAX;
+        }
+
+        auto grow = [&n](const float bmin[3], const float bmax[3])
+        {
+            for(int k = 0; k < 3; k++)
+            {
+                n.bmin[k] = std::min(n.bmin[k], bmin[k]);
+                n.bmax[k] = std::max(n.bmax[k], bmax[k]);
+            }
+        };
+
+        if(n.count > 0)
+        {
+            for(int j = n.first; j < n.first + n.count; j++)
+            {
+                float bmin[3], bmax[3];
+                if(meshes[topIndices[j]]->getBounds(bmin, bmax))
+                    grow(bmin, bmax);
+            }
+        }
+        else
+        {
+            grow(topNodes[n.first].bmin, topNodes[n.first].bmax);
+            grow(topNodes[n.first + 1].bmin, topNodes[n.first + 1].bmax);
+        }
+    }
+}
+
+long long AtmosTwoLevelBVH::getRayCount()
+{
+    return rayCount;
+}
+
+// slab测试 返回光线是否穿过包围盒的(tMin, tMax)区间
+static inline bool hitBounds(const float bmin[3], const float bmax[3], const float origin[3], const float invDir[3], float tMin, float tMax)
+{
+    for(int k = 0; k < 3; k++)
+    {
+        float t0 = (bmin[k] - origin[k]) * invDir[k];
+        float t1 = (bmax[k] - origin[k]) * invDir[k];
+        if(t0 > t1)
+            std::swap(t0, t1);
+
+        tMin = std::max(tMin, t0);
+        tMax = std::min(tMax, t1);
+        if(tMin > tMax)
+            return false;
+    }
+
+    return true;
+}
+
+bool AtmosTwoLevelBVH::intersect(const a3Ray& ray, a3IntersectRecord* intersection) const
+{
+    rayCount++;
+
+    bool hit = false;
+    float closest = ray.maxT;
+
+    if(staticBVH && staticBVH->intersect(ray, intersection))
+    {
+        hit = true;
+        closest = intersection->t;
+    }
+
+    if(topNodes.empty())
+        return hit;
+
+    float origin[3] = {ray.o.x, ray.o.y, ray.o.z};
+    float invDir[3] = {1.0f / ray.d.x, 1.0f / ray.d.y, 1.0f / ray.d.z};
+
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+
+    // 动态层仅接受比已有交点更近的结果
+    while(top > 0)
+    {
+        const topNode& n = topNodes[stack[--top]];
+        if(!hitBounds(n.bmin, n.bmax, origin, invDir, ray.minT, closest))
+            continue;
+
+        if(n.count > 0)
+        {
+            for(int j = n.first; j < n.first + n.count; j++)
+            {
+                if(meshes[topIndices[j]]->intersect(ray, closest, intersection))
+                {
+                    hit = true;
+                    closest = intersection->t;
+                }
+            }
+        }
+        else
+        {
+            stack[top++] = n.first;
+            stack[top++] = n.first + 1;
+        }
+    }
+
+    return hit;
+}
+
+bool AtmosTwoLevelBVH::intersect(const a3Ray& ray) const
+{
+    rayCount++;
+
+    if(staticBVH && staticBVH->intersect(ray))
+        return true;
+
+    if(topNodes.empty())
+        return false;
+
+    float origin[3] = {ray.o.x, ray.o.y, ray.o.z};
+    float invDir[3] = {1.0f / ray.d.x, 1.0f / ray.d.y, 1.0f / ray.d.z};
+
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+
+    while(top > 0)
+    {
+        const topNode& n = topNodes[stack[--top]];
+        if(!hitBounds(n.bmin, n.bmax, origin, invDir, ray.minT, ray.maxT))
+            continue;
+
+        if(n.count > 0)
+        {
+            for(int j = n.first; j < n.first + n.count; j++)
+            {
+                if(meshes[topIndices[j]]->intersect(ray, ray.maxT))
+                    return true;
+            }
+        }
+        else
+        {
+            stack[top++] = n.first;
+            stack[top++] = n.first + 1;
+        }
+    }
+
+    return false;
+}
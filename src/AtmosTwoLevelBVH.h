@@ -0,0 +1,62 @@
+﻿#pragma once
+
+#include <vector>
+#include <Atmos.h>
+#include "AtmosMeshBVH.h"
+
+// 两层加速结构
+// 静态层: 非关键帧shape组成的a3BVH 仅在静态shape改变时重建
+// 动态层: 每个模型一棵AtmosMeshBVH 每帧refit
+// 顶层: 以各模型BVH的根包围盒建立的小BVH 避免每条光线遍历全部模型
+class AtmosTwoLevelBVH : public a3PrimitiveSet
+{
+public:
+    AtmosTwoLevelBVH();
+    ~AtmosTwoLevelBVH();
+
+    virtual bool intersect(const a3Ray& ray, a3IntersectRecord* intersection) const;
+
+    virtual bool intersect(const a3Ray& ray) const;
+
+    // 以给定primitive重建静态层 primitive内存不归此处管理
+    void buildStatic(const std::vector<a3Shape*>& staticPrimitives);
+
+    // 引用base的静态层(并行渲染的多帧共享) 不负责释放
+    void shareStatic(const AtmosTwoLevelBVH* base);
+
+    // meshes改变后调用 列表与上次相同时仅refit顶层包围盒 否则重建
+    void buildTop();
+
+    // 本线程至今求交的光线数(含阴影光线) 用于统计rays/s
+    static long long getRayCount();
+
+    // 静态层 无静态shape时为NULL
+    a3BVH* staticBVH;
+    bool ownsStatic;
+
+    // 动态层 由AtmosSceneBuilder持有
+    std::vector<const AtmosMeshBVH*> meshes;
+
+private:
+    struct topNode
+    {
+        float bmin[3], bmax[3];
+
+        // 内部节点: 左子节点索引(右子节点紧随其后) / 叶节点: topIndices中的起始位置
+        int first;
+
+        // 叶节点中的模型数 内部节点为0
+        int count;
+    };
+
+    void buildTopNode(int nodeIndex, int first, int count, const std::vector<float>& centroids);
+
+    // 子节点索引总大于父节点 逆序遍历即为自底向上
+    void refitTop();
+
+    std::vector<topNode> topNodes;
+    std::vector<int> topIndices;
+
+    // 建立顶层时的meshes 用于判断是否只需refit
+    std::vector<const AtmosMeshBVH*> topMeshes;
+};
@@ -0,0 +1,516 @@
+﻿#include "AtmosWavefront.h"
+#include "AtmosMaterialTable.h"
+#include "AtmosShapeData.h"
+#include "AtmosSampler.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// 每批的目标路径数 像素较少的网格一批包含每个像素的多个采样
+#define A3_WAVEFRONT_BATCH_SIZE 16384
+
+// 新光线起点沿法线的偏移
+#define A3_WAVEFRONT_RAY_EPSILON 1e-3f
+
+// 俄罗斯轮盘赌的存活概率上限 反射率为1的封闭场景同样能够终止
+#define A3_WAVEFRONT_MAX_SURVIVAL 0.95f
+
+// Glass的折射率
+#define A3_WAVEFRONT_GLASS_IOR 1.5f
+
+static const float pi = 3.14159265358979f;
+
+// splitmix64
+static inline uint64_t mixBits(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// [0, 1)
+static inline float nextFloat(uint64_t& state)
+{
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (float) (mixBits(state) >> 40) * (1.0f / 16777216.0f);
+}
+
+// 10位整数的各位间隔2位展开
+static inline uint32_t expandBits(uint32_t x)
+{
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+static inline a3Ray spawnRay(const t3Vector3f& p, const t3Vector3f& offset, const t3Vector3f& d, float maxT)
+{
+    a3Ray ray(p + offset * A3_WAVEFRONT_RAY_EPSILON, d);
+    ray.minT = 0.0f;
+    ray.maxT = maxT;
+    return ray;
+}
+
+wavefrontLightData::wavefrontLightData() :type(POINT), cosTotalWidth(-1.0f), cosFalloffStart(-1.0f)
+{
+    position[0] = position[1] = position[2] = 0.0f;
+    direction[0] = direction[1] = 0.0f;
+    direction[2] = -1.0f;
+    intensity[0] = intensity[1] = intensity[2] = 0.0f;
+}
+
+AtmosWavefrontIntegrator::AtmosWavefrontIntegrator() :russianRouletteDepth(3), maxDepth(-1), environment(NULL)
+{
+
+}
+
+a3Spectrum AtmosWavefrontIntegrator::li(const a3Ray& ray, const a3Scene& scene) const
+{
+    static thread_local batchData batch;
+    static thread_local std::vector<pathData> paths(1);
+    static thread_local uint64_t sequence = 0;
+
+    pathData& path = paths[0];
+    path.ray = ray;
+    path.throughput = a3Spectrum(1.0f);
+    path.radiance = a3Spectrum(0.0f);
+    path.random = mixBits(sequence++);
+    path.pixel = 0;
+    path.lastPdf = 0.0f;
+    path.depth = 0;
+    path.alive = true;
+
+    trace(paths, scene, batch, NULL);
+
+    return path.radiance;
+}
+
+long long AtmosWavefrontIntegrator::renderTile(const a3GridRenderer* renderer,
+                                               const a3Scene* scene,
+                                               a3Sampler* sampler,
+                                               const tileData& tile,
+                                               int samples,
+                                               const adaptiveSamplingData& adaptive,
+                                               AtmosFrameBuffer* buffer) const
+{
+    static thread_local batchData batch;
+    static thread_local std::vector<pathData> paths;
+
+    AtmosSampler* deterministic = dynamic_cast<AtmosSampler*>(sampler);
+
+    long long taken = 0;
+
+    int pixels = tile.width * tile.height;
+    int perBatch = pixels > 0 ? std::max(1, A3_WAVEFRONT_BATCH_SIZE / pixels) : 1;
+
+    for(int s = 0; s < samples; s += perBatch)
+    {
+        int count = std::min(perBatch, samples - s);
+
+        // 生成: 未收敛的像素各count条路径
+        paths.clear();
+        for(int y = tile.y; y < tile.y + tile.height; y++)
+        {
+            for(int x = tile.x; x < tile.x + tile.width; x++)
+            {
+                int index = x + y * buffer->width;
+
+                if(adaptive.enable && buffer->isConverged(index, adaptive))
+                    continue;
+
+                if(deterministic)
+                    deterministic->setSampleIndex((uint32_t) buffer->count[index]);
+
+                for(int i = 0; i < count; i++)
+                {
+                    a3CameraSample sample;
+                    sampler->getMoreSamples(x, y, &sample);
+
+                    pathData path;
+                    renderer->camera->castRay(&sample, &path.ray);
+                    path.throughput = a3Spectrum(1.0f);
+                    path.radiance = a3Spectrum(0.0f);
+
+                    // 由像素与其采样序号决定 与网格顺序和线程数无关
+                    path.random = mixBits(((uint64_t) index << 32) ^ (uint64_t) (buffer->count[index] + i));
+
+                    path.pixel = index;
+                    path.lastPdf = 0.0f;
+                    path.depth = 0;
+                    path.alive = true;
+                    paths.push_back(path);
+                }
+            }
+        }
+
+        if(paths.empty())
+            break;
+
+        trace(paths, *scene, batch, buffer->hasAOV() ? buffer : NULL);
+
+        for(auto& path : paths)
+            buffer->add(path.pixel, path.radiance);
+
+        taken += (long long) paths.size();
+    }
+
+    for(int y = tile.y; y < tile.y + tile.height; y++)
+    {
+        for(int x = tile.x; x < tile.x + tile.width; x++)
+        {
+            int index = x + y * buffer->width;
+            renderer->colorList[index] = buffer->getColor(index);
+        }
+    }
+
+    return taken;
+}
+
+void AtmosWavefrontIntegrator::trace(std::vector<pathData>& paths, const a3Scene& scene, batchData& batch, AtmosFrameBuffer* aov) const
+{
+    batch.active.clear();
+    for(int i = 0; i < (int) paths.size(); i++)
+    {
+        if(paths[i].alive)
+            batch.active.push_back(i);
+    }
+
+    batch.records.resize(paths.size());
+
+    while(!batch.active.empty())
+    {
+        // 求交: 按排序后的顺序 相邻光线访问相近的BVH节点
+        sortRays(paths, batch);
+
+        batch.hits.clear();
+        for(int i : batch.active)
+        {
+            pathData& path = paths[i];
+            a3IntersectRecord& record = batch.records[i];
+
+            bool hit = scene.intersect(path.ray, &record);
+
+            // 主光线的交点同时写入辅助缓冲
+            if(aov && path.depth == 0)
+                aov->addAOV(path.pixel, path.ray, hit ? &record : NULL);
+
+            if(!hit)
+            {
+                if(environment)
+                {
+                    a3Spectrum radiance = path.throughput * environment->lookup(path.ray.d);
+
+                    // 漫反射采样到的环境光与直接光照的环境采样按power heuristic合并
+                    if(path.lastPdf > 0.0f && environment->canSample())
+                    {
+                        float lightPdf = environment->pdf(path.ray.d) / getLightCount();
+                        radiance = radiance * (path.lastPdf * path.lastPdf / (path.lastPdf * path.lastPdf + lightPdf * lightPdf));
+                    }
+
+                    path.radiance += radiance;
+                }
+
+                path.alive = false;
+                continue;
+            }
+
+            const a3Shape* shape = record.shape;
+            path.radiance += path.throughput * shape->emission;
+
+            if(!shape->bsdf)
+            {
+                path.alive = false;
+                continue;
+            }
+
+            batch.hits.push_back(std::make_pair((const a3BSDF*) shape->bsdf, i));
+        }
+
+        // 着色: 按BSDF分组 组内保持光线的排序 每组仅判断一次材质类型
+        std::stable_sort(batch.hits.begin(), batch.hits.end(),
+                         [](const std::pair<const a3BSDF*, int>& a, const std::pair<const a3BSDF*, int>& b)
+        {
+            return a.first < b.first;
+        });
+
+        batch.shadowRays.clear();
+        for(size_t begin = 0, end = 0; begin < batch.hits.size(); begin = end)
+        {
+            const a3BSDF* bsdf = batch.hits[begin].first;
+            while(end < batch.hits.size() && batch.hits[end].first == bsdf)
+                end++;
+
+            switch(AtmosMaterialTable::getType(bsdf))
+            {
+            case DIFFUSE:
+                for(size_t k = begin; k < end; k++)
+                {
+                    int i = batch.hits[k].second;
+                    shadeDiffuse(paths[i], batch.records[i], i, batch);
+                }
+                break;
+            case MIRROR:
+                for(size_t k = begin; k < end; k++)
+                {
+                    int i = batch.hits[k].second;
+                    shadeMirror(paths[i], batch.records[i]);
+                }
+                break;
+            case GLASS:
+                for(size_t k = begin; k < end; k++)
+                {
+                    int i = batch.hits[k].second;
+                    shadeGlass(paths[i], batch.records[i]);
+                }
+                break;
+            default:
+                for(size_t k = begin; k < end; k++)
+                    paths[batch.hits[k].second].alive = false;
+                break;
+            }
+        }
+
+        // 阴影光线: 已按材质与光线顺序产生
+        for(auto& shadow : batch.shadowRays)
+        {
+            if(!scene.primitiveSet->intersect(shadow.ray))
+                paths[shadow.path].radiance += shadow.contribution;
+        }
+
+        // 移除已终止的路径
+        batch.active.erase(std::remove_if(batch.active.begin(), batch.active.end(), [&paths](int i)
+        {
+            return !paths[i].alive;
+        }), batch.active.end());
+    }
+}
+
+void AtmosWavefrontIntegrator::sortRays(const std::vector<pathData>& paths, batchData& batch) const
+{
+    if(batch.active.size() < 2)
+        return;
+
+    // 起点的包围盒 量化为每轴9位
+    float bmin[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+    float bmax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for(int i : batch.active)
+    {
+        const t3Vector3f& o = paths[i].ray.o;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            bmin[axis] = std::min(bmin[axis], o[axis]);
+            bmax[axis] = std::max(bmax[axis], o[axis]);
+        }
+    }
+
+    float scale[3];
+    for(int axis = 0; axis < 3; axis++)
+        scale[axis] = bmax[axis] > bmin[axis] ? 511.0f / (bmax[axis] - bmin[axis]) : 0.0f;
+
+    // 方向卦限(3位) | 起点Morton码(27位) | 路径索引(32位)
+    batch.keys.clear();
+    for(int i : batch.active)
+    {
+        const a3Ray& ray = paths[i].ray;
+
+        uint32_t octant = (ray.d.x < 0.0f ? 1 : 0) | (ray.d.y < 0.0f ? 2 : 0) | (ray.d.z < 0.0f ? 4 : 0);
+
+        uint32_t morton = 0;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            uint32_t q = (uint32_t) t3Math::clamp((ray.o[axis] - bmin[axis]) * scale[axis], 0.0f, 511.0f);
+            morton |= expandBits(q) << axis;
+        }
+
+        uint64_t key = (uint64_t) ((octant << 27) | morton);
+        batch.keys.push_back((key << 32) | (uint32_t) i);
+    }
+
+    std::sort(batch.keys.begin(), batch.keys.end());
+
+    for(size_t k = 0; k < batch.keys.size(); k++)
+        batch.active[k] = (int) (batch.keys[k] & 0xffffffff);
+}
+
+void AtmosWavefrontIntegrator::shadeDiffuse(pathData& path, const a3IntersectRecord& record, int index, batchData& batch) const
+{
+    t3Vector3f p = path.ray.o + path.ray.d * record.t;
+    t3Vector3f n = record.shape->getNormal(p, record.u, record.v).getNormalized();
+    if(n.dot(path.ray.d) > 0.0f)
+        n = n * -1.0f;
+
+    // 均匀选取一个光源 最后一个为环境贴图
+    int count = getLightCount();
+    int pick = count > 0 ? std::min((int) (nextFloat(path.random) * count), count - 1) : -1;
+    if(pick >= 0 && pick < (int) lights.size())
+    {
+        const wavefrontLightData& light = lights[pick];
+
+        t3Vector3f toLight = t3Vector3f(light.position[0], light.position[1], light.position[2]) - p;
+        float distance2 = toLight.dot(toLight);
+        float distance = std::sqrt(distance2);
+
+        t3Vector3f wi = toLight / distance;
+        float cosTheta = n.dot(wi);
+
+        float falloff = 1.0f;
+        if(light.type == wavefrontLightData::SPOT)
+        {
+            float cosAngle = -(wi.x * light.direction[0] + wi.y * light.direction[1] + wi.z * light.direction[2]);
+            if(cosAngle < light.cosTotalWidth)
+                falloff = 0.0f;
+            else if(cosAngle < light.cosFalloffStart)
+            {
+                float delta = (cosAngle - light.cosTotalWidth) / (light.cosFalloffStart - light.cosTotalWidth);
+                falloff = delta * delta * delta * delta;
+            }
+        }
+
+        if(cosTheta > 0.0f && falloff > 0.0f && distance > 0.0f)
+        {
+            a3Spectrum radiance = a3Spectrum(light.intensity[0], light.intensity[1], light.intensity[2]) * (falloff / distance2);
+
+            // Lambert(R = 1): f = 1 / pi 除以选中该光源的概率1 / count
+            shadowRayData shadow;
+            shadow.ray = spawnRay(p, n, wi, distance - 2.0f * A3_WAVEFRONT_RAY_EPSILON);
+            shadow.contribution = path.throughput * radiance * (cosTheta / pi * count);
+            shadow.path = index;
+            batch.shadowRays.push_back(shadow);
+        }
+    }
+    else if(pick >= 0)
+    {
+        float u0 = nextFloat(path.random), u1 = nextFloat(path.random), u2 = nextFloat(path.random);
+
+        float envPdf = 0.0f;
+        t3Vector3f wi = environment->sample(u0, u1, u2, &envPdf);
+        float cosTheta = n.dot(wi);
+
+        if(cosTheta > 0.0f && envPdf > 0.0f)
+        {
+            float lightPdf = envPdf / count;
+            float bsdfPdf = cosTheta / pi;
+            float weight = lightPdf * lightPdf / (lightPdf * lightPdf + bsdfPdf * bsdfPdf);
+
+            shadowRayData shadow;
+            shadow.ray = spawnRay(p, n, wi, FLT_MAX);
+            shadow.contribution = path.throughput * environment->lookup(wi) * (cosTheta / pi / lightPdf * weight);
+            shadow.path = index;
+            batch.shadowRays.push_back(shadow);
+        }
+    }
+
+    path.depth++;
+    if(!survive(path))
+        return;
+
+    // 余弦加权半球采样 f * cos / pdf = R = 1
+    float r = std::sqrt(nextFloat(path.random));
+    float phi = 2.0f * pi * nextFloat(path.random);
+    float x = r * std::cos(phi), y = r * std::sin(phi);
+    float z = std::sqrt(std::max(0.0f, 1.0f - x * x - y * y));
+
+    t3Vector3f tangent = std::fabs(n.x) > 0.1f ? t3Vector3f(0.0f, 1.0f, 0.0f).getCrossed(n) : t3Vector3f(1.0f, 0.0f, 0.0f).getCrossed(n);
+    tangent = tangent.getNormalized();
+    t3Vector3f bitangent = n.getCrossed(tangent);
+
+    t3Vector3f wo = (tangent * x + bitangent * y + n * z).getNormalized();
+    path.ray = spawnRay(p, n, wo, FLT_MAX);
+    path.lastPdf = z / pi;
+}
+
+void AtmosWavefrontIntegrator::shadeMirror(pathData& path, const a3IntersectRecord& record) const
+{
+    t3Vector3f p = path.ray.o + path.ray.d * record.t;
+    t3Vector3f n = record.shape->getNormal(p, record.u, record.v).getNormalized();
+    if(n.dot(path.ray.d) > 0.0f)
+        n = n * -1.0f;
+
+    path.depth++;
+    if(!survive(path))
+        return;
+
+    t3Vector3f d = path.ray.d.getNormalized();
+    t3Vector3f wo = d - n * (2.0f * d.dot(n));
+    path.ray = spawnRay(p, n, wo.getNormalized(), FLT_MAX);
+    path.lastPdf = 0.0f;
+}
+
+void AtmosWavefrontIntegrator::shadeGlass(pathData& path, const a3IntersectRecord& record) const
+{
+    t3Vector3f p = path.ray.o + path.ray.d * record.t;
+    t3Vector3f n = record.shape->getNormal(p, record.u, record.v).getNormalized();
+    t3Vector3f d = path.ray.d.getNormalized();
+
+    // 法线朝外时为射入
+    float cosI = -d.dot(n);
+    float eta = 1.0f / A3_WAVEFRONT_GLASS_IOR;
+    if(cosI < 0.0f)
+    {
+        n = n * -1.0f;
+        cosI = -cosI;
+        eta = A3_WAVEFRONT_GLASS_IOR;
+    }
+
+    path.depth++;
+    if(!survive(path))
+        return;
+
+    path.lastPdf = 0.0f;
+
+    float sin2T = eta * eta * (1.0f - cosI * cosI);
+
+    // 全反射时F = 1
+    float F = 1.0f, cosT = 0.0f;
+    if(sin2T < 1.0f)
+    {
+        cosT = std::sqrt(1.0f - sin2T);
+        float rs = (eta * cosI - cosT) / (eta * cosI + cosT);
+        float rp = (cosI - eta * cosT) / (cosI + eta * cosT);
+        F = 0.5f * (rs * rs + rp * rp);
+    }
+
+    // 按F选择反射或折射 权重与概率抵消
+    if(nextFloat(path.random) < F)
+    {
+        t3Vector3f wo = d + n * (2.0f * cosI);
+        path.ray = spawnRay(p, n, wo.getNormalized(), FLT_MAX);
+    }
+    else
+    {
+        t3Vector3f wo = d * eta + n * (eta * cosI - cosT);
+        path.ray = spawnRay(p, n * -1.0f, wo.getNormalized(), FLT_MAX);
+    }
+}
+
+int AtmosWavefrontIntegrator::getLightCount() const
+{
+    return (int) lights.size() + (environment && environment->canSample() ? 1 : 0);
+}
+
+bool AtmosWavefrontIntegrator::survive(pathData& path) const
+{
+    if(maxDepth >= 0 && path.depth > maxDepth)
+    {
+        path.alive = false;
+        return false;
+    }
+
+    if(path.depth > russianRouletteDepth)
+    {
+        const a3Spectrum& t = path.throughput;
+        float q = std::min(A3_WAVEFRONT_MAX_SURVIVAL, std::max(t.x, std::max(t.y, t.z)));
+        if(nextFloat(path.random) >= q)
+        {
+            path.alive = false;
+            return false;
+        }
+
+        path.throughput = path.throughput / q;
+    }
+
+    return true;
+}
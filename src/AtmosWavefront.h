@@ -0,0 +1,106 @@
+﻿#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <Atmos.h>
+#include "AtmosTileQueue.h"
+#include "AtmosFrameBuffer.h"
+#include "AtmosEnvironment.h"
+
+// 波前式路径追踪使用的光源 由编辑器光源数据转换
+struct wavefrontLightData
+{
+    enum
+    {
+        POINT = 0,
+        SPOT = 1
+    };
+
+    wavefrontLightData();
+
+    int type;
+    float position[3], direction[3];
+    float intensity[3];
+
+    // 聚光灯圆锥 / 半影起始角的余弦
+    float cosTotalWidth, cosFalloffStart;
+};
+
+// 波前式路径追踪
+// 一个网格的全部路径按阶段成批处理: 生成 -> 求交 -> 按材质着色 -> 阴影光线
+// 求交前光线按方向卦限与起点的Morton码排序 着色前交点按BSDF分组
+// 同一批内的求交与着色访问相近的节点与相同的材质 缓存与分支预测更友好
+// 材质按a3MaterialType自行着色(Glass / Mirror / Diffuse) 光源为点光源 / 聚光灯与环境贴图
+// 环境贴图按别名表重要性采样 与漫反射采样以power heuristic做多重重要性采样
+class AtmosWavefrontIntegrator : public a3Integrator
+{
+public:
+    AtmosWavefrontIntegrator();
+
+    // 单条光线作为仅含一条路径的一批处理
+    virtual a3Spectrum li(const a3Ray& ray, const a3Scene& scene) const;
+
+    // 与renderTile的约定相同 由renderTile转发
+    long long renderTile(const a3GridRenderer* renderer,
+                         const a3Scene* scene,
+                         a3Sampler* sampler,
+                         const tileData& tile,
+                         int samples,
+                         const adaptiveSamplingData& adaptive,
+                         AtmosFrameBuffer* buffer) const;
+
+    int russianRouletteDepth, maxDepth;
+
+    std::vector<wavefrontLightData> lights;
+
+    // 由AtmosEnvironmentCache持有 没有环境光时为NULL
+    const AtmosEnvironmentMap* environment;
+
+private:
+    // 一批中的一条路径 random为本路径的随机数状态
+    // lastPdf为上一次漫反射采样方向的概率密度 主光线与镜面反射 / 折射后为0(环境光不做MIS)
+    struct pathData
+    {
+        a3Ray ray;
+        a3Spectrum throughput, radiance;
+        uint64_t random;
+        float lastPdf;
+        int pixel;
+        int depth;
+        bool alive;
+    };
+
+    struct shadowRayData
+    {
+        a3Ray ray;
+        a3Spectrum contribution;
+        int path;
+    };
+
+    // 每个线程复用的批数据
+    struct batchData
+    {
+        std::vector<int> active;
+        std::vector<uint64_t> keys;
+        std::vector<a3IntersectRecord> records;
+        std::vector<std::pair<const a3BSDF*, int>> hits;
+        std::vector<shadowRayData> shadowRays;
+    };
+
+    // 追踪paths直至全部终止 结果累积在radiance中 aov不为NULL时写入主光线的交点
+    void trace(std::vector<pathData>& paths, const a3Scene& scene, batchData& batch, AtmosFrameBuffer* aov) const;
+
+    // 按光线方向与起点排序active
+    void sortRays(const std::vector<pathData>& paths, batchData& batch) const;
+
+    // 更新路径的下一条光线 漫反射同时产生阴影光线
+    void shadeDiffuse(pathData& path, const a3IntersectRecord& record, int index, batchData& batch) const;
+    void shadeMirror(pathData& path, const a3IntersectRecord& record) const;
+    void shadeGlass(pathData& path, const a3IntersectRecord& record) const;
+
+    // 可供直接光照采样的光源数 环境贴图可采样时计入
+    int getLightCount() const;
+
+    // 深度限制与俄罗斯轮盘赌 终止时将路径标记为结束
+    bool survive(pathData& path) const;
+};
@@ -1,8 +1,27 @@
 ﻿#include "ofMain.h"
 #include "ofApp.h"
+#include "AtmosBatch.h"
+#include "AtmosBenchmark.h"
+#include "AtmosFarm.h"
 
 //========================================================================
-int main( ){
+int main(int argc, char* argv[]){
+	// 命令行批量渲染: AtmosMovie -batch scene.atmos [startFrame endFrame]
+	if(argc >= 3 && string(argv[1]) == "-batch")
+		return batchRender(argc - 2, argv + 2);
+
+	// 渲染农场: AtmosMovie -farm scene.atmos [-port 7340] [-frames start end] [-strips 1] [-spawn 0]
+	if(argc >= 3 && string(argv[1]) == "-farm")
+		return farmCoordinator(argv[0], argc - 2, argv + 2);
+
+	// 渲染农场工作进程: AtmosMovie -worker host port
+	if(argc >= 4 && string(argv[1]) == "-worker")
+		return farmWorker(argc - 2, argv + 2);
+
+	// 性能测试: AtmosMovie -benchmark [width height]
+	if(argc >= 2 && string(argv[1]) == "-benchmark")
+		return benchmarkRender(argc - 2, argv + 2);
+
 	ofSetupOpenGL(1280,780,OF_WINDOW);			// <-------- setup the GL context
 
 	// this kicks off the running of my app
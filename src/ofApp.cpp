@@ -1,15 +1,11 @@
 ﻿#include "ofApp.h"
+#include "AtmosQuantize.h"
+#include "AtmosCheckpoint.h"
+#include "AtmosFrameCache.h"
+#include "AtmosSampler.h"
 
 //#define TEST
 
-enum a3MaterialType
-{
-    NONE = -1,
-    GLASS = 0,
-    MIRROR = 1,
-    DIFFUSE = 2
-};
-
 //--------------------------------------------------------------
 void ofApp::setup(){
     atmosInitOnce = false;
@@ -17,6 +13,8 @@ void ofApp::setup(){
     renderingFinished = true;
 
     currentFrame = 0;
+    output = NULL;
+    fingerprint = 0;
 
     // Gui
     ImGuiIO& io = ImGui::GetIO();
@@ -36,74 +34,147 @@ void ofApp::update(){
     {
         if(!atmosInitOnce)
         {
-            // 初始化渲染器必要组件
-            initAtmos();
+            stats.begin(config.getStatsPath());
+            denoiser.reset();
+            timer.start();
+
             // 已初始化完毕允许渲染器结束工作的延迟执行
             atmosInitOnce = true;
-            renderingFinished = false;
+
+            // 跳过已完成的关键帧
+            currentFrame = findNextFrame(config, shapeList, lightList, config.startFrame, getLastFrame());
+            if(currentFrame <= getLastFrame())
+            {
+                // 初始化渲染器必要组件
+                initAtmos();
+                renderingFinished = false;
+            }
+            else
+            {
+                a3Log::debug("全部关键帧均已完成\n");
+                progress = 1.0f;
+            }
         }
 
-        if(!renderer->isFinished())
-        {
-            renderer->render(scene);
+        // 先确认完成状态再取队列 避免遗漏最后一个网格
+        bool frameFinished = scheduler.isFinished();
 
-            // 渲染中更新预览纹理
-            int gridWidth = renderer->gridWidth;
-            int gridHeight = renderer->gridHeight;
+        // 渲染中更新预览纹理 仅转换并上传已完成的网格
+        auto begin = std::chrono::high_resolution_clock::now();
 
-            int gridX = renderer->startX + (int) ((renderer->currentGrid - 1) % renderer->levelX) * gridWidth;
-            int gridY = renderer->startY + (int) ((renderer->currentGrid - 1) / renderer->levelX) * gridHeight;
-            int gridEndX = gridX + gridWidth;
-            int gridEndY = gridY + gridHeight;
+        tileData tile;
+        while(scheduler.popTile(tile))
+            updatePreview(tile);
 
-            progress = (float) renderer->currentGrid / (renderer->levelX * renderer->levelY);
+        frameStats.seconds[A3_PHASE_PREVIEW] += elapsedSeconds(begin);
 
-            // 更新网格待渲染区域
-            if(!renderer->isFinished())
-            {
-//#pragma omp parallel for schedule(dynamic)
-                for(int x = gridX; x < gridEndX; x++)
-                {
-                    for(int y = gridY; y < gridEndY; y++)
-                    {
-                        a3Spectrum& color = renderer->colorList[x + y * imageWidth];
+        progress = scheduler.getProgress();
 
-                        // 截断
-                        color.x = t3Math::clamp(color.x, 0.0f, 1.0f);
-                        color.y = t3Math::clamp(color.y, 0.0f, 1.0f);
-                        color.z = t3Math::clamp(color.z, 0.0f, 1.0f);
+        if(frameFinished && !renderingFinished)
+        {
+            scheduler.stop();
 
-                        previewPixels.setColor(x, y, ofColor(color.x * 255, color.y * 255, color.z * 255));
-                    }
-                }
+            denoiseFrame();
 
-                preview.loadData(previewPixels);
-            }
-        }
-        else
-        {
-            if(!renderingFinished)
-            {
-                // 是否为关键帧中的一帧完成渲染
-                renderer->end();
+            // 是否为关键帧中的一帧完成渲染
+            // 编码保存交由写入线程 不阻塞下一帧
+            saveFrame(true);
 
-                // 查看是否需要渲染关键帧
-                // 有则需要重新对renderer等进行分配
-                if(hasKeyFrame && currentFrame + 1 >= startFrame && currentFrame + 1 <= endFrame)
-                {
-                    currentFrame++;
+            // 查看是否需要渲染关键帧
+            // 有则需要重新对renderer等进行分配
+            int next = findNextFrame(config, shapeList, lightList, currentFrame + 1, getLastFrame());
+            if(next <= getLastFrame())
+            {
+                currentFrame = next;
 
-                    // 代渲染数据已设定完毕开始渲染前分配工作
-                    // 初始化渲染器必要组件
-                    initAtmos();
-                }
-                else
-                    renderingFinished = true;
+                // 代渲染数据已设定完毕开始渲染前分配工作
+                // 初始化渲染器必要组件
+                initAtmos();
             }
+            else
+                renderingFinished = true;
         }
     }
 }
 
+//--------------------------------------------------------------
+void ofApp::denoiseFrame()
+{
+    if(!config.enableDenoise)
+        return;
+
+    auto begin = std::chrono::high_resolution_clock::now();
+
+    tileData region = denoiser.denoise(config, scheduler.getFrameBuffer(), atmos.renderer->colorList, currentFrame);
+    AtmosFrameWriter::writeTile(output, atmos.renderer->colorList, config.imageWidth, region);
+    updatePreview(region);
+
+    frameStats.seconds[A3_PHASE_DENOISE] = elapsedSeconds(begin);
+}
+
+//--------------------------------------------------------------
+void ofApp::saveFrame(bool complete)
+{
+    frameStats.seconds[A3_PHASE_RENDER] = scheduler.getElapsedSeconds();
+    frameStats.tiles = scheduler.getTileStats();
+
+    // 保存耗时在写入线程中得到 之后才写入日志
+    AtmosStats* target = &stats;
+    frameStatsData current = frameStats;
+    std::string path = output->path;
+    uint64_t hash = fingerprint;
+    renderConfigData frameConfig = config;
+    output->onSaved = [target, current, path, hash, complete, frameConfig](bool saved, double seconds) mutable
+    {
+        current.seconds[A3_PHASE_SAVE] = seconds;
+        current.saved = saved;
+        target->finishFrame(current);
+
+        if(saved && complete)
+            commitFrame(frameConfig, path, hash);
+    };
+
+    writer.endFrame(output);
+    output = NULL;
+
+    if(config.enableAdaptive && config.saveHeatmap)
+        writer.writeHeatmap(scheduler.getFrameBuffer(), config.getHeatmapPath(currentFrame), config.spp);
+}
+
+//--------------------------------------------------------------
+int ofApp::getLastFrame() const
+{
+    // 无关键帧时仅渲染起始帧
+    return config.hasKeyFrame ? config.endFrame : config.startFrame;
+}
+
+//--------------------------------------------------------------
+void ofApp::updatePreview(const tileData& tile)
+{
+    previewTile.resize((size_t) tile.width * tile.height * 3);
+
+    // 工作线程仍在写入其余网格 此处只读不修改
+    quantizeTile(atmos.renderer->colorList, config.imageWidth, tile, previewTile.data(), tile.width * 3);
+
+    ofTextureData& data = preview.getTextureData();
+    glBindTexture(data.textureTarget, data.textureID);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(data.textureTarget, 0, tile.x, tile.y, tile.width, tile.height,
+                    GL_RGB, GL_UNSIGNED_BYTE, previewTile.data());
+    glBindTexture(data.textureTarget, 0);
+}
+
+//--------------------------------------------------------------
+void ofApp::exit(){
+    scheduler.stop();
+
+    if(output)
+    {
+        writer.cancelFrame(output);
+        output = NULL;
+    }
+}
+
 //--------------------------------------------------------------
 void ofApp::draw(){
     gui.begin();
@@ -155,7 +226,7 @@ void ofApp::draw(){
     else
     {
         // 渐进渲染预览
-        preview.draw(0, 0, imageWidth, imageHeight);
+        preview.draw(0, 0, config.imageWidth, config.imageHeight);
 
         // 渲染中进度界面
         renderingPanel();
@@ -167,214 +238,53 @@ void ofApp::draw(){
 //--------------------------------------------------------------
 void ofApp::initAtmos()
 {
-    ofSetWindowShape(imageWidth, imageHeight);
+    ofSetWindowShape(config.imageWidth, config.imageHeight);
 
     // 初始化关键帧信息
     //currentFrame = startFrame;
 
     // Atmos
-    if(renderer)
-    {
-        // 同时释放与renderer相关的指针内存
-        A3_SAFE_DELETE(renderer->sampler);
-        A3_SAFE_DELETE(renderer->camera->image);
-        A3_SAFE_DELETE(renderer->camera);
-        A3_SAFE_DELETE(renderer->integrator);
-        A3_SAFE_DELETE_1DARRAY(renderer->colorList);
-        A3_SAFE_DELETE(renderer);
-    }
-    if(scene)
-    {
-        // 同时释放与scene相关的指针内存
-        for(auto l : scene->lights)
-        {
-            A3_SAFE_DELETE(l);
-        }
-        scene->lights.clear();
-        // delete all shapes
-        for(auto p : scene->primitiveSet->primitives)
-        {
-            A3_SAFE_DELETE(p->areaLight);
-            A3_SAFE_DELETE(p->bsdf);
-            A3_SAFE_DELETE(p);
-        }
-        scene->primitiveSet->primitives.clear();
-        A3_SAFE_DELETE(scene->primitiveSet);
-        A3_SAFE_DELETE(scene);
-    }
+    // 重新分配前确保工作线程不再访问旧的renderer / scene
+    scheduler.stop();
 
-    // alloc
-    a3Film* image = NULL;
-    if(hasKeyFrame)
+    // 中途停止的帧不保存
+    if(output)
     {
-        string path = addKeyFrameInPath(currentFrame, saveToPath);
-
-        image = new a3Film(imageWidth, imageHeight, path);
+        writer.cancelFrame(output);
+        output = NULL;
     }
-    else
-        image = new a3Film(imageWidth, imageHeight, saveToPath);
-
-    if(previewPixels.isAllocated())
-        previewPixels.clear();
-
-    previewPixels.allocate(imageWidth, imageHeight, OF_PIXELS_RGB);
 
-    a3PerspectiveSensor* camera = new a3PerspectiveSensor(t3Vector3f(cameraOrigin[0], cameraOrigin[1], cameraOrigin[2]), 
-                                                          t3Vector3f(cameraLookat[0], cameraLookat[1], cameraLookat[2]),
-                                                          t3Vector3f(cameraUp[0], cameraUp[1], cameraUp[2]),
-                                                          cameraFov, cameraFocalDistance, cameraLensRadius, image);
-
-    a3Scene* se = new a3Scene();
-    scene = se;
-    a3BVH* bvh = NULL;
-
-    if(enableBVH)
-        se->primitiveSet = bvh = new a3BVH();
-    else
-        se->primitiveSet = new a3Exhaustive();
-
-    renderer = new a3GridRenderer(spp);
-    renderer->setLevel(level[0], level[1]);
-    renderer->camera = camera;
-    renderer->sampler = new a3RandomSampler();
-    renderer->startX = localStartPos[0];
-    renderer->startY = localStartPos[1];
-    renderer->renderWidth = localRenderSize[0];
-    renderer->renderHeight = localRenderSize[1];
-
-    // integrator
-    if(enablePath)
-    {
-        a3PathIntegrator* path = new a3PathIntegrator();
-        path->russianRouletteDepth = russianRouletteDepth;
-        path->maxDepth = -1;
-        renderer->integrator = path;
-    }
-    else
-    {
-        a3DirectLightingIntegrator* direct = new a3DirectLightingIntegrator();
-        direct->maxDepth = maxDepth;
-        renderer->integrator = direct;
-    }
+    frameStats = frameStatsData();
+    frameStats.frame = currentFrame;
+    fingerprint = 0;
+    if(config.enableResume || config.enableFrameCache)
+        fingerprint = getFrameFingerprint(config, shapeList, lightList, currentFrame);
 
-    renderer->enableGammaCorrection = enableGammaCorrection;
-    renderer->enableToneMapping = enableToneMapping;
+    atmos.build(config, shapeList, lightList, currentFrame);
+    frameStats.seconds[A3_PHASE_IMPORT] = atmos.importSeconds;
+    frameStats.seconds[A3_PHASE_BVH] = atmos.bvhSeconds;
+    frameStats.arena = atmos.getArenaStats();
 
-    auto addShape = [&se](a3Shape* s, a3Spectrum R, a3Spectrum emission, int type, a3Texture<a3Spectrum>* texture)->auto
+    // 尺寸不变时保留上一帧的画面 由新网格逐块覆盖
+    if(!preview.isAllocated() || preview.getWidth() != config.imageWidth || preview.getHeight() != config.imageHeight)
     {
-        s->emission = emission;
-
-        switch(type)
-        {
-        case DIFFUSE:
-            s->bsdf = new a3Diffuse(R);
-            break;
-        case MIRROR:
-            s->bsdf = new a3Conductor(R);
-            break;
-        case GLASS:
-            s->bsdf = new a3Dieletric(R);
-            break;
-        default:
-            a3Log::error("未找到指定类型材质: %d\n", type);
-            break;
-        }
-
-        s->bsdf->texture = texture;
-        if(texture)
-            s->bCalTextureCoordinate = true;
-
-        se->addShape(s);
+        ofPixels black;
+        black.allocate(config.imageWidth, config.imageHeight, OF_PIXELS_RGB);
+        memset(black.getData(), 0, (size_t) config.imageWidth * config.imageHeight * 3);
 
-        return s->bsdf;
-    };
-
-    // light
-    for(auto l : lightList)
-    {
-        if(l->name == "Area Light")
-        {
-            // do nothing
-            // still have bug
-        }
-        else if(l->name == "Spot Light")
-        {
-            spotLightData* data = (spotLightData*) l;
-            scene->addLight(new a3SpotLight(t3Vector3f(data->position[0], data->position[1], data->position[2]),
-                                            t3Vector3f(data->direction[0], data->direction[1], data->direction[2]),
-                                            a3Spectrum(data->intensity[0], data->intensity[1], data->intensity[2]),
-                                            data->coneAngle, data->falloffStart));
-        }
-        else if(l->name == "Point Light")
-        {
-            pointLightData* data = (pointLightData*) l;
-            scene->addLight(new a3PointLight(t3Vector3f(data->position[0], data->position[1], data->position[2]),
-                                             t3Vector3f(data->intensity[0], data->intensity[1], data->intensity[2])));
-        }
-        else if(l->name == "Inifinite Area Light")
-        {
-            infiniteAreaLightData* data = (infiniteAreaLightData*)l;
-            scene->addLight(new a3InfiniteAreaLight(data->imagePath));
-        }
+        preview.allocate(config.imageWidth, config.imageHeight, GL_RGB);
+        preview.loadData(black);
     }
 
-    // shape
-    for(auto s : shapeList)
-    {
-        if(s->name == "Mesh")
-        {
-            meshData* data = (meshData*) s;
-            a3ModelImporter importer;
-            std::vector<a3Shape*> model;
-            if(data->supportKeyFrame)
-            {
-                // 路径中添加关键帧信息
-                string path = addKeyFrameInPath(currentFrame, data->modelPath);
-
-                model = importer.load(path.c_str());
-            }
-            else
-                model = importer.load(data->modelPath);
+    // 工作线程开始渲染 update()仅负责取出已完成的网格
+    output = writer.beginFrame(config.getSavePath(currentFrame), config.imageWidth, config.imageHeight,
+                               config.enableToneMapping, config.enableGammaCorrection);
+    if(config.enableResume)
+        scheduler.setCheckpoint(getCheckpointPath(output->path), fingerprint);
+    scheduler.start(atmos.renderer, atmos.scene, config, true, output);
 
-            for(auto s : model)
-                addShape(s, t3Vector3f(1.0f), t3Vector3f(0.0f), data->materialType, NULL);
-        }
-        else if(s->name == "InfinitePlane")
-        {
-            infinitePlaneData* data = (infinitePlaneData*) s;
-            addShape(new a3InfinitePlane(t3Vector3f(data->position[0], data->position[1], data->position[2]),
-                                         t3Vector3f(data->normal[0], data->normal[1], data->normal[2])),
-                     a3Spectrum(1.0f), a3Spectrum(0.0f), data->materialType, NULL);
-        }
-        else if(s->name == "Sphere")
-        {
-            sphereData* data = (sphereData*) s;
-            addShape(new a3Sphere(t3Vector3f(data->center[0], data->center[1], data->center[2]), data->radius),
-                     a3Spectrum(1.0f), a3Spectrum(0.0f), data->materialType, NULL);
-        }
-        else if(s->name == "Disk")
-        {
-            diskData* data = (diskData*) s;
-            addShape(new a3Disk(t3Vector3f(data->center[0], data->center[1], data->center[2]), 
-                                data->radius, 
-                                t3Vector3f(data->normal[0], data->normal[1], data->normal[2])), 
-                     a3Spectrum(1.0f), a3Spectrum(0.0f), data->materialType, NULL);
-        }
-        else if(s->name == "Triangle")
-        {
-            // 懒得写
-        }
-        else if(s->name == "Plane")
-        {
-            // do nothing
-            // still have bug
-        }
-    }
-
-    if(enableBVH)
-        bvh->init();
-
-    renderer->begin();
+    // 渲染当前帧的同时导入下一关键帧 下一帧的查找在后台线程中进行
+    atmos.prefetch(config, shapeList, lightList, currentFrame + 1, getLastFrame());
 }
 
 //--------------------------------------------------------------
@@ -389,59 +299,13 @@ void ofApp::initImGui()
     openLightWindow = true;
     openAboutWindow = false;
 
-    // config
-    startFrame = 1;
-    endFrame = 10;
-    spp = 16;
-
-    imageWidth = 1280;
-    imageHeight = 720;
-
-    hasKeyFrame = true;
+    // config / image / integrator / post effect / camera
+    config = renderConfigData();
     startRendering = false;
 
-    // image
-    localStartPos[0] = 0;
-    localStartPos[1] = 0;
-    localRenderSize[0] = imageWidth;
-    localRenderSize[1] = imageHeight;
-
-    level[0] = 8;
-    level[1] = 6;
-
-    // 动态获取当前可执行文件目录
-    string exePath = ofFilePath::getCurrentWorkingDirectory();
-    exePath += "\\data\\movie\\Test.png";
-    strcpy(saveToPath, exePath.c_str());
-
-    // integrator
-    enablePath = true;
-    enableBVH = true;
-    maxDepth = -1;
-    russianRouletteDepth = 3;
-
-    // post effect
-    enableGammaCorrection = false;
-    enableToneMapping = false;
-
-    // camera
-    cameraLookat[0] = -2.0f;
-    cameraLookat[1] = 0.0f;
-    cameraLookat[2] = 3.5f;
-    cameraUp[0] = 0.0f;
-    cameraUp[1] = 0.0f;
-    cameraUp[2] = 1.0f;   
-    cameraOrigin[0] = -2.0f;
-    cameraOrigin[1] = 77.0f;
-    cameraOrigin[2] = 17.0f;
-
-    cameraFov = 40.0f;
-    cameraFocalDistance = 100.0f;
-    cameraLensRadius = 0.0f;
-
     // ImGui Start Rendering
     stopRendering = false;
-    currentFrame = startFrame;
+    currentFrame = config.startFrame;
     progress = 0.0f;
 
     // clear lists
@@ -476,58 +340,86 @@ void ofApp::renderingMenu()
     if(ImGui::Begin("Render Config", &openRenderingWindow))
     {
         ImGui::Text("Config");
-        if(ImGui::DragInt("Start Frame", &startFrame, 1, 0, 10000))
+        if(ImGui::DragInt("Start Frame", &config.startFrame, 1, 0, 10000))
+        {
+            if(config.startFrame > config.endFrame)
+                config.startFrame = config.endFrame;
+        }
+
+        if(ImGui::DragInt("End Frame", &config.endFrame, 1, 0, 10000))
         {
-            if(startFrame > endFrame)
-                startFrame = endFrame;
+            if(config.endFrame < config.startFrame)
+                config.endFrame = config.startFrame;
         }
 
-        if(ImGui::DragInt("End Frame", &endFrame, 1, 0, 10000))
+        ImGui::DragInt("Spp", &config.spp, 1, 1, 1000000);
+
+        ImGui::Checkbox("Has Key Frame ?##Rendering", &config.hasKeyFrame);
+
+        ImGui::Checkbox("Progressive##Rendering", &config.enableProgressive);
+        if(ImGui::IsItemHovered())
+            ImGui::SetTooltip("Render the whole frame at 1, 2, 4 ... spp\nStop at any pass to save the current image");
+
+        ImGui::DragInt("Frames In Flight", &config.framesInFlight, 1, 0, 64);
+        if(ImGui::IsItemHovered())
+            ImGui::SetTooltip("Key frames rendered at the same time by -batch, 0 = auto");
+
+        ImGui::Checkbox("Adaptive##Rendering", &config.enableAdaptive);
+        if(ImGui::IsItemHovered())
+            ImGui::SetTooltip("Stop sampling converged pixels early, Spp is the max samples per pixel");
+        if(config.enableAdaptive)
         {
-            if(endFrame < startFrame)
-                endFrame = startFrame;
+            ImGui::DragFloat("Noise Threshold", &config.adaptiveThreshold, 0.001f, 0.001f, 1.0f);
+            ImGui::DragInt("Min Spp", &config.adaptiveMinSpp, 1, 2, 1000000);
+            ImGui::Checkbox("Save Spp Heatmap", &config.saveHeatmap);
         }
 
-        ImGui::DragInt("Spp", &spp, 1, 1, 1000000);
+        ImGui::Checkbox("Resume##Rendering", &config.enableResume);
+        if(ImGui::IsItemHovered())
+            ImGui::SetTooltip("Skip frames already rendered with the same scene\nContinue interrupted frames from their checkpoint");
+        if(config.enableResume)
+            ImGui::DragInt("Checkpoint Interval (s)", &config.checkpointInterval, 1, 0, 86400);
 
-        ImGui::Checkbox("Has Key Frame ?##Rendering", &hasKeyFrame);
+        ImGui::Checkbox("Frame Cache##Rendering", &config.enableFrameCache);
+        if(ImGui::IsItemHovered())
+            ImGui::SetTooltip("Reuse frames rendered before from identical inputs (scene, frame, mesh files)\nOnly frames affected by an edit are rendered again");
 
         ImGui::Separator();
 
         ImGui::Text("Image");
-        ImGui::DragInt("Width", &imageWidth, 1, 1, 1000000);
-        ImGui::DragInt("Height", &imageHeight, 1, 1, 1000000);
+        ImGui::DragInt("Width", &config.imageWidth, 1, 1, 1000000);
+        ImGui::DragInt("Height", &config.imageHeight, 1, 1, 1000000);
 
         ImGui::Separator();
         ImGui::Text("Local Rendering");
-        if(ImGui::DragInt2("start", localStartPos, 1, 1, 1000000))
+        if(ImGui::DragInt2("start", config.localStartPos, 1, 1, 1000000))
         {
-            if(localStartPos[0] + localRenderSize[0] > imageWidth)
-                localStartPos[0] = imageWidth - localRenderSize[0];
+            if(config.localStartPos[0] + config.localRenderSize[0] > config.imageWidth)
+                config.localStartPos[0] = config.imageWidth - config.localRenderSize[0];
 
-            if(localStartPos[1] + localRenderSize[1] > imageHeight)
-                localStartPos[1] = imageHeight - localRenderSize[1];
+            if(config.localStartPos[1] + config.localRenderSize[1] > config.imageHeight)
+                config.localStartPos[1] = config.imageHeight - config.localRenderSize[1];
         }
-        if(ImGui::DragInt2("size", localRenderSize, 1, 1, 1000000))
+        if(ImGui::DragInt2("size", config.localRenderSize, 1, 1, 1000000))
         {
-            if(localRenderSize[0] + localStartPos[0] > imageWidth)
-                localRenderSize[0] = imageWidth - localStartPos[0];
+            if(config.localRenderSize[0] + config.localStartPos[0] > config.imageWidth)
+                config.localRenderSize[0] = config.imageWidth - config.localStartPos[0];
 
-            if(localRenderSize[1] + localStartPos[1] > imageHeight)
-                localRenderSize[1] = imageHeight - localStartPos[1];
+            if(config.localRenderSize[1] + config.localStartPos[1] > config.imageHeight)
+                config.localRenderSize[1] = config.imageHeight - config.localStartPos[1];
         }
 
-        if(ImGui::DragInt2("Level", level, 1.0f, 1.0f, 20.0f))
+        if(ImGui::DragInt2("Level", config.level, 1.0f, 1.0f, 20.0f))
         {
-            if(level[0] > imageWidth)
-                level[0] = imageWidth;
-            if(level[1] > imageHeight)
-                level[1] = imageHeight;
+            if(config.level[0] > config.imageWidth)
+                config.level[0] = config.imageWidth;
+            if(config.level[1] > config.imageHeight)
+                config.level[1] = config.imageHeight;
         }
 
         ImGui::Separator();
         ImGui::Text("Save");
-        ImGui::InputText("Image Path", saveToPath, sizeof(saveToPath) / sizeof(char));
+        ImGui::InputText("Image Path", config.saveToPath, sizeof(config.saveToPath) / sizeof(char));
 
         // save to button with custom color
         ImGui::PushID(0);
@@ -537,7 +429,7 @@ void ofApp::renderingMenu()
         if(ImGui::Button("Save To..."))
         {
             ofFileDialogResult result = ofSystemSaveDialog("", "");
-            strcpy(saveToPath, result.getPath().c_str());
+            strcpy(config.saveToPath, result.getPath().c_str());
             strcpy(saveImageName, result.getName().c_str());
         }
         ImGui::PopStyleColor(3);
@@ -546,46 +438,135 @@ void ofApp::renderingMenu()
         if(ImGui::IsItemHovered())
             ImGui::SetTooltip("Set the image's save path");
 
+        ImGui::Separator();
+        ImGui::Text("Scene");
+        ImGui::PushID(0);
+        ImGui::PushStyleColor(ImGuiCol_Button, ImColor::HSV(4 / 7.0f, 0.6f, 0.6f));
+        ImGui::PushStyleColor(ImGuiCol_ButtonHovered, ImColor::HSV(4 / 7.0f, 0.7f, 0.7f));
+        ImGui::PushStyleColor(ImGuiCol_ButtonActive, ImColor::HSV(4 / 7.0f, 0.8f, 0.8f));
+        if(ImGui::Button("Import Scene..."))
+        {
+            ofFileDialogResult result = ofSystemLoadDialog("Open Atmos Scene", false, "");
+            if(result.bSuccess)
+            {
+                for(auto s : shapeList)
+                    delete s;
+                shapeList.clear();
+
+                for(auto l : lightList)
+                    delete l;
+                lightList.clear();
+
+                loadScene(result.getPath(), config, shapeList, lightList);
+            }
+        }
+        ImGui::SameLine();
+        if(ImGui::Button("Export Scene..."))
+        {
+            ofFileDialogResult result = ofSystemSaveDialog("scene.atmos", "Export Atmos Scene");
+            if(result.bSuccess)
+                saveScene(result.getPath(), config, shapeList, lightList);
+        }
+        ImGui::PopStyleColor(3);
+        ImGui::PopID();
+
+        if(ImGui::IsItemHovered())
+            ImGui::SetTooltip("Scene file can be rendered without window by: AtmosMovie -batch scene.atmos");
+
         ImGui::Separator();
         ImGui::Text("Integrator");
-        static int e = 1;
+        int e = !config.enablePath ? 0 : (config.enableWavefront ? 2 : 1);
         if(ImGui::RadioButton("Direct", &e, 0))
-            enablePath = false;
+            config.enablePath = false;
         ImGui::SameLine();
         if(ImGui::RadioButton("Path", &e, 1))
-            enablePath = true;
+        {
+            config.enablePath = true;
+            config.enableWavefront = false;
+        }
+        ImGui::SameLine();
+        if(ImGui::RadioButton("Wavefront", &e, 2))
+        {
+            config.enablePath = true;
+            config.enableWavefront = true;
+        }
+        if(ImGui::IsItemHovered())
+            ImGui::SetTooltip("Path tracing in batches per tile: rays sorted, hits grouped by material");
         
-        if(enablePath)
+        if(config.enablePath)
         {
-            ImGui::DragInt("RR Depth", &russianRouletteDepth, 1, 0, 1000000);
+            ImGui::DragInt("RR Depth", &config.russianRouletteDepth, 1, 0, 1000000);
             if(ImGui::IsItemHovered())
                 ImGui::SetTooltip("Set number of Russian-Roulette Depth");
         }
         else
         {
-            ImGui::DragInt("Max Depth", &maxDepth, 1, 0, 1000000);
+            ImGui::DragInt("Max Depth", &config.maxDepth, 1, 0, 1000000);
             if(ImGui::IsItemHovered())
                 ImGui::SetTooltip("Set Direct Integrator's Max Depth");
         }
 
+        ImGui::Separator();
+        ImGui::Text("Sampler");
+        ImGui::RadioButton("Random", &config.sampler, RANDOM_SAMPLER);
+        ImGui::SameLine();
+        ImGui::RadioButton("Sobol", &config.sampler, SOBOL_SAMPLER);
+        if(ImGui::IsItemHovered())
+            ImGui::SetTooltip("Owen-scrambled Sobol, decorrelated per pixel");
+        ImGui::SameLine();
+        ImGui::RadioButton("Blue Noise", &config.sampler, BLUE_NOISE_SAMPLER);
+        if(ImGui::IsItemHovered())
+            ImGui::SetTooltip("Sobol shifted per pixel by a blue noise mask, remaining noise is high frequency");
+
         ImGui::Separator();
         ImGui::Text("Post Effect");
-        ImGui::Checkbox("Gamma Correction", &enableGammaCorrection);
-        ImGui::Checkbox("Tone Mapping", &enableToneMapping);
+        ImGui::Checkbox("Gamma Correction", &config.enableGammaCorrection);
+        ImGui::Checkbox("Tone Mapping", &config.enableToneMapping);
+        ImGui::Checkbox("Denoise", &config.enableDenoise);
+        if(ImGui::IsItemHovered())
+            ImGui::SetTooltip("A-trous filter guided by albedo / normal / depth, runs when a frame finishes");
+        if(config.enableDenoise)
+        {
+            ImGui::SameLine();
+            ImGui::Checkbox("Temporal", &config.enableTemporalDenoise);
+            if(ImGui::IsItemHovered())
+                ImGui::SetTooltip("Blend with the previous keyframe where the scene is unchanged");
+        }
 
         ImGui::Separator();
         ImGui::Text("Primitive Set");
-        static int e1 = 0;
+        int e1 = !config.enableBVH ? 2 : (config.enableWideBVH ? 1 : 0);
         if(ImGui::RadioButton("BVH", &e1, 0))
-            enableBVH = true;
+        {
+            config.enableBVH = true;
+            config.enableWideBVH = false;
+        }
+        ImGui::SameLine();
+        if(ImGui::RadioButton("BVH4", &e1, 1))
+        {
+            config.enableBVH = true;
+            config.enableWideBVH = true;
+        }
+        if(ImGui::IsItemHovered())
+            ImGui::SetTooltip("Meshes use a 4-wide BVH with %s box / triangle tests", AtmosMeshBVH4::getKernelName());
         ImGui::SameLine();
-        if(ImGui::RadioButton("Exaustive", &e1, 1))
-            enableBVH = false;
+        if(ImGui::RadioButton("Exaustive", &e1, 2))
+            config.enableBVH = false;
+        ImGui::Checkbox("Compact Mesh", &config.enableCompactMesh);
+        if(ImGui::IsItemHovered())
+            ImGui::SetTooltip("Quantize mesh normals and uvs to save memory");
 
         ImGui::Separator();
         ImGui::Text("Status");
-        //ImGui::Text(("Time Elapsed: " + ofToString(ofGetElapsedTimef()) + "s").c_str());
-        //ImGui::Text("Time Remainning");
+        frameStatsData last;
+        if(stats.getLastFrame(last))
+        {
+            ImGui::Text("Last Render: %d frame(s) in %s", stats.getFinishedFrames(), formatSeconds(timer.difference()).c_str());
+            ImGui::Text("Last Frame: %s (render %s)", formatSeconds(last.getFrameSeconds()).c_str(),
+                        formatSeconds(last.seconds[A3_PHASE_RENDER]).c_str());
+        }
+        else
+            ImGui::Text("Idle");
 
         ImGui::PushID(0);
         ImGui::PushStyleColor(ImGuiCol_Button, ImColor::HSV(3 / 7.0f, 0.6f, 0.6f));
@@ -614,14 +595,14 @@ void ofApp::cameraMenu()
     if(ImGui::Begin("Camera", &openCameraWindow))
     {
         ImGui::Text("Matrix");
-        ImGui::DragFloat3("Lookat", cameraLookat, 1.0f);
-        ImGui::DragFloat3("Origin", cameraOrigin, 1.0f);
-        ImGui::DragFloat3("Up", cameraUp, 1.0f);
+        ImGui::DragFloat3("Lookat", config.cameraLookat, 1.0f);
+        ImGui::DragFloat3("Origin", config.cameraOrigin, 1.0f);
+        ImGui::DragFloat3("Up", config.cameraUp, 1.0f);
 
         ImGui::Separator();
         ImGui::Text("Lens");
-        ImGui::DragFloat("Focal Distance", &cameraFocalDistance, 1.0f, 0.0f);
-        ImGui::DragFloat("Lens Radius", &cameraLensRadius, 1.0f, 0.0f, 1000.0f);
+        ImGui::DragFloat("Focal Distance", &config.cameraFocalDistance, 1.0f, 0.0f);
+        ImGui::DragFloat("Lens Radius", &config.cameraLensRadius, 1.0f, 0.0f, 1000.0f);
     }
 
     ImGui::End();
@@ -1070,6 +1051,55 @@ void ofApp::lightDelete(int index)
     ImGui::PopID();
 }
 
+//--------------------------------------------------------------
+void ofApp::statisticsPanel()
+{
+    // 序列完成后不再计时
+    if(!renderingFinished)
+        timer.end();
+
+    double elapsed = scheduler.getElapsedSeconds();
+    double remaining = renderingFinished ? 0.0 : scheduler.getRemainingSeconds();
+
+    // 未开始的关键帧
+    int framesLeft = config.hasKeyFrame && !renderingFinished ? config.endFrame - currentFrame : 0;
+    double sequenceRemaining = -1.0;
+    if(remaining >= 0.0)
+        sequenceRemaining = stats.getSequenceRemaining(frameStats.getFrameSeconds() + elapsed, remaining, framesLeft);
+
+    ImGui::Separator();
+    ImGui::Text("Statistics");
+    ImGui::Text("Frame: %s elapsed, %s remaining", formatSeconds(elapsed).c_str(), formatSeconds(remaining).c_str());
+    ImGui::Text("Sequence: %s elapsed, %s remaining", formatSeconds(timer.difference()).c_str(),
+                formatSeconds(sequenceRemaining).c_str());
+
+    tileStatsData tiles = scheduler.getTileStats();
+    double seconds = std::max(elapsed, 1e-6);
+    ImGui::Text("Tiles: %d (min %.3fs / avg %.3fs / max %.3fs)", tiles.tiles,
+                tiles.minSeconds, tiles.getAverageSeconds(), tiles.maxSeconds);
+    ImGui::Text("Samples/s: %.2fM  Rays/s: %.2fM", tiles.samples / seconds * 1e-6, tiles.rays / seconds * 1e-6);
+    if(ImGui::IsItemHovered())
+        ImGui::SetTooltip("Rays include secondary / shadow rays, counted in BVH mode only");
+
+    arenaStatsData arena = atmos.getArenaStats();
+    ImGui::Text("Frame Arena: %.1fMB used / %.1fMB reserved in %d block(s)", arena.usedBytes / 1048576.0,
+                arena.reservedBytes / 1048576.0, (int) arena.blocks);
+    if(ImGui::IsItemHovered())
+        ImGui::SetTooltip("Keyframe meshes, plus BVH nodes of frames rendered in parallel, reset in one step between keyframes");
+
+    // 上一帧各阶段耗时 保存完成后更新
+    frameStatsData last;
+    if(stats.getLastFrame(last))
+    {
+        ImGui::Text("Frame %d:", last.frame);
+        for(int i = 0; i < A3_PHASE_COUNT; i++)
+        {
+            ImGui::SameLine();
+            ImGui::Text("%s %s", AtmosStats::getPhaseName(i), formatSeconds(last.seconds[i]).c_str());
+        }
+    }
+}
+
 //--------------------------------------------------------------
 void ofApp::renderingPanel()
 {
@@ -1080,7 +1110,7 @@ void ofApp::renderingPanel()
     {
         // 数据只读 UI不可写
         ImGui::Text("Key Frame");
-        int frameRange[2] = {startFrame, endFrame};
+        int frameRange[2] = {config.startFrame, config.endFrame};
         ImGui::DragInt2("Range", frameRange, 1.0f);
 
         int current = currentFrame;
@@ -1093,10 +1123,17 @@ void ofApp::renderingPanel()
         ImGui::SameLine(0.0f, ImGui::GetStyle().ItemInnerSpacing.x);
         ImGui::Text("Rendering Progress");
 
-        if(renderer && renderer->isFinished())
+        statisticsPanel();
+
+        if(renderingFinished)
         {
             ImGui::Separator();
-            ImGui::Text("Ready");
+
+            int pending = writer.getPendingFrames();
+            if(pending > 0)
+                ImGui::Text("Saving %d frame(s)...", pending);
+            else
+                ImGui::Text("Ready");
 
             ImGui::PushID(0);
             ImGui::PushStyleColor(ImGuiCol_Button, ImColor::HSV(3 / 7.0f, 0.6f, 0.6f));
@@ -1116,13 +1153,36 @@ void ofApp::renderingPanel()
         else
         {
             ImGui::Separator();
+
+            if(config.enableProgressive)
+            {
+                ImGui::Text("Pass %d/%d (%d spp done)", scheduler.getCurrentPass() + 1, scheduler.getNumPasses(),
+                            scheduler.getCompletedSamples());
+
+                // 停止于当前遍 已完成的采样即为有效图像
+                if(ImGui::Button("Stop And Save", ImVec2(ImGui::GetContentRegionAvailWidth(), 0)))
+                {
+                    scheduler.stop();
+
+                    tileData tile;
+                    while(scheduler.popTile(tile))
+                        updatePreview(tile);
+
+                    // 与正常完成的帧相同 已完成的采样同样去噪
+                    denoiseFrame();
+                    saveFrame(false);
+
+                    renderingFinished = true;
+                }
+            }
+
             ImGui::Text("Waiting");
 
             ImGui::PushID(0);
             ImGui::PushStyleColor(ImGuiCol_Button, ImColor::HSV(1 / 7.0f, 0.6f, 0.6f));
             ImGui::PushStyleColor(ImGuiCol_ButtonHovered, ImColor::HSV(1 / 7.0f, 0.7f, 0.7f));
             ImGui::PushStyleColor(ImGuiCol_ButtonActive, ImColor::HSV(1 / 7.0f, 0.8f, 0.8f));
-            string frameProgress = ofToString(currentFrame) + "/" + ofToString(endFrame - startFrame + 1);
+            string frameProgress = ofToString(currentFrame) + "/" + ofToString(config.endFrame - config.startFrame + 1);
             if(ImGui::Button(frameProgress.c_str(), ImVec2(ImGui::GetContentRegionAvailWidth(), 0)))
             {
                 a3Log::debug("Waiting...\n");
@@ -6,6 +6,13 @@
 #include "ThemeTest.h"
 #include "AtmosShapeData.h"
 #include "AtmosLightData.h"
+#include "AtmosRenderConfig.h"
+#include "AtmosSceneBuilder.h"
+#include "AtmosSceneIO.h"
+#include "AtmosFrameWriter.h"
+#include "AtmosTileScheduler.h"
+#include "AtmosStats.h"
+#include "AtmosDenoise.h"
 #include "util.h"
 
 class ofApp : public ofBaseApp
@@ -14,6 +21,7 @@ public:
     void setup();
     void update();
     void draw();
+    void exit();
 
     void keyPressed(int key);
     void keyReleased(int key);
@@ -57,17 +65,44 @@ public:
 
     // process of rendering
     void renderingPanel();
+    // 各阶段耗时 / 吞吐量 / 剩余时间
+    void statisticsPanel();
+    // 提交当前帧(与热力图)至写入线程
+    // complete为false时(中途停止)不写入指纹 下次渲染从检查点继续
+    // 启用去噪时去噪 重新写入输出帧并刷新预览 在saveFrame前调用
+    void denoiseFrame();
+    void saveFrame(bool complete);
+
+    // 序列的最后一帧
+    int getLastFrame() const;
+
+    // 转换已完成的网格并上传至预览纹理的对应区域
+    void updatePreview(const tileData& tile);
 
     // about window
     void about();
 
     // Atmos
-    a3GridRenderer* renderer;
-    a3Scene* scene;
+    AtmosSceneBuilder atmos;
+
+    // 需晚于writer析构: 写入线程保存完成时写入统计
+    AtmosStats stats;
+    // 渲染中的一帧 渲染与保存耗时在saveFrame中补全
+    frameStatsData frameStats;
+
+    AtmosFrameWriter writer;
+    AtmosTileScheduler scheduler;
+    AtmosDenoiser denoiser;
 
-    ofPixels previewPixels;
+    // 当前渲染中的输出帧及其场景指纹
+    AtmosFrameWriter::frameData* output;
+    uint64_t fingerprint;
+
+    // 预览纹理 仅上传已完成网格所在的子区域
     ofTexture preview;
+    std::vector<unsigned char> previewTile;
 
+    // 整个序列的耗时
     t3Timer timer;
 
     // ImGui
@@ -77,31 +112,11 @@ public:
     GLuint logoButtonID;
 
     // Atmos with ImGui
-    // config
-    int startFrame, endFrame;
-    int spp;
-    bool hasKeyFrame;
+    // config / image / integrator / primitive set / post effect / camera
+    renderConfigData config;
     bool startRendering;
-    int level[2];
-
-    // image
-    int imageWidth, imageHeight;
-    int localStartPos[2], localRenderSize[2];
-    char saveToPath[1024];
     char saveImageName[1024];
 
-    // integrator / primitive set
-    bool enablePath, enableBVH;
-    int maxDepth, russianRouletteDepth;
-
-    // post effect
-    bool enableGammaCorrection, enableToneMapping;
-
-    // camera
-    float cameraLookat[3], cameraOrigin[3], cameraUp[3];
-    float cameraFov;
-    float cameraFocalDistance, cameraLensRadius;
-    
     // shape
     vector<shapeData*> shapeList;
 
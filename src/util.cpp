@@ -1,5 +1,13 @@
 ﻿#include "util.h"
 #include <ofMain.h>
+#include <functional>
+#include <thread>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
 
 std::string addKeyFrameInPath(int keyFrame, std::string path)
 {
@@ -22,3 +30,8 @@ std::string addKeyFrameInPath(int keyFrame, std::string path)
     return pathWithoutName + baseName + extension;
 }
 
+std::string getTempPath(const std::string& path)
+{
+    size_t thread = std::hash<std::thread::id>()(std::this_thread::get_id());
+    return path + "." + ofToString(getpid()) + "-" + ofToString(thread) + ".tmp";
+}
@@ -17,4 +17,7 @@ int getNumOfDigits(const T& number)
     return count;
 }
 
-std::string addKeyFrameInPath(int keyFrame, std::string path);
\ No newline at end of file
+std::string addKeyFrameInPath(int keyFrame, std::string path);
+
+// 每个写入者(进程 + 线程)独立的临时文件名 多个进程同时写入同一缓存时互不覆盖
+std::string getTempPath(const std::string& path);